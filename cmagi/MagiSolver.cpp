@@ -1,8 +1,17 @@
+#include <algorithm>
+#include <limits>
+
 #include "MagiSolver.h"
 #include "gpsmoothing.h"
 #include "tgtdistr.h"
 #include "fullloglikelihood.h"
 #include "Sampler.h"
+#include "diagnostics.h"
+#include "checkpoint.h"
+#include "paralleltempering.h"
+#include "smc.h"
+#include "laplace.h"
+#include "xthetasigma.h"
 
 
 MagiSolver::MagiSolver(const arma::mat & yFull,
@@ -31,7 +40,41 @@ MagiSolver::MagiSolver(const arma::mat & yFull,
                        bool useFixedSigma,
                        bool skipMissingComponentOptimization,
                        bool positiveSystem,
-                       bool verbose) :
+                       bool verbose,
+                       std::string samplerMethod,
+                       const int maxTreeDepth,
+                       std::string adaptMethod,
+                       std::string metric,
+                       const double targetAcceptRate,
+                       const int nChains,
+                       const int seed,
+                       const int thin,
+                       std::string sampleFile,
+                       bool recordLlik,
+                       bool recordX,
+                       const arma::vec recordXComponents,
+                       const arma::vec recordXTimes,
+                       bool recordTheta,
+                       bool recordSigma,
+                       bool singlePrecision,
+                       bool continueEpochs,
+                       const double epochBurninRatio,
+                       std::string checkpointFile,
+                       const unsigned int checkpointEvery,
+                       const arma::vec temperatures,
+                       bool adaptTemperatures,
+                       std::string optimizerMethod,
+                       bool transformBounds,
+                       std::string integrator,
+                       std::string lengthAdaptation,
+                       std::string blocking,
+                       const unsigned int sgWindow,
+                       const double sgFriction,
+                       const double maxSeconds,
+                       const double targetEss,
+                       const double targetRhat,
+                       const unsigned int stopCheckEvery,
+                       const unsigned int smcMoves) :
         yFull(yFull),
         odeModel(odeModel),
         tvecFull(tvecFull),
@@ -56,13 +99,66 @@ MagiSolver::MagiSolver(const arma::mat & yFull,
         skipMissingComponentOptimization(skipMissingComponentOptimization),
         positiveSystem(positiveSystem),
         verbose(verbose),
+        samplerMethod(std::move(samplerMethod)),
+        maxTreeDepth(maxTreeDepth),
+        adaptMethod(std::move(adaptMethod)),
+        metric(std::move(metric)),
+        targetAcceptRate(targetAcceptRate),
+        nChains(nChains),
+        seed(seed),
+        thin(thin),
+        sampleFile(std::move(sampleFile)),
+        recordLlik(recordLlik),
+        recordX(recordX),
+        recordXComponents(recordXComponents),
+        recordXTimes(recordXTimes),
+        recordTheta(recordTheta),
+        recordSigma(recordSigma),
+        singlePrecision(singlePrecision),
+        continueEpochs(continueEpochs),
+        epochBurninRatio(epochBurninRatio),
+        checkpointFile(std::move(checkpointFile)),
+        checkpointEvery(checkpointEvery),
+        temperatures(temperatures),
+        adaptTemperatures(adaptTemperatures),
+        optimizerMethod(std::move(optimizerMethod)),
+        transformBounds(transformBounds),
+        integrator(std::move(integrator)),
+        lengthAdaptation(std::move(lengthAdaptation)),
+        blocking(std::move(blocking)),
+        sgWindow(sgWindow),
+        sgFriction(sgFriction),
+        maxSeconds(maxSeconds),
+        targetEss(targetEss),
+        targetRhat(targetRhat),
+        stopCheckEvery(stopCheckEvery),
+        smcMoves(smcMoves),
         ydim(yFull.n_cols),
         sigmaSize(useScalerSigma ? 1 : yFull.n_cols),
+        niterStored(this->samplerMethod == "map" ? 1 : thinnedLength(niterHmc, std::max(thin, 1))),
+        recordLayout(makeRecordLayout()),
         distSignedFull(tvecFull.size(), tvecFull.size()),
         indicatorRowWithObs(yFull.n_rows),
         indicatorMatWithObs(yFull.n_rows, yFull.n_cols, arma::fill::zeros),
+        summaryProbs({0.025, 0.5, 0.975}),
+        ladder(temperatures),
+        phase(phaseNone),
+        currentEpoch(0),
+        currentIter(0),
         // phiAllDimensions(2, yFull.n_cols),
-        llikxthetasigmaSamples(1 + yFull.size() + odeModel.thetaSize + sigmaSize, niterHmc, nEpoch)
+        llikxthetasigmaSamples(recordLayout.rows(),
+                               this->sampleFile.empty() && !singlePrecision ? niterStored * std::max(nChains, 1) : 0,
+                               nEpoch),
+        llikxthetasigmaSamplesFloat(recordLayout.rows(),
+                                    this->sampleFile.empty() && singlePrecision ? niterStored * std::max(nChains, 1) : 0,
+                                    nEpoch),
+        gradientsPerEss(odeModel.thetaSize, nEpoch),
+        thetaRhat(odeModel.thetaSize, nEpoch),
+        thetaBulkEss(odeModel.thetaSize, nEpoch),
+        thetaTailEss(odeModel.thetaSize, nEpoch),
+        swapAcceptRate(temperatures.empty() ? 0 : temperatures.size() - 1, nEpoch),
+        roundTripRate(nEpoch, arma::fill::zeros),
+        logEvidence(nEpoch)
 {
     // if(kernel != "generalMatern"){
     //     throw std::runtime_error("only generalMatern kernel has full support");
@@ -125,9 +221,116 @@ MagiSolver::MagiSolver(const arma::mat & yFull,
         throw std::runtime_error("kernel is not specified correctly");
     }
 
+    if(this->samplerMethod != "hmc" && this->samplerMethod != "nuts" && this->samplerMethod != "splithmc" &&
+       this->samplerMethod != "ellipticalslice" && this->samplerMethod != "sghmc" && this->samplerMethod != "smc" &&
+       this->samplerMethod != "map" && this->samplerMethod != "laplace"){
+        throw std::runtime_error("samplerMethod is not specified correctly");
+    }
+
+    if(this->metric == "band" && this->adaptMethod != "windowed"){
+        throw std::runtime_error("metric band needs adaptMethod windowed");
+    }
+
+    if(this->samplerMethod == "splithmc" && this->adaptMethod == "windowed" && this->metric != "diag"){
+        throw std::runtime_error("samplerMethod splithmc needs metric diag");
+    }
+
+    if(this->samplerMethod != "hmc" && this->samplerMethod != "nuts" && this->samplerMethod != "splithmc" &&
+       this->samplerMethod != "ellipticalslice" && !temperatures.empty()){
+        throw std::runtime_error("temperatures cannot be combined with samplerMethod " + this->samplerMethod);
+    }
+
+    if(transformBounds && this->samplerMethod == "splithmc"){
+        throw std::runtime_error("transformBounds cannot be combined with samplerMethod splithmc");
+    }
+
+    if(this->samplerMethod == "ellipticalslice" && (transformBounds || (this->adaptMethod == "windowed" && this->metric != "diag"))){
+        throw std::runtime_error("samplerMethod ellipticalslice needs metric diag and no transformBounds");
+    }
+
+    // integratorStages throws for unknown names
+    if(integratorStages(this->integrator) > 1 && this->samplerMethod != "hmc"){
+        throw std::runtime_error("integrator " + this->integrator + " needs samplerMethod hmc");
+    }
+
+    if(this->lengthAdaptation != "fixed" && this->lengthAdaptation != "jitter" && this->lengthAdaptation != "chees"){
+        throw std::runtime_error("lengthAdaptation is not specified correctly");
+    }
+    if(this->lengthAdaptation != "fixed" && this->samplerMethod != "hmc" && this->samplerMethod != "splithmc"){
+        throw std::runtime_error("lengthAdaptation " + this->lengthAdaptation + " needs samplerMethod hmc or splithmc");
+    }
+
+    if(this->samplerMethod == "sghmc"){
+        if(!useBand){
+            throw std::runtime_error("samplerMethod sghmc needs useBand");
+        }
+        if(this->adaptMethod != "legacy" || transformBounds){
+            throw std::runtime_error("samplerMethod sghmc needs adaptMethod legacy and no transformBounds");
+        }
+        if(sgWindow < 1 || sgFriction <= 0 || sgFriction > 1){
+            throw std::runtime_error("sgWindow must be at least 1 and sgFriction in (0, 1]");
+        }
+    }
+
+    if(maxSeconds < 0 || targetEss < 0 || (targetRhat != 0 && targetRhat < 1)){
+        throw std::runtime_error("maxSeconds and targetEss must be nonnegative, targetRhat 0 or at least 1");
+    }
+    if((maxSeconds > 0 || targetEss > 0 || targetRhat > 0) &&
+       (this->samplerMethod == "smc" || this->samplerMethod == "map" || this->samplerMethod == "laplace")){
+        throw std::runtime_error("stopping rules cannot be combined with samplerMethod " + this->samplerMethod);
+    }
+
+    if(this->blocking != "joint" && this->blocking != "components"){
+        throw std::runtime_error("blocking is not specified correctly");
+    }
+    if(this->blocking == "components"){
+        if(this->samplerMethod != "hmc" && this->samplerMethod != "nuts"){
+            throw std::runtime_error("blocking components needs samplerMethod hmc or nuts");
+        }
+        if(this->adaptMethod == "windowed" && this->metric != "diag"){
+            throw std::runtime_error("blocking components needs metric diag");
+        }
+        if(transformBounds || this->lengthAdaptation == "chees"){
+            throw std::runtime_error("blocking components cannot be combined with transformBounds or lengthAdaptation chees");
+        }
+    }
+
+    if(this->optimizerMethod != "lbfgsb" && this->optimizerMethod != "newton-cg"){
+        throw std::runtime_error("optimizerMethod is not specified correctly");
+    }
+    logEvidence.fill(arma::datum::nan);
+    epochIterations.zeros(nEpoch);
+    solveStart = std::chrono::steady_clock::now();
+
+    if(nChains < 1){
+        throw std::runtime_error("nChains must be at least 1");
+    }
+
+    if(thin < 1){
+        throw std::runtime_error("thin must be at least 1");
+    }
+
+    if(epochBurninRatio < 0 || epochBurninRatio >= 1){
+        throw std::runtime_error("epochBurninRatio must be in [0, 1)");
+    }
+
+    if(!temperatures.empty() && (temperatures(0) != 1 || arma::any(arma::diff(temperatures) <= 0))){
+        throw std::runtime_error("temperatures must start at 1 and increase");
+    }
+
+    if(!this->checkpointFile.empty() && checkpointEvery > 0 && this->sampleFile.empty()){
+        throw std::runtime_error("checkpointEvery needs a sampleFile to keep the draws out of the checkpoint");
+    }
+
+    if(!this->checkpointFile.empty() && checkpointExists(this->checkpointFile)){
+        loadCheckpoint();
+    }
 }
 
 void MagiSolver::setupPhiSigma() {
+    if(phase >= phasePhiSigma){
+        return;
+    }
     if(sigmaExogenous.empty() && phiExogenous.empty()){
         if(useScalerSigma){
             const arma::vec & phisig = gpsmooth(yObs,
@@ -237,9 +440,13 @@ void MagiSolver::setupPhiSigma() {
 
         
     }
+    completePhase(phasePhiSigma);
 }
 
 void MagiSolver::initXmudotmu() {
+    if(phase >= phaseXmudotmu){
+        return;
+    }
     arma::vec sigmaUsed(ydim);
     if(useScalerSigma){
         sigmaUsed.fill(sigmaInit(0));
@@ -296,9 +503,18 @@ void MagiSolver::initXmudotmu() {
             covAllDimensions[j].dotmu = dotmuExogenous.col(j);
         }
     }
+    completePhase(phaseXmudotmu);
 }
 
 void MagiSolver::initTheta() {
+    if(phase >= phaseTheta){
+        return;
+    }
+    fitThetaInit();
+    completePhase(phaseTheta);
+}
+
+void MagiSolver::fitThetaInit() {
     arma::vec sigmaUsed(ydim);
     if(useScalerSigma){
         sigmaUsed.fill(sigmaInit(0));
@@ -315,16 +531,21 @@ void MagiSolver::initTheta() {
                                       sigmaUsed,
                                       priorTemperature,
                                       xInit,
-                                      useBand);
+                                      useBand,
+                                      optimizerMethod == "newton-cg");
     }
 }
 
 void MagiSolver::initMissingComponent() {
+    if(phase >= phaseMissingComponent){
+        return;
+    }
     const unsigned int nSGD = 0;  // skip sgd, not useful, and produce unstable result due to delay eval of arma
     double learningRate = 1e-6;
     const arma::uvec & nobsEachDim = arma::sum(indicatorMatWithObs, 0).t();
     const arma::uvec & missingComponentDim = arma::find(nobsEachDim < 3);
     if(missingComponentDim.empty()){
+        completePhase(phaseMissingComponent);
         return;
     }
 
@@ -376,7 +597,7 @@ void MagiSolver::initMissingComponent() {
     }
 
     // update theta
-    initTheta();
+    fitThetaInit();
 
     // x for missing component
     lp llikOld = xthetaphisigmallik( xInit,
@@ -491,60 +712,729 @@ void MagiSolver::initMissingComponent() {
               << "; xthetaphisigmallik = " << llik.value
               << "; phi missing dim = \n" << phiAllDimensions.cols(missingComponentDim).t()
               << "\n";
+    completePhase(phaseMissingComponent);
+}
+
+// overdispersed starting point for an additional chain: jitter theta and sigma
+// on the log scale and x by a fraction of the noise level, within the bounds
+arma::vec MagiSolver::dispersedInit(const arma::vec & xthetasigmaInit, RandomStream & rng) {
+    arma::vec init = xthetasigmaInit;
+    const unsigned int thetaStart = yFull.size();
+    const unsigned int sigmaStart = thetaStart + odeModel.thetaSize;
+
+    arma::vec sigmaUsed(ydim);
+    if(useScalerSigma){
+        sigmaUsed.fill(sigmaInit(0));
+    }else{
+        sigmaUsed = sigmaInit;
+    }
+    for(unsigned j = 0; j < ydim; j++){
+        init.subvec(yFull.n_rows * j, yFull.n_rows * (j + 1) - 1) +=
+                0.5 * sigmaUsed(j) * rng.normal(yFull.n_rows);
+    }
+    if(positiveSystem){
+        init.subvec(0, thetaStart - 1) = arma::abs(init.subvec(0, thetaStart - 1));
+    }
+
+    arma::vec theta = init.subvec(thetaStart, sigmaStart - 1);
+    theta %= arma::exp(0.2 * rng.normal(theta.size()));
+    const arma::vec & width = odeModel.thetaUpperBound - odeModel.thetaLowerBound;
+    for(unsigned i = 0; i < theta.size(); i++){
+        double margin = 1e-3 * std::abs(theta(i));
+        if(std::isfinite(width(i))){
+            margin = std::min(margin, 1e-3 * width(i));
+        }
+        theta(i) = std::max(theta(i), odeModel.thetaLowerBound(i) + margin);
+        theta(i) = std::min(theta(i), odeModel.thetaUpperBound(i) - margin);
+    }
+    init.subvec(thetaStart, sigmaStart - 1) = theta;
+
+    if(!useFixedSigma){
+        init.subvec(sigmaStart, init.size() - 1) %=
+                arma::exp(0.2 * rng.normal(init.size() - sigmaStart));
+    }
+    return init;
+}
+
+// rows of the full column [llik, x, theta, sigma] kept in the stored draws
+RecordLayout MagiSolver::makeRecordLayout() const {
+    std::vector<arma::uword> rows;
+    if(recordLlik){
+        rows.push_back(0);
+    }
+    if(recordX){
+        if(arma::any(recordXComponents < 0) || arma::any(recordXTimes < 0)){
+            throw std::runtime_error("recordXComponents or recordXTimes out of range");
+        }
+        const arma::uvec & components = recordXComponents.empty() ?
+                                        arma::regspace<arma::uvec>(0, yFull.n_cols - 1) :
+                                        arma::uvec(arma::unique(arma::conv_to<arma::uvec>::from(recordXComponents)));
+        const arma::uvec & times = recordXTimes.empty() ?
+                                   arma::regspace<arma::uvec>(0, yFull.n_rows - 1) :
+                                   arma::uvec(arma::unique(arma::conv_to<arma::uvec>::from(recordXTimes)));
+        if(components.max() >= yFull.n_cols || times.max() >= yFull.n_rows){
+            throw std::runtime_error("recordXComponents or recordXTimes out of range");
+        }
+        for(unsigned j = 0; j < components.size(); j++){
+            for(unsigned i = 0; i < times.size(); i++){
+                rows.push_back(1 + components(j) * yFull.n_rows + times(i));
+            }
+        }
+    }
+    if(recordTheta){
+        for(unsigned i = 0; i < odeModel.thetaSize; i++){
+            rows.push_back(1 + yFull.size() + i);
+        }
+    }
+    if(recordSigma){
+        for(unsigned i = 0; i < sigmaSize; i++){
+            rows.push_back(1 + yFull.size() + odeModel.thetaSize + i);
+        }
+    }
+    return RecordLayout(1 + yFull.size() + odeModel.thetaSize + sigmaSize,
+                        arma::conv_to<arma::uvec>::from(rows), singlePrecision);
+}
+
+// burn-in iterations of an epoch, shorter once chains continue from the previous epoch
+unsigned int MagiSolver::epochBurnin(int iEpoch) const {
+    if(samplerMethod == "smc" || samplerMethod == "laplace"){
+        return 0;
+    }
+    const double ratio = continueEpochs && iEpoch > 0 ? epochBurninRatio : burninRatioHmc;
+    return static_cast<unsigned int>(niterHmc * ratio);
+}
+
+// start of the column major recorded rows x (niterStored * nChains) block of an epoch
+char * MagiSolver::epochSampleMemory(int iEpoch) {
+    const size_t epochBytes = recordLayout.elementBytes() * recordLayout.rows() * niterStored * nChains;
+    if(sampleFileMap){
+        return sampleFileMap->data() + epochBytes * iEpoch;
+    }
+    if(singlePrecision){
+        return reinterpret_cast<char *>(llikxthetasigmaSamplesFloat.slice_memptr(iEpoch));
+    }
+    return reinterpret_cast<char *>(llikxthetasigmaSamples.slice_memptr(iEpoch));
+}
+
+// xthetasigmallik of the stacked [x, theta, sigma] with the given prior temperatures
+lp MagiSolver::xthetasigmaLlik(const arma::vec & xthetasigma, const arma::vec & temperature) const {
+    const arma::mat & xlatent = arma::mat(const_cast<double*>(xthetasigma.memptr()), yFull.n_rows, ydim, false, false);
+    const arma::vec & theta = arma::vec(const_cast<double*>(xthetasigma.memptr() + yFull.size()), odeModel.thetaSize, false, false);
+    const arma::vec & sigma = arma::vec(const_cast<double*>(xthetasigma.memptr() + yFull.size() + odeModel.thetaSize), sigmaSize, false, false);
+    return xthetasigmallik(xlatent, theta, sigma, yFull, covAllDimensions, odeModel, temperature, useBand, useMean);
+}
+
+std::shared_ptr<Sampler> MagiSolver::makeSampler() const {
+    std::shared_ptr<Sampler> hmcSampler = std::make_shared<Sampler>(yFull,
+                                                                  covAllDimensions,
+                                                                  nstepsHmc,
+                                                                  loglikflag,
+                                                                  priorTemperature,
+                                                                  sigmaSize,
+                                                                  odeModel,
+                                                                  niterHmc,
+                                                                  burninRatioHmc,
+                                                                  positiveSystem);
+    hmcSampler->samplerMethod = samplerMethod;
+    hmcSampler->maxTreeDepth = maxTreeDepth;
+    hmcSampler->adaptMethod = adaptMethod;
+    hmcSampler->metric = metric;
+    hmcSampler->targetAcceptRate = targetAcceptRate;
+    hmcSampler->transformBounds = transformBounds;
+    hmcSampler->integrator = integrator;
+    hmcSampler->lengthAdaptation = lengthAdaptation;
+    hmcSampler->blocking = blocking;
+    hmcSampler->sgWindow = sgWindow;
+    hmcSampler->sgFriction = sgFriction;
+    return hmcSampler;
+}
+
+// writes straight into ncols columns of the epoch block, starting at firstColumn
+std::shared_ptr<SampleSink> MagiSolver::makeBlockSink(int iEpoch, unsigned int firstColumn, unsigned int ncols) {
+    const size_t columnOffset = recordLayout.elementBytes() * recordLayout.rows() * firstColumn;
+    if(sampleFileMap){
+        const size_t epochOffset = epochSampleMemory(iEpoch) - sampleFileMap->data();
+        return std::make_shared<MappedFileSink>(sampleFileMap, epochOffset + columnOffset, recordLayout, ncols);
+    }
+    return std::make_shared<InMemorySink>(epochSampleMemory(iEpoch) + columnOffset, recordLayout, ncols);
+}
+
+// the chain streams its draws straight into its own columns of the epoch block
+std::shared_ptr<SampleSink> MagiSolver::makeChainSink(int iEpoch, int c) {
+    std::shared_ptr<SampleSink> sink = makeBlockSink(iEpoch, niterStored * c, niterStored);
+    if(thin > 1){
+        sink = std::make_shared<ThinnedSink>(sink, thin);
+    }
+    return sink;
+}
+
+Sampler & MagiSolver::replica(int c, unsigned int k) {
+    if(k == 0){
+        return *chainSamplers[c];
+    }
+    return *hotReplicas[c * (ladder.temperature.size() - 1) + k - 1];
+}
+
+// task i always runs on the same worker, so a chain or replica keeps its thread
+void MagiSolver::runParallel(int ntasks, const std::function<void(int)> & task) {
+    if(ntasks == 1){
+        task(0);
+        return;
+    }
+    // model callbacks are evaluated concurrently, so they must be thread safe
+    if(!chainPool){
+        chainPool = std::make_shared<ThreadPool>(
+                std::min(static_cast<unsigned int>(ntasks), std::max(1u, std::thread::hardware_concurrency())));
+    }
+    std::vector<std::future<void>> pending;
+    for(int i = 0; i < ntasks; i++){
+        pending.push_back(chainPool->submitTo(i % chainPool->size(), std::bind(task, i)));
+    }
+    // wait for every chain before rethrowing, the tasks refer to locals of the caller
+    std::exception_ptr failure;
+    for(auto & chain : pending){
+        try {
+            chain.get();
+        } catch (...) {
+            if(!failure){
+                failure = std::current_exception();
+            }
+        }
+    }
+    if(failure){
+        std::rethrow_exception(failure);
+    }
+}
+
+// a round of swaps between neighbouring temperatures within each chain, even pairs
+// after even iterations and odd pairs after odd ones. In burn-in the ladder adapts
+// to the outcome, afterwards the log densities feed its variance estimates.
+void MagiSolver::swapReplicas(const unsigned int iter, const unsigned int burnin) {
+    const unsigned int nReplicas = ladder.temperature.size();
+    const arma::uvec attemptedBefore = swapAttempts;
+    const arma::uvec acceptedBefore = swapAccepts;
+    for(int c = 0; c < nChains; c++){
+        arma::vec logDensity(nReplicas);
+        for(unsigned int k = 0; k < nReplicas; k++){
+            logDensity(k) = replica(c, k).stateLogDensity();
+        }
+        swapNeighbours(ladder.temperature, logDensity, iter % 2, chainSamplers[c]->rng,
+                       [&](const unsigned int k) {
+                           replica(c, k).exchangeState(replica(c, k + 1));
+                           chainRoundTrips[c].exchange(k);
+                       },
+                       swapAttempts, swapAccepts);
+        chainRoundTrips[c].endRound();
+        if(iter >= burnin){
+            ladder.energy.update(logDensity);
+        }
+    }
+    if(adaptTemperatures && iter < burnin){
+        ladder.adapt(swapAttempts - attemptedBefore, swapAccepts - acceptedBefore);
+        for(int c = 0; c < nChains; c++){
+            for(unsigned int k = 1; k < nReplicas; k++){
+                replica(c, k).setTemperature(ladder.temperature(k));
+            }
+        }
+    }
 }
 
 void MagiSolver::doHMC(int iEpoch) {
-    Sampler hmcSampler(yFull,
-                       covAllDimensions,
-                       nstepsHmc,
-                       loglikflag,
-                       priorTemperature,
-                       sigmaSize,
-                       odeModel,
-                       niterHmc,
-                       burninRatioHmc,
-                       positiveSystem);
     arma::vec xthetasigmaInit = arma::join_vert(arma::join_vert(arma::vectorise(xInit), thetaInit), sigmaInit);
-    hmcSampler.sampleChian(xthetasigmaInit, stepLow, verbose);
-    llikxthetasigmaSamples(arma::span(0, 0), arma::span::all, arma::span(iEpoch, iEpoch)) = hmcSampler.lliklist;
-    llikxthetasigmaSamples(arma::span(1, llikxthetasigmaSamples.n_rows - 1), arma::span::all, arma::span(iEpoch, iEpoch)) = hmcSampler.xth;
-    stepLow = hmcSampler.stepLow;
+
+    const unsigned int burnin = epochBurnin(iEpoch);
+    const bool resume = continueEpochs && iEpoch > 0;
+    const unsigned int nrows = recordLayout.fullRows;
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(yFull.size(), yFull.size() + odeModel.thetaSize - 1);
+    chainSinks.resize(nChains);
+    chainSamplers.resize(nChains);
+    if(currentIter == 0 && adaptTemperatures && iEpoch > 0 && ladder.temperature.size() > 1){
+        // respace the adapted ladder to the number of temperatures its log density variances
+        // call for, with hot replicas started afresh on fresh streams if the number changes
+        const unsigned int nReplicas = ladder.recommendedSize(0.23);
+        if(nReplicas != ladder.temperature.size()){
+            ladder.temperature = ladder.respaced(nReplicas);
+            hotReplicas.clear();
+            replicaRng.clear();
+            for(int c = 0; c < nChains; c++){
+                for(unsigned int k = 1; k < nReplicas; k++){
+                    const uint64_t replicaSeed = (static_cast<uint64_t>(chainRng[c].nextUInt32()) << 32) |
+                                                 chainRng[c].nextUInt32();
+                    replicaRng.emplace_back(replicaSeed, k);
+                }
+            }
+            if(verbose){
+                std::cout << "doHMC epoch " << iEpoch << ": temperatures = " << ladder.temperature.t();
+            }
+        }
+    }
+    const unsigned int nReplicas = std::max(static_cast<unsigned int>(ladder.temperature.size()), 1u);
+    hotReplicas.resize(nChains * (nReplicas - 1));
+    if(nReplicas - 1 > swapAcceptRate.n_rows){
+        swapAcceptRate.resize(nReplicas - 1, nEpoch);
+    }
+    if(currentIter == 0){
+        ladder.restart();
+        chainRoundTrips.assign(nChains, RoundTripCounter(nReplicas));
+        swapAttempts.zeros(nReplicas - 1);
+        swapAccepts.zeros(nReplicas - 1);
+        chainSummaries.resize(nChains);
+        for(int c = 0; c < nChains; c++){
+            std::shared_ptr<Sampler> & hmcSampler = chainSamplers[c];
+            if(!resume || !hmcSampler){
+                hmcSampler = makeSampler();
+            }
+            // jitter the start before the sampler takes over the stream, so they share no draws
+            const arma::vec & chainInit = resume || c == 0 ? xthetasigmaInit : dispersedInit(xthetasigmaInit, chainRng[c]);
+            hmcSampler->rng = chainRng[c];
+            chainSinks[c] = makeChainSink(iEpoch, c);
+            hmcSampler->sink = chainSinks[c];
+            chainSummaries[c] = std::make_shared<OnlineSummary>(nrows - 1, summaryProbs, thetaIdx);
+            hmcSampler->summary = chainSummaries[c];
+            if(resume){
+                hmcSampler->startContinuation(burnin);
+            }else{
+                hmcSampler->startChian(chainInit, stepLow);
+            }
+
+            // hot replicas keep no draws and start where their chain does, with steps
+            // widened for the flatter target
+            for(unsigned int k = 1; k < nReplicas; k++){
+                const unsigned int idx = c * (nReplicas - 1) + k - 1;
+                std::shared_ptr<Sampler> & hot = hotReplicas[idx];
+                const bool fresh = !resume || !hot;
+                if(fresh){
+                    hot = makeSampler();
+                }
+                hot->setTemperature(ladder.temperature(k));
+                hot->rng = replicaRng[idx];
+                hot->sink = std::make_shared<NullSink>(nrows);
+                if(fresh){
+                    hot->startChian(chainInit, stepLow * std::sqrt(ladder.temperature(k)));
+                }else{
+                    hot->startContinuation(burnin);
+                }
+            }
+        }
+        currentIter = 1;
+    }else{
+        // resumed inside this epoch: samplers and summaries come from the checkpoint,
+        // the sinks reopen the epoch block after the draws kept so far
+        for(int c = 0; c < nChains; c++){
+            chainSinks[c] = makeChainSink(iEpoch, c);
+            chainSinks[c]->resume(chainSinkSizes.at(c));
+            chainSamplers[c]->sink = chainSinks[c];
+            chainSamplers[c]->summary = chainSummaries[c];
+        }
+        for(const auto & hot : hotReplicas){
+            hot->sink = std::make_shared<NullSink>(nrows);
+        }
+    }
+
+    // run the chains in segments of checkpointEvery iterations, checkpointing after each, and
+    // of stopCheckEvery iterations with a stopping rule, checking it after each
+    const unsigned int checkpointSegment = checkpointFile.empty() || checkpointEvery == 0 ? niterHmc : checkpointEvery;
+    const bool stopping = maxSeconds > 0 || targetEss > 0 || targetRhat > 0;
+    const unsigned int segment = stopping ? std::min(checkpointSegment, std::max(stopCheckEvery, 1u)) : checkpointSegment;
+    unsigned int nextCheckpoint = currentIter + checkpointSegment;
+    std::string stopped;
+    while(currentIter < niterHmc){
+        const unsigned int until = std::min({niterHmc, currentIter + segment, nextCheckpoint});
+        if(nReplicas > 1){
+            // one HMC move of every replica, then a round of swaps within each chain
+            for(unsigned int t = currentIter; t < until; t++){
+                runParallel(nChains * nReplicas, [&](const int i) {
+                    replica(i / nReplicas, i % nReplicas).advance(t + 1, verbose && i == 0);
+                });
+                swapReplicas(t, burnin);
+            }
+            for(unsigned int i = 0; i < hotReplicas.size(); i++){
+                replicaRng[i] = hotReplicas[i]->rng;
+            }
+        }else{
+            runParallel(nChains, [&](const int c) {
+                chainSamplers[c]->advance(until, verbose && c == 0);
+            });
+        }
+        for(int c = 0; c < nChains; c++){
+            chainRng[c] = chainSamplers[c]->rng;
+        }
+        currentIter = until;
+        if(stopping && currentIter < niterHmc){
+            stopped = stoppingRule(iEpoch, burnin);
+            if(!stopped.empty()){
+                break;
+            }
+        }
+        if(currentIter < niterHmc && currentIter >= nextCheckpoint){
+            saveCheckpoint();
+            nextCheckpoint = currentIter + checkpointSegment;
+        }
+    }
+    epochIterations(iEpoch) = currentIter;
+    stopReason = stopped;
+    if(!stopped.empty()){
+        arma::uvec kept(nChains);
+        for(int c = 0; c < nChains; c++){
+            kept(c) = chainSinks[c]->size();
+        }
+        fillNotTaken(iEpoch, kept);
+        for(const auto & sampler : chainSamplers){
+            sampler->stopRun();
+        }
+        for(const auto & hot : hotReplicas){
+            hot->stopRun();
+        }
+        if(verbose){
+            std::cout << "doHMC epoch " << iEpoch << ": stopped by " << stopped << " after "
+                      << currentIter << " iterations\n";
+        }
+    }
+    if(!stopped.empty() && currentIter <= burnin){
+        // the deadline cut the burn-in short: the warmup draws are no posterior draws, so the
+        // summaries of the epoch stay empty and the diagnostics below NaN
+        stopReason = "deadline in burn-in";
+    }
+
+    stepLow = chainSamplers[0]->stepLow;
+    double gradients = arma::sum(chainSamplers[0]->ngradlist.subvec(burnin, niterHmc - 1));
+    for(int c = 1; c < nChains; c++){
+        stepLow += chainSamplers[c]->stepLow;
+        gradients += arma::sum(chainSamplers[c]->ngradlist.subvec(burnin, niterHmc - 1));
+    }
+    stepLow /= nChains;
+    // hot replicas cost gradients too
+    for(const auto & hot : hotReplicas){
+        gradients += arma::sum(hot->ngradlist.subvec(burnin, niterHmc - 1));
+    }
+    if(nReplicas > 1){
+        swapAcceptRate.col(iEpoch).fill(arma::datum::nan);
+        swapAcceptRate.col(iEpoch).head(nReplicas - 1) =
+                arma::conv_to<arma::vec>::from(swapAccepts) /
+                arma::max(arma::conv_to<arma::vec>::from(swapAttempts), arma::ones(nReplicas - 1));
+        double roundTrips = 0;
+        for(const auto & counter : chainRoundTrips){
+            roundTrips += counter.roundTrips;
+        }
+        roundTripRate(iEpoch) = roundTrips / nChains / currentIter;
+    }
+
+    thetaDiagnostics(iEpoch, burnin);
+    gradientsPerEss.col(iEpoch) = gradients / thetaBulkEss.col(iEpoch);
+
+    if(verbose){
+        std::cout << "doHMC epoch " << iEpoch << ": split R-hat of theta = " << thetaRhat.col(iEpoch).t()
+                  << "bulk ESS of theta = " << thetaBulkEss.col(iEpoch).t()
+                  << "tail ESS of theta = " << thetaTailEss.col(iEpoch).t();
+    }
+}
+
+// convergence diagnostics of theta in the epoch so far, from the draws after burn-in, one
+// column per chain
+void MagiSolver::thetaDiagnostics(const int iEpoch, const unsigned int burnin) {
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(yFull.size(), yFull.size() + odeModel.thetaSize - 1);
+    bool thetaRecorded = true;
+    for(unsigned int i = 0; i < thetaIdx.size(); i++){
+        thetaRecorded = thetaRecorded && recordLayout.keeps(1 + thetaIdx(i));
+    }
+    if(chainSinks[0]->size() < chainSinks[0]->columnsBefore(burnin) + 4){
+        // a deadline in the burn-in leaves too few draws to diagnose
+        thetaRhat.col(iEpoch).fill(arma::datum::nan);
+        thetaBulkEss.col(iEpoch).fill(arma::datum::nan);
+        thetaTailEss.col(iEpoch).fill(arma::datum::nan);
+    }else if(thetaRecorded){
+        std::vector<arma::mat> chainTheta;
+        for(int c = 0; c < nChains; c++){
+            chainTheta.push_back(chainSinks[c]->samples(thetaIdx + 1).cols(
+                    chainSinks[c]->columnsBefore(burnin), chainSinks[c]->size() - 1).t());
+        }
+        for(unsigned int i = 0; i < odeModel.thetaSize; i++){
+            arma::mat draws(chainTheta[0].n_rows, nChains);
+            for(int c = 0; c < nChains; c++){
+                draws.col(c) = chainTheta[c].col(i);
+            }
+            thetaRhat(i, iEpoch) = splitRhat(draws);
+            thetaBulkEss(i, iEpoch) = bulkEffectiveSampleSize(draws);
+            thetaTailEss(i, iEpoch) = tailEffectiveSampleSize(draws);
+        }
+    }else{
+        // without stored theta only the running autocovariances are available
+        thetaRhat.col(iEpoch).fill(arma::datum::nan);
+        thetaBulkEss.col(iEpoch) = pooledEffectiveSampleSize(chainSummaries);
+        thetaTailEss.col(iEpoch).fill(arma::datum::nan);
+    }
+}
+
+bool MagiSolver::deadlinePassed() const {
+    return maxSeconds > 0 &&
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - solveStart).count() >= maxSeconds;
+}
+
+// the rule that ends the current epoch now, empty if none. Only the deadline stops the burn-in;
+// the diagnostics wait for a few draws after it.
+std::string MagiSolver::stoppingRule(const int iEpoch, const unsigned int burnin) {
+    if(deadlinePassed()){
+        return "deadline";
+    }
+    if(currentIter <= burnin){
+        return "";
+    }
+    if(chainSinks[0]->size() - chainSinks[0]->columnsBefore(burnin) < 4 || (targetEss <= 0 && targetRhat <= 0)){
+        return "";
+    }
+    thetaDiagnostics(iEpoch, burnin);
+    const arma::vec & ess = thetaBulkEss.col(iEpoch);
+    const arma::vec & rhat = thetaRhat.col(iEpoch);
+    if(targetEss > 0 && ess.is_finite() && ess.min() >= targetEss){
+        return "ess";
+    }
+    if(targetRhat > 0 && rhat.is_finite() && rhat.max() <= targetRhat){
+        return "rhat";
+    }
+    return "";
+}
+
+// the columns of chain c past its first keptPerChain(c) draws, not taken as a stopping rule
+// ended the epoch, are set to NaN
+void MagiSolver::fillNotTaken(const int iEpoch, const arma::uvec & keptPerChain) {
+    char * block = epochSampleMemory(iEpoch);
+    const size_t rows = recordLayout.rows();
+    for(int c = 0; c < nChains; c++){
+        const size_t first = (static_cast<size_t>(niterStored) * c + keptPerChain(c)) * rows;
+        const size_t count = (niterStored - keptPerChain(c)) * rows;
+        if(singlePrecision){
+            std::fill_n(reinterpret_cast<float *>(block) + first, count, std::numeric_limits<float>::quiet_NaN());
+        }else{
+            std::fill_n(reinterpret_cast<double *>(block) + first, count, arma::datum::nan);
+        }
+    }
+}
+
+// tempered SMC from the GP prior of x to the posterior, along
+// log pi_lambda = llik with the derivative and observation terms weighted by lambda
+//                 + (1 - lambda) log q(theta, sigma).
+// theta and sigma have flat priors, so pi_0 holds them by a reference q centred at the
+// current initial values: a normal for each theta truncated to its bounds and a log normal
+// for each sigma. The particles fill the epoch block in order, split into nChains summaries.
+void MagiSolver::doSMC(int iEpoch) {
+    const unsigned int n = yFull.n_rows;
+    const unsigned int xSize = yFull.size();
+    const unsigned int thetaSize = odeModel.thetaSize;
+    const unsigned int nParticles = niterStored * nChains;
+    const unsigned int nrows = recordLayout.fullRows;
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(xSize, xSize + thetaSize - 1);
+    const double inf = arma::datum::inf;
+    const double log2pi = std::log(2 * arma::datum::pi);
+
+    // reference q of theta and sigma
+    const arma::vec thetaCentre = arma::vectorise(thetaInit);
+    const arma::vec & thetaScale = 0.5 * arma::abs(thetaCentre) + 0.01;
+    arma::vec thetaLogMass(thetaSize);
+    for(unsigned i = 0; i < thetaSize; i++){
+        const double upper = (odeModel.thetaUpperBound(i) - thetaCentre(i)) / thetaScale(i);
+        const double lower = (odeModel.thetaLowerBound(i) - thetaCentre(i)) / thetaScale(i);
+        thetaLogMass(i) = std::log(0.5 * (std::erfc(-upper / std::sqrt(2.0)) - std::erfc(-lower / std::sqrt(2.0))));
+    }
+    const arma::vec logSigmaCentre = arma::log(sigmaInit);
+    const double sigmaLogSd = 0.5;
+    auto reference = [&](const arma::vec & xthetasigma) {
+        lp ret(0.0);
+        ret.gradient.zeros(xthetasigma.size());
+        const arma::vec & u = (xthetasigma.subvec(xSize, xSize + thetaSize - 1) - thetaCentre) / thetaScale;
+        ret.value = arma::accu(-0.5 * arma::square(u) - arma::log(thetaScale) - thetaLogMass) - 0.5 * log2pi * thetaSize;
+        ret.gradient.subvec(xSize, xSize + thetaSize - 1) = -u / thetaScale;
+        if(!useFixedSigma){
+            const arma::vec & sigma = xthetasigma.tail(sigmaSize);
+            const arma::vec & v = (arma::log(sigma) - logSigmaCentre) / sigmaLogSd;
+            ret.value += arma::accu(-0.5 * arma::square(v) - arma::log(sigma))
+                         - sigmaSize * (std::log(sigmaLogSd) + 0.5 * log2pi);
+            ret.gradient.tail(sigmaSize) = -(v / sigmaLogSd + 1) / sigma;
+        }
+        return ret;
+    };
+
+    TemperedSmc smc;
+    xthetasigmaBounds(smc.lb, smc.ub);
+    smc.nsteps = nstepsHmc;
+    smc.nMoves = smcMoves;
+
+    const arma::vec levelOnly = {inf, priorTemperature(1), inf};
+    const arma::vec likelihoodOnly = {priorTemperature(0), inf, priorTemperature(2)};
+    smc.target = [&](const arma::vec & xthetasigma, const double lambda) {
+        const arma::vec temperature = {priorTemperature(0) / lambda, priorTemperature(1), priorTemperature(2) / lambda};
+        lp ret = xthetasigmaLlik(xthetasigma, temperature);
+        if(lambda < 1){
+            const lp & q = reference(xthetasigma);
+            ret.value += (1 - lambda) * q.value;
+            ret.gradient += (1 - lambda) * q.gradient;
+        }
+        return ret;
+    };
+    smc.slope = [&](const arma::vec & xthetasigma) {
+        return xthetasigmaLlik(xthetasigma, likelihoodOnly).value - reference(xthetasigma).value;
+    };
+
+    // x is drawn from its GP prior N(mu, priorTemperature(1) C), so a particle's weight is
+    // the banded level term over the exact prior density
+    std::vector<arma::mat> covFactor(ydim);
+    double logNormaliser = 0;
+    for(unsigned j = 0; j < ydim; j++){
+        const arma::mat & C = covAllDimensions[j].C;
+        double jitter = 1e-10 * arma::mean(C.diag());
+        while(!arma::chol(covFactor[j], C + jitter * arma::eye(n, n), "lower")){
+            jitter *= 10;
+            if(jitter > 1e-2 * arma::mean(C.diag())){
+                throw std::runtime_error("doSMC: GP covariance is not positive definite");
+            }
+        }
+        logNormaliser += arma::accu(arma::log(covFactor[j].diag())) + 0.5 * n * std::log(2 * arma::datum::pi * priorTemperature(1));
+    }
+
+    const uint64_t smcSeed = (static_cast<uint64_t>(chainRng[0].nextUInt32()) << 32) | chainRng[0].nextUInt32();
+    // the engine takes streams 0 to nParticles
+    RandomStream initRng(smcSeed, nParticles + 1);
+    arma::mat initial(xSize + thetaSize + sigmaSize, nParticles);
+    arma::vec initialLogWeights(nParticles);
+    for(unsigned int i = 0; i < nParticles; i++){
+        arma::vec xthetasigma(initial.n_rows);
+        double quadratic = 0;
+        for(unsigned j = 0; j < ydim; j++){
+            const arma::vec & e = initRng.normal(n);
+            quadratic += arma::dot(e, e);
+            xthetasigma.subvec(n * j, n * (j + 1) - 1) = std::sqrt(priorTemperature(1)) * covFactor[j] * e;
+            if(useMean){
+                xthetasigma.subvec(n * j, n * (j + 1) - 1) += covAllDimensions[j].mu;
+            }
+        }
+        for(unsigned k = 0; k < thetaSize; k++){
+            double theta;
+            unsigned int tries = 0;
+            do {
+                if(++tries > 10000){
+                    throw std::runtime_error("doSMC: thetaInit is far outside the theta bounds");
+                }
+                theta = thetaCentre(k) + thetaScale(k) * initRng.normal();
+            } while(theta < odeModel.thetaLowerBound(k) || theta > odeModel.thetaUpperBound(k));
+            xthetasigma(xSize + k) = theta;
+        }
+        if(useFixedSigma){
+            xthetasigma.tail(sigmaSize) = sigmaInit;
+        }else{
+            xthetasigma.tail(sigmaSize) = arma::exp(logSigmaCentre + sigmaLogSd * initRng.normal(sigmaSize));
+        }
+        initial.col(i) = xthetasigma;
+        if(arma::any(xthetasigma < smc.lb) || arma::any(xthetasigma > smc.ub)){
+            initialLogWeights(i) = -inf;
+        }else{
+            initialLogWeights(i) = xthetasigmaLlik(xthetasigma, levelOnly).value + 0.5 * quadratic + logNormaliser;
+        }
+    }
+
+    // model callbacks are evaluated concurrently, so they must be thread safe
+    if(!chainPool){
+        chainPool = std::make_shared<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    smc.run(initial, initialLogWeights, smcSeed, chainPool.get(), verbose);
+
+    chainSinks.assign(1, makeBlockSink(iEpoch, 0, nParticles));
+    chainSummaries.resize(nChains);
+    for(int c = 0; c < nChains; c++){
+        chainSummaries[c] = std::make_shared<OnlineSummary>(nrows - 1, summaryProbs, thetaIdx);
+    }
+    for(unsigned int i = 0; i < nParticles; i++){
+        chainSinks[0]->push(i, smc.logDensity(i), smc.particles.col(i));
+        chainSummaries[i / niterStored]->update(smc.particles.col(i));
+    }
+
+    // the particles are one weighted sample rather than chains, so only their ESS applies
+    logEvidence(iEpoch) = smc.logEvidence;
+    thetaRhat.col(iEpoch).fill(arma::datum::nan);
+    thetaBulkEss.col(iEpoch).fill(smc.finalEss);
+    thetaTailEss.col(iEpoch).fill(arma::datum::nan);
+    gradientsPerEss.col(iEpoch).fill(arma::accu(smc.ngrad) / smc.finalEss);
+
+    if(verbose){
+        std::cout << "doSMC epoch " << iEpoch << ": " << smc.lambdas.size() << " stages, ESS = " << smc.finalEss
+                  << ", log evidence = " << smc.logEvidence << "\n";
+    }
 }
 
 void MagiSolver::sampleInEpochs() {
     std::string epochMethod = "mean";
 
-    stepLow = arma::vec(llikxthetasigmaSamples.n_rows - 1);
-    if (stepSizeFactorHmc.n_elem > 1){
-      stepLow = (1.0 / nstepsHmc * stepSizeFactorHmc);
-    }else{
-      stepLow.fill(1.0 / nstepsHmc * stepSizeFactorHmc(0));
-    }
-    if(useFixedSigma){
-        stepLow.subvec(xInit.size() + thetaInit.size(), stepLow.size() - 1).fill(0);
-    }
-
-    for(int iEpoch = 0; iEpoch < nEpoch; iEpoch++){
-        doHMC(iEpoch);
-        const arma::mat & xthetasigmaSamples = llikxthetasigmaSamples(
-                arma::span(1, llikxthetasigmaSamples.n_rows - 1), arma::span::all, arma::span(iEpoch, iEpoch));
-        // update mu and dotmu
-        arma::mat xPosteriorMean = arma::mean(
-                xthetasigmaSamples(
-                        arma::span(0, yFull.size() - 1),
-                        arma::span(static_cast<int>(niterHmc * burninRatioHmc), niterHmc - 1)),
-                1);
+    // a resumed solve takes its step sizes, streams and progress from the checkpoint
+    const bool resumed = phase >= phaseSampling;
+    if(!resumed){
+        stepLow = arma::vec(yFull.size() + odeModel.thetaSize + sigmaSize);
+        if (stepSizeFactorHmc.n_elem > 1){
+          stepLow = (1.0 / nstepsHmc * stepSizeFactorHmc);
+        }else{
+          stepLow.fill(1.0 / nstepsHmc * stepSizeFactorHmc(0));
+        }
+        if(useFixedSigma){
+            stepLow.subvec(xInit.size() + thetaInit.size(), stepLow.size() - 1).fill(0);
+        }
+
+        const uint64_t streamSeed = resolveSeed(seed);
+        chainRng.clear();
+        for(int c = 0; c < nChains; c++){
+            chainRng.emplace_back(streamSeed, c);
+        }
+        ladder = TemperatureLadder(temperatures);
+        replicaRng.clear();
+        for(int i = 0; i < nChains * std::max(static_cast<int>(temperatures.size()) - 1, 0); i++){
+            replicaRng.emplace_back(streamSeed, nChains + i);
+        }
+        chainSamplers.clear();
+        hotReplicas.clear();
+        currentEpoch = 0;
+        currentIter = 0;
+    }
+
+    if(!sampleFile.empty()){
+        // the draws of finished segments are already in the file when resuming
+        sampleFileMap = std::make_shared<MappedFile>(
+                sampleFile, recordLayout.elementBytes() * recordLayout.rows() * niterStored * nChains * nEpoch, resumed);
+    }
+    phase = phaseSampling;
+
+    for(int iEpoch = currentEpoch; iEpoch < nEpoch; iEpoch++){
+        // past the deadline the remaining epochs are skipped, the results stay those of the last one
+        if(iEpoch > 0 && currentIter == 0 && deadlinePassed()){
+            for(int e = iEpoch; e < nEpoch; e++){
+                fillNotTaken(e, arma::zeros<arma::uvec>(nChains));
+                thetaRhat.col(e).fill(arma::datum::nan);
+                thetaBulkEss.col(e).fill(arma::datum::nan);
+                thetaTailEss.col(e).fill(arma::datum::nan);
+                gradientsPerEss.col(e).fill(arma::datum::nan);
+            }
+            stopReason = "deadline";
+            break;
+        }
+        if(samplerMethod == "smc"){
+            doSMC(iEpoch);
+        }else{
+            doHMC(iEpoch);
+        }
+        if(stopReason == "deadline in burn-in"){
+            // nothing to update mu, dotmu and the initial values from, and no time for more epochs
+            for(int e = iEpoch + 1; e < nEpoch; e++){
+                fillNotTaken(e, arma::zeros<arma::uvec>(nChains));
+                thetaRhat.col(e).fill(arma::datum::nan);
+                thetaBulkEss.col(e).fill(arma::datum::nan);
+                thetaTailEss.col(e).fill(arma::datum::nan);
+                gradientsPerEss.col(e).fill(arma::datum::nan);
+            }
+            break;
+        }
+        const unsigned int burnin = epochBurnin(iEpoch);
+        // update mu and dotmu, pooling the running means of all chains
+        const arma::vec & xthetasigmaPosteriorMean = pooledMean(chainSummaries);
+        arma::mat xPosteriorMean = xthetasigmaPosteriorMean.subvec(0, yFull.size() - 1);
         xPosteriorMean.reshape(yFull.n_rows, yFull.n_cols);
-        arma::vec thetaPosteriorMean = arma::mean(
-                xthetasigmaSamples(
-                        arma::span(yFull.size(), yFull.size() + thetaInit.size() - 1),
-                        arma::span(static_cast<int>(niterHmc * burninRatioHmc), niterHmc - 1)),
-                1);
-        arma::vec sigmaPosteriorMean = arma::mean(
-                xthetasigmaSamples(
-                        arma::span(yFull.size() + thetaInit.size(), xthetasigmaSamples.n_rows - 1),
-                        arma::span(static_cast<int>(niterHmc * burninRatioHmc), niterHmc - 1)),
-                1);
+        arma::vec thetaPosteriorMean = xthetasigmaPosteriorMean.subvec(yFull.size(), yFull.size() + thetaInit.size() - 1);
+        arma::vec sigmaPosteriorMean = xthetasigmaPosteriorMean.subvec(yFull.size() + thetaInit.size(),
+                                                                       xthetasigmaPosteriorMean.size() - 1);
 
         // TODO allow median or numerical solver
         for(unsigned long j = 0; j < covAllDimensions.size(); j++){
@@ -561,24 +1451,509 @@ void MagiSolver::sampleInEpochs() {
                 covAllDimensions[j].dotmu = dotxOde.col(j);
             }
         }else if(epochMethod == "bar_f_x"){
+            // needs every x recorded
+            const arma::uvec & xRows = arma::regspace<arma::uvec>(1, yFull.size());
             arma::mat dotxOde(yFull.n_rows, yFull.n_cols, arma::fill::zeros);
-            for(unsigned it = static_cast<int>(niterHmc * burninRatioHmc); it < niterHmc; it++){
-                dotxOde += odeModel.fOde(
-                        thetaPosteriorMean,
-                        arma::reshape(xthetasigmaSamples(
-                                arma::span(0, yFull.size() - 1),
-                                arma::span(it, it)
-                        ), yFull.n_rows, yFull.n_cols),
-                        tvecFull);
+            unsigned int nkept = 0;
+            for(const auto & sink : chainSinks){
+                const arma::mat & xDraws = sink->samples(xRows);
+                for(unsigned it = sink->columnsBefore(burnin); it < sink->size(); it++){
+                    dotxOde += odeModel.fOde(thetaPosteriorMean,
+                                             arma::reshape(xDraws.col(it), yFull.n_rows, yFull.n_cols),
+                                             tvecFull);
+                    nkept++;
+                }
             }
-            dotxOde /= niterHmc - static_cast<int>(niterHmc * burninRatioHmc);
+            dotxOde /= nkept;
             for(unsigned long j = 0; j < covAllDimensions.size(); j++) {
                 covAllDimensions[j].dotmu = dotxOde.col(j);
             }
         }
 
+        // the chains carry over to the next epoch, only their cached log densities are stale
+        for(const auto & sampler : chainSamplers){
+            sampler->invalidateCache();
+        }
+        for(const auto & hot : hotReplicas){
+            hot->invalidateCache();
+        }
+
         xInit = xPosteriorMean;
         thetaInit = thetaPosteriorMean;
         sigmaInit = sigmaPosteriorMean;
+
+        currentEpoch = iEpoch + 1;
+        currentIter = 0;
+        if(!checkpointFile.empty()){
+            saveCheckpoint();
+        }
+    }
+
+    if(stopReason == "deadline in burn-in"){
+        xthetasigmaMean = arma::vec(chainSummaries[0]->mean.size()).fill(arma::datum::nan);
+        xthetasigmaSd = xthetasigmaMean;
+        xthetasigmaQuantiles = arma::mat(xthetasigmaMean.size(), summaryProbs.size()).fill(arma::datum::nan);
+        thetaOnlineEss = arma::vec(odeModel.thetaSize).fill(arma::datum::nan);
+    }else if(!chainSummaries.empty()){
+        xthetasigmaMean = pooledMean(chainSummaries);
+        xthetasigmaSd = arma::sqrt(pooledVariance(chainSummaries));
+        xthetasigmaQuantiles = pooledQuantiles(chainSummaries);
+        if(samplerMethod == "smc"){
+            // resampled particles come in runs of copies, which the autocovariances would take for correlation
+            thetaOnlineEss = thetaBulkEss.col(nEpoch - 1);
+        }else{
+            thetaOnlineEss = pooledEffectiveSampleSize(chainSummaries);
+        }
+    }
+}
+
+// support of [x, theta, sigma], as in Sampler
+void MagiSolver::xthetasigmaBounds(arma::vec & lb, arma::vec & ub) const {
+    const unsigned int xSize = yFull.size();
+    const unsigned int thetaSize = odeModel.thetaSize;
+    lb.set_size(xSize + thetaSize + sigmaSize);
+    lb.head(xSize).fill(positiveSystem ? 0 : -arma::datum::inf);
+    lb.subvec(xSize, xSize + thetaSize - 1) = odeModel.thetaLowerBound;
+    lb.tail(sigmaSize).fill(1e-7);
+    ub.set_size(lb.size());
+    ub.fill(arma::datum::inf);
+    // bounds of x on the model, per component or per element, narrow the ones above
+    if(!odeModel.xLowerBound.empty()){
+        lb.head(xSize) = arma::max(lb.head(xSize), OdeSystem::xBoundElements(odeModel.xLowerBound, yFull.n_rows, yFull.n_cols));
+    }
+    if(!odeModel.xUpperBound.empty()){
+        ub.head(xSize) = arma::min(ub.head(xSize), OdeSystem::xBoundElements(odeModel.xUpperBound, yFull.n_rows, yFull.n_cols));
+    }
+    ub.subvec(xSize, xSize + thetaSize - 1) = odeModel.thetaUpperBound;
+}
+
+// independent draws from the Laplace approximation at mode, truncated to the bounds by
+// rejection. With x ordered by time point the Hessian of the band likelihood is banded in
+// x: a draw of x(t) couples to x(t') through Cinv and, via the derivative residual, through
+// mphi' Kinv mphi, so within 3 * bandSize time points. theta and the free sigma form its
+// dense border. Chain c fills its columns from its own stream.
+void MagiSolver::drawLaplace(int iEpoch, const arma::vec & mode, const double modeLlik) {
+    const unsigned int n = yFull.n_rows;
+    const unsigned int xSize = yFull.size();
+    const unsigned int nFree = xSize + odeModel.thetaSize + (useFixedSigma ? 0 : sigmaSize);
+    const unsigned int nrows = recordLayout.fullRows;
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(xSize, xSize + odeModel.thetaSize - 1);
+
+    // coordinate of [x, theta, sigma] at each position of the Hessian, x(t, j) at t * ydim + j
+    arma::uvec order(nFree);
+    arma::vec scale(nFree);
+    for(unsigned j = 0; j < ydim; j++){
+        const arma::vec & xj = mode.subvec(n * j, n * (j + 1) - 1);
+        const double xScale = arma::max(arma::abs(xj)) > 0 ? arma::max(arma::abs(xj)) : 1.0;
+        for(unsigned t = 0; t < n; t++){
+            order(t * ydim + j) = n * j + t;
+            scale(t * ydim + j) = xScale;
+        }
+    }
+    for(unsigned i = xSize; i < nFree; i++){
+        order(i) = i;
+        scale(i) = mode(i) != 0 ? std::abs(mode(i)) : 1.0;
+    }
+    unsigned int bandwidth = xSize - 1;
+    if(useBand){
+        int widest = 0;
+        for(const auto & cov : covAllDimensions){
+            widest = std::max(widest, cov.bandsize);
+        }
+        bandwidth = (3 * widest + 1) * ydim - 1;
+    }
+
+    auto negativeGradient = [&](const arma::vec & free) -> arma::vec {
+        arma::vec xthetasigma = mode;
+        xthetasigma.elem(order) = free;
+        return -xthetasigmaLlik(xthetasigma, priorTemperature).gradient.elem(order);
+    };
+    const arma::vec & modeFree = mode.elem(order);
+    const ArrowheadCholesky hessianFactor(finiteDifferenceHessian(negativeGradient, modeFree, scale, xSize, bandwidth));
+    logEvidence(iEpoch) = modeLlik + 0.5 * nFree * std::log(2 * arma::datum::pi) - 0.5 * hessianFactor.logDeterminant();
+
+    arma::vec lb, ub;
+    xthetasigmaBounds(lb, ub);
+    chainSinks.resize(nChains);
+    chainSummaries.resize(nChains);
+    runParallel(nChains, [&](const int c) {
+        chainSinks[c] = makeBlockSink(iEpoch, niterStored * c, niterStored);
+        chainSummaries[c] = std::make_shared<OnlineSummary>(nrows - 1, summaryProbs, thetaIdx);
+        for(unsigned int i = 0; i < niterStored; i++){
+            arma::vec draw = mode;
+            unsigned int tries = 0;
+            do {
+                if(++tries > 1000){
+                    throw std::runtime_error("drawLaplace: the Laplace approximation has almost no mass within the bounds");
+                }
+                draw.elem(order) = modeFree + hessianFactor.solveTransposed(chainRng[c].normal(nFree));
+            } while(arma::any(draw < lb) || arma::any(draw > ub));
+            const double llik = recordLayout.keeps(0) ? xthetasigmaLlik(draw, priorTemperature).value : arma::datum::nan;
+            chainSinks[c]->push(i, llik, draw);
+            chainSummaries[c]->update(draw);
+        }
+    });
+
+    // the draws are independent
+    thetaRhat.col(iEpoch).fill(arma::datum::nan);
+    thetaBulkEss.col(iEpoch).fill(niterStored * nChains);
+    thetaTailEss.col(iEpoch).fill(niterStored * nChains);
+    if(verbose){
+        std::cout << "drawLaplace epoch " << iEpoch << ": log evidence = " << logEvidence(iEpoch) << "\n";
+    }
+}
+
+// point estimate in place of draws: every chain maximises xthetasigmallik with the band
+// approximation jointly over x, theta and sigma by L-BFGS-B, chain c > 0 from a dispersed
+// start, and keeps its optimum as its single column of the epoch block, or with samplerMethod
+// "laplace" the chains draw from the Laplace approximation at the best optimum instead.
+// Between epochs mu and dotmu move to the best optimum, as the posterior mean does in sampleInEpochs.
+void MagiSolver::optimizeInEpochs() {
+    const bool resumed = phase >= phaseSampling;
+    if(!resumed){
+        const uint64_t streamSeed = resolveSeed(seed);
+        chainRng.clear();
+        for(int c = 0; c < nChains; c++){
+            chainRng.emplace_back(streamSeed, c);
+        }
+        currentEpoch = 0;
+        currentIter = 0;
+    }
+    if(!sampleFile.empty()){
+        sampleFileMap = std::make_shared<MappedFile>(
+                sampleFile, recordLayout.elementBytes() * recordLayout.rows() * niterStored * nChains * nEpoch, resumed);
+    }
+    phase = phaseSampling;
+
+    for(int iEpoch = currentEpoch; iEpoch < nEpoch; iEpoch++){
+        const arma::vec & xthetasigmaInit = arma::join_vert(arma::join_vert(arma::vectorise(xInit), thetaInit), sigmaInit);
+        std::vector<arma::vec> optimum(nChains);
+        arma::vec llik(nChains);
+        runParallel(nChains, [&](const int c) {
+            const arma::vec & start = c == 0 ? xthetasigmaInit : dispersedInit(xthetasigmaInit, chainRng[c]);
+            optimum[c] = optimizeXthetasigma(yFull, odeModel, covAllDimensions, priorTemperature, start,
+                                             sigmaSize, useFixedSigma, positiveSystem, useBand, useMean,
+                                             optimizerMethod == "newton-cg");
+            llik(c) = xthetasigmaLlik(optimum[c], priorTemperature).value;
+        });
+        const arma::vec & best = optimum[llik.index_max()];
+        if(samplerMethod == "laplace"){
+            drawLaplace(iEpoch, best, llik.max());
+        }else{
+            chainSinks.resize(nChains);
+            for(int c = 0; c < nChains; c++){
+                chainSinks[c] = makeChainSink(iEpoch, c);
+                chainSinks[c]->push(0, llik(c), optimum[c]);
+            }
+            thetaRhat.col(iEpoch).fill(arma::datum::nan);
+            thetaBulkEss.col(iEpoch).fill(arma::datum::nan);
+            thetaTailEss.col(iEpoch).fill(arma::datum::nan);
+        }
+        gradientsPerEss.col(iEpoch).fill(arma::datum::nan);
+
+        arma::mat xBest = best.subvec(0, yFull.size() - 1);
+        xBest.reshape(yFull.n_rows, yFull.n_cols);
+        for(unsigned long j = 0; j < covAllDimensions.size(); j++){
+            covAllDimensions[j].mu = xBest.col(j);
+            covAllDimensions[j].dotmu = covAllDimensions[j].mphi * xBest.col(j);
+        }
+        xInit = xBest;
+        thetaInit = best.subvec(yFull.size(), yFull.size() + thetaInit.size() - 1);
+        sigmaInit = best.subvec(yFull.size() + thetaInit.size(), best.size() - 1);
+        if(verbose){
+            std::cout << "optimizeInEpochs epoch " << iEpoch << ": log posterior of each chain = " << llik.t()
+                      << "theta = " << thetaInit.t();
+        }
+
+        currentEpoch = iEpoch + 1;
+        if(!checkpointFile.empty()){
+            saveCheckpoint();
+        }
+    }
+
+    if(samplerMethod == "laplace" && !chainSummaries.empty()){
+        xthetasigmaMean = pooledMean(chainSummaries);
+        xthetasigmaSd = arma::sqrt(pooledVariance(chainSummaries));
+        xthetasigmaQuantiles = pooledQuantiles(chainSummaries);
+        thetaOnlineEss = thetaBulkEss.col(nEpoch - 1);
+        return;
+    }
+    // a point mass at the best optimum
+    xthetasigmaMean = arma::join_vert(arma::join_vert(arma::vectorise(xInit), thetaInit), sigmaInit);
+    xthetasigmaSd = arma::zeros(xthetasigmaMean.size());
+    xthetasigmaQuantiles = arma::repmat(xthetasigmaMean, 1, summaryProbs.size());
+    thetaOnlineEss = arma::vec(odeModel.thetaSize).fill(arma::datum::nan);
+}
+void MagiSolver::completePhase(int done) {
+    phase = done;
+    if(!checkpointFile.empty()){
+        saveCheckpoint();
+    }
+}
+
+// the state a resumed solve needs to continue bit for bit, read back by loadCheckpoint
+void MagiSolver::saveCheckpoint() {
+    if(sampleFileMap){
+        sampleFileMap->flush();
+    }
+    CheckpointWriter out(checkpointFile);
+    out.put(std::string("magi checkpoint 3"));
+    out.put<uint64_t>(yFull.n_rows);
+    out.put<uint64_t>(yFull.n_cols);
+    out.put<uint64_t>(odeModel.thetaSize);
+    out.put<uint64_t>(sigmaSize);
+    out.put<uint64_t>(niterHmc);
+    out.put<uint64_t>(nChains);
+    out.put<uint64_t>(nEpoch);
+    out.put<uint64_t>(niterStored);
+    out.put<uint64_t>(recordLayout.rows());
+    out.put<uint8_t>(singlePrecision);
+    out.put<uint8_t>(!sampleFile.empty());
+    out.put(temperatures);
+    out.put(samplerMethod);
+    out.put(metric);
+    out.put(adaptMethod);
+    out.put(integrator);
+    out.put<int32_t>(seed);
+    out.put(yFull);
+    out.put(tvecFull);
+    out.put(sigmaExogenous);
+    out.put(phiExogenous);
+    out.put(xInitExogenous);
+    out.put(thetaInitExogenous);
+    out.put(muExogenous);
+    out.put(dotmuExogenous);
+    out.put(odeModel.name);
+    out.put(odeModel.thetaLowerBound);
+    out.put(odeModel.thetaUpperBound);
+    out.put(odeModel.xLowerBound);
+    out.put(odeModel.xUpperBound);
+    out.put(priorTemperature);
+    out.put(kernel);
+    out.put<int32_t>(nstepsHmc);
+    out.put<double>(burninRatioHmc);
+    out.put(stepSizeFactorHmc);
+    out.put<int32_t>(bandSize);
+    out.put<uint8_t>(useFrequencyBasedPrior);
+    out.put<uint8_t>(useBand);
+    out.put<uint8_t>(useMean);
+    out.put<uint8_t>(useScalerSigma);
+    out.put<uint8_t>(useFixedSigma);
+    out.put<uint8_t>(skipMissingComponentOptimization);
+    out.put<uint8_t>(positiveSystem);
+    out.put<int32_t>(maxTreeDepth);
+    out.put<double>(targetAcceptRate);
+    out.put<uint8_t>(recordLlik);
+    out.put<uint8_t>(recordX);
+    out.put(recordXComponents);
+    out.put(recordXTimes);
+    out.put<uint8_t>(recordTheta);
+    out.put<uint8_t>(recordSigma);
+    out.put<uint8_t>(continueEpochs);
+    out.put<double>(epochBurninRatio);
+    out.put<uint8_t>(adaptTemperatures);
+    out.put(optimizerMethod);
+    out.put<uint8_t>(transformBounds);
+    out.put(lengthAdaptation);
+    out.put(blocking);
+    out.put<uint32_t>(sgWindow);
+    out.put<double>(sgFriction);
+    out.put<uint32_t>(smcMoves);
+
+    out.put<int32_t>(phase);
+    out.put<int32_t>(currentEpoch);
+    out.put<uint32_t>(currentIter);
+    out.put(phiAllDimensions);
+    out.put(sigmaInit);
+    out.put(xInit);
+    out.put(thetaInit);
+    for(const auto & cov : covAllDimensions){
+        out.put(cov.mu);
+        out.put(cov.dotmu);
+    }
+
+    out.put(stepLow);
+    out.put<uint64_t>(chainRng.size());
+    for(const auto & rng : chainRng){
+        rng.save(out);
+    }
+    out.put(gradientsPerEss);
+    out.put(thetaRhat);
+    out.put(thetaBulkEss);
+    out.put(thetaTailEss);
+    out.put(swapAcceptRate);
+    out.put(roundTripRate);
+    out.put(logEvidence);
+    out.put(epochIterations);
+    out.put(stopReason);
+    // draws written to sampleFile stay there, in memory they are rewritten whole, so checkpoints
+    // within an epoch need the sampleFile
+    out.put(llikxthetasigmaSamples);
+    out.put(llikxthetasigmaSamplesFloat);
+
+    out.put<uint64_t>(chainSamplers.size());
+    for(const auto & sampler : chainSamplers){
+        sampler->save(out);
+    }
+    out.put<uint64_t>(hotReplicas.size());
+    for(unsigned int i = 0; i < hotReplicas.size(); i++){
+        replicaRng[i].save(out);
+        hotReplicas[i]->save(out);
+    }
+    out.put(swapAttempts);
+    out.put(swapAccepts);
+    ladder.save(out);
+    out.put<uint64_t>(chainRoundTrips.size());
+    for(const auto & counter : chainRoundTrips){
+        counter.save(out);
     }
-}
\ No newline at end of file
+    out.put<uint64_t>(chainSummaries.size());
+    for(const auto & summary : chainSummaries){
+        summary->save(out);
+    }
+    out.put<uint64_t>(chainSinks.size());
+    for(const auto & sink : chainSinks){
+        out.put<uint32_t>(sink->size());
+    }
+    out.close();
+}
+
+void MagiSolver::loadCheckpoint() {
+    CheckpointReader in(checkpointFile);
+    if(in.getString() != "magi checkpoint 3"){
+        throw std::runtime_error("checkpoint " + checkpointFile + " is not a magi checkpoint");
+    }
+    in.expect<uint64_t>(yFull.n_rows, "number of time points");
+    in.expect<uint64_t>(yFull.n_cols, "number of components");
+    in.expect<uint64_t>(odeModel.thetaSize, "size of theta");
+    in.expect<uint64_t>(sigmaSize, "size of sigma");
+    in.expect<uint64_t>(niterHmc, "niterHmc");
+    in.expect<uint64_t>(nChains, "nChains");
+    in.expect<uint64_t>(nEpoch, "nEpoch");
+    in.expect<uint64_t>(niterStored, "thin");
+    in.expect<uint64_t>(recordLayout.rows(), "recorded rows");
+    in.expect<uint8_t>(singlePrecision, "singlePrecision");
+    in.expect<uint8_t>(!sampleFile.empty(), "sampleFile");
+    in.expect(temperatures, "temperatures");
+    in.expect(samplerMethod, "samplerMethod");
+    in.expect(metric, "metric");
+    in.expect(adaptMethod, "adaptMethod");
+    in.expect(integrator, "integrator");
+    in.expect<int32_t>(seed, "seed");
+    // the data, the model and every option the draws depend on; the stopping rules,
+    // checkpointEvery and verbose may change on resume
+    in.expect(yFull, "yFull");
+    in.expect(tvecFull, "tvecFull");
+    in.expect(sigmaExogenous, "sigmaExogenous");
+    in.expect(phiExogenous, "phiExogenous");
+    in.expect(xInitExogenous, "xInitExogenous");
+    in.expect(thetaInitExogenous, "thetaInitExogenous");
+    in.expect(muExogenous, "muExogenous");
+    in.expect(dotmuExogenous, "dotmuExogenous");
+    in.expect(odeModel.name, "model name");
+    in.expect(odeModel.thetaLowerBound, "thetaLowerBound");
+    in.expect(odeModel.thetaUpperBound, "thetaUpperBound");
+    in.expect(odeModel.xLowerBound, "xLowerBound");
+    in.expect(odeModel.xUpperBound, "xUpperBound");
+    in.expect(priorTemperature, "priorTemperature");
+    in.expect(kernel, "kernel");
+    in.expect<int32_t>(nstepsHmc, "nstepsHmc");
+    in.expect<double>(burninRatioHmc, "burninRatioHmc");
+    in.expect(stepSizeFactorHmc, "stepSizeFactorHmc");
+    in.expect<int32_t>(bandSize, "bandSize");
+    in.expect<uint8_t>(useFrequencyBasedPrior, "useFrequencyBasedPrior");
+    in.expect<uint8_t>(useBand, "useBand");
+    in.expect<uint8_t>(useMean, "useMean");
+    in.expect<uint8_t>(useScalerSigma, "useScalerSigma");
+    in.expect<uint8_t>(useFixedSigma, "useFixedSigma");
+    in.expect<uint8_t>(skipMissingComponentOptimization, "skipMissingComponentOptimization");
+    in.expect<uint8_t>(positiveSystem, "positiveSystem");
+    in.expect<int32_t>(maxTreeDepth, "maxTreeDepth");
+    in.expect<double>(targetAcceptRate, "targetAcceptRate");
+    in.expect<uint8_t>(recordLlik, "recordLlik");
+    in.expect<uint8_t>(recordX, "recordX");
+    in.expect(recordXComponents, "recordXComponents");
+    in.expect(recordXTimes, "recordXTimes");
+    in.expect<uint8_t>(recordTheta, "recordTheta");
+    in.expect<uint8_t>(recordSigma, "recordSigma");
+    in.expect<uint8_t>(continueEpochs, "continueEpochs");
+    in.expect<double>(epochBurninRatio, "epochBurninRatio");
+    in.expect<uint8_t>(adaptTemperatures, "adaptTemperatures");
+    in.expect(optimizerMethod, "optimizerMethod");
+    in.expect<uint8_t>(transformBounds, "transformBounds");
+    in.expect(lengthAdaptation, "lengthAdaptation");
+    in.expect(blocking, "blocking");
+    in.expect<uint32_t>(sgWindow, "sgWindow");
+    in.expect<double>(sgFriction, "sgFriction");
+    in.expect<uint32_t>(smcMoves, "smcMoves");
+
+    phase = in.get<int32_t>();
+    currentEpoch = in.get<int32_t>();
+    currentIter = in.get<uint32_t>();
+    in.get(phiAllDimensions);
+    in.get(sigmaInit);
+    in.get(xInit);
+    in.get(thetaInit);
+    for(unsigned j = 0; j < ydim; j++){
+        // the covariances follow from phi, as at the end of setupPhiSigma
+        if(phase >= phasePhiSigma){
+            covAllDimensions[j] = kernelCov(phiAllDimensions.col(j), distSignedFull, 3);
+            covAllDimensions[j].tvecCovInput = tvecFull;
+            covAllDimensions[j].addBandCov(bandSize);
+        }
+        in.get(covAllDimensions[j].mu);
+        in.get(covAllDimensions[j].dotmu);
+    }
+
+    in.get(stepLow);
+    chainRng.resize(in.get<uint64_t>());
+    for(auto & rng : chainRng){
+        rng.load(in);
+    }
+    in.get(gradientsPerEss);
+    in.get(thetaRhat);
+    in.get(thetaBulkEss);
+    in.get(thetaTailEss);
+    in.get(swapAcceptRate);
+    in.get(roundTripRate);
+    in.get(logEvidence);
+    in.get(epochIterations);
+    stopReason = in.getString();
+    in.get(llikxthetasigmaSamples);
+    in.get(llikxthetasigmaSamplesFloat);
+
+    chainSamplers.resize(in.get<uint64_t>());
+    for(auto & sampler : chainSamplers){
+        sampler = makeSampler();
+        sampler->load(in);
+    }
+    hotReplicas.resize(in.get<uint64_t>());
+    replicaRng.resize(hotReplicas.size());
+    for(unsigned int i = 0; i < hotReplicas.size(); i++){
+        replicaRng[i].load(in);
+        hotReplicas[i] = makeSampler();
+        hotReplicas[i]->load(in);
+    }
+    in.get(swapAttempts);
+    in.get(swapAccepts);
+    ladder.load(in);
+    chainRoundTrips.resize(in.get<uint64_t>());
+    for(auto & counter : chainRoundTrips){
+        counter.load(in);
+    }
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(yFull.size(), yFull.size() + odeModel.thetaSize - 1);
+    chainSummaries.resize(in.get<uint64_t>());
+    for(auto & summary : chainSummaries){
+        summary = std::make_shared<OnlineSummary>(recordLayout.fullRows - 1, summaryProbs, thetaIdx);
+        summary->load(in);
+    }
+    chainSinkSizes.resize(in.get<uint64_t>());
+    for(auto & kept : chainSinkSizes){
+        kept = in.get<uint32_t>();
+    }
+
+    if(verbose){
+        std::cout << "resumed from checkpoint " << checkpointFile << " at phase " << phase
+                  << ", epoch " << currentEpoch << ", iteration " << currentIter << "\n";
+    }
+}
@@ -1,7 +1,15 @@
 #ifndef MAGI_MULTI_LANG_MAGISOLVER_H
 #define MAGI_MULTI_LANG_MAGISOLVER_H
 
+#include <chrono>
+
 #include "classDefinition.h"
+#include "threadpool.h"
+#include "rng.h"
+#include "samplesink.h"
+#include "onlinestats.h"
+#include "Sampler.h"
+#include "paralleltempering.h"
 
 class MagiSolver {
 public:
@@ -35,10 +43,54 @@ public:
     bool skipMissingComponentOptimization;
     bool positiveSystem;
     bool verbose;
+    std::string samplerMethod;
+    const int maxTreeDepth;
+    std::string adaptMethod;
+    std::string metric;
+    const double targetAcceptRate;
+    const int nChains;
+    const int seed;
+    const int thin;
+    std::string sampleFile;
+    bool recordLlik;
+    bool recordX;
+    const arma::vec recordXComponents;
+    const arma::vec recordXTimes;
+    bool recordTheta;
+    bool recordSigma;
+    bool singlePrecision;
+    bool continueEpochs;
+    const double epochBurninRatio;
+    // checkpoint after every phase and epoch, and every checkpointEvery iterations within an epoch,
+    // which needs a sampleFile; a checkpoint of other data, another model or any other option the
+    // draws depend on is rejected, while the stopping rules, checkpointEvery and verbose may change
+    std::string checkpointFile;
+    const unsigned int checkpointEvery;
+    const arma::vec temperatures;
+    bool adaptTemperatures;
+    std::string optimizerMethod;
+    bool transformBounds;
+    std::string integrator;
+    std::string lengthAdaptation;
+    std::string blocking;
+    const unsigned int sgWindow;
+    const double sgFriction;
+    // stopping rules of the MCMC samplers, 0 for none, checked every stopCheckEvery iterations:
+    // a wall-clock budget in seconds from the construction of the solver, which ends the current
+    // epoch, burn-in included, and skips the rest; and a minimum bulk ESS or maximum split R-hat
+    // of every theta after burn-in, which ends an epoch
+    const double maxSeconds;
+    const double targetEss;
+    const double targetRhat;
+    const unsigned int stopCheckEvery;
+    // HMC moves of every particle per stage with samplerMethod "smc", each of nstepsHmc leapfrog steps
+    const unsigned int smcMoves;
 
     // intermediate object storage
     const unsigned int ydim;
     const unsigned int sigmaSize;
+    const unsigned int niterStored;  // draws kept per chain and epoch after thinning, 1 with samplerMethod "map"
+    const RecordLayout recordLayout;  // rows of [llik, x, theta, sigma] kept and their precision
     std::vector<gpcov> covAllDimensions;
     std::string loglikflag;
     arma::mat distSignedFull;
@@ -58,9 +110,62 @@ public:
     arma::mat thetaInit;
 
     arma::vec stepLow;
+    std::shared_ptr<ThreadPool> chainPool;
+    // chain c draws from stream c, carried over from one epoch to the next
+    std::vector<RandomStream> chainRng;
+    // backing store of the draws when sampleFile is set, llikxthetasigmaSamples is then empty
+    std::shared_ptr<MappedFile> sampleFileMap;
+    // running summaries of the current epoch, one per chain
+    std::vector<std::shared_ptr<OnlineSummary>> chainSummaries;
+    std::vector<std::shared_ptr<SampleSink>> chainSinks;
+    // kept across epochs when continueEpochs, with their adapted steps, metric and state
+    std::vector<std::shared_ptr<Sampler>> chainSamplers;
+    arma::vec summaryProbs;
+    // parallel tempering on the temperatures of ladder, adapted when adaptTemperatures: chain c
+    // is the replica at temperature 1, its replica k > 0 is
+    // hotReplicas[c * (ladder.temperature.size() - 1) + k - 1] with stream replicaRng[same]
+    TemperatureLadder ladder;
+    std::vector<std::shared_ptr<Sampler>> hotReplicas;
+    std::vector<RandomStream> replicaRng;
+    std::vector<RoundTripCounter> chainRoundTrips;
+    arma::uvec swapAttempts;  // per neighbour pair in the current epoch, summed over chains
+    arma::uvec swapAccepts;
+
+    // progress of the solve, restored from checkpointFile so a resumed solve skips finished work
+    enum Phase { phaseNone, phasePhiSigma, phaseXmudotmu, phaseTheta, phaseMissingComponent, phaseSampling };
+    int phase;
+    int currentEpoch;
+    unsigned int currentIter;  // next iteration of the chains in currentEpoch, 0 before they start
+    std::vector<unsigned int> chainSinkSizes;  // draws kept by each chain when resuming inside an epoch
+    std::chrono::steady_clock::time_point solveStart;  // construction of the solver, for maxSeconds
 
-    // output
+    // output, chain c occupies columns c * niterStored to (c + 1) * niterStored - 1 of each slice,
+    // or all columns hold equally weighted particles with samplerMethod "smc";
+    // with samplerMethod "map" the single column of chain c is its optimum;
+    // rows are recordLayout.recorded; only the one matching singlePrecision is filled
     arma::cube llikxthetasigmaSamples;
+    arma::fcube llikxthetasigmaSamplesFloat;
+    arma::mat gradientsPerEss;
+    arma::mat thetaRhat;
+    arma::mat thetaBulkEss;
+    arma::mat thetaTailEss;
+    arma::mat swapAcceptRate;  // per neighbour pair of temperatures and epoch
+    arma::vec roundTripRate;   // per epoch, round trips of a chain's states per iteration
+    // per epoch with samplerMethod "smc" or "laplace", log normalising constant of the posterior
+    // under flat priors on theta and sigma, up to the constant dropped from the GP prior; NaN otherwise
+    arma::vec logEvidence;
+    // posterior summaries of xthetasigma in the last epoch, computed while sampling
+    arma::vec xthetasigmaMean;
+    arma::vec xthetasigmaSd;
+    arma::mat xthetasigmaQuantiles;  // columns at summaryProbs
+    arma::vec thetaOnlineEss;
+    // iterations each epoch of the MCMC samplers ran, fewer than niterHmc when a stopping rule
+    // ended it and 0 for epochs skipped at the deadline; the draws not taken are NaN
+    arma::uvec epochIterations;
+    // "deadline", "ess" or "rhat" when a stopping rule ended the last epoch it ran, else empty;
+    // "deadline in burn-in" when the deadline came before any posterior draw, which leaves the
+    // summaries, R-hat and ESS NaN
+    std::string stopReason;
 
     MagiSolver(const arma::mat & yFull,
                const OdeSystem & odeModel,
@@ -88,14 +193,72 @@ public:
                bool useFixedSigma = false,
                bool skipMissingComponentOptimization = false,
                bool positiveSystem = false,
-               bool verbose = false);
+               bool verbose = false,
+               std::string samplerMethod = "hmc",
+               const int maxTreeDepth = 10,
+               std::string adaptMethod = "legacy",
+               std::string metric = "diag",
+               const double targetAcceptRate = 0.8,
+               const int nChains = 1,
+               const int seed = -1,
+               const int thin = 1,
+               std::string sampleFile = "",
+               bool recordLlik = true,
+               bool recordX = true,
+               const arma::vec recordXComponents = arma::vec(),
+               const arma::vec recordXTimes = arma::vec(),
+               bool recordTheta = true,
+               bool recordSigma = true,
+               bool singlePrecision = false,
+               bool continueEpochs = false,
+               const double epochBurninRatio = 0.1,
+               std::string checkpointFile = "",
+               const unsigned int checkpointEvery = 0,
+               const arma::vec temperatures = arma::vec(),
+               bool adaptTemperatures = false,
+               std::string optimizerMethod = "lbfgsb",
+               bool transformBounds = false,
+               std::string integrator = "leapfrog",
+               std::string lengthAdaptation = "fixed",
+               std::string blocking = "joint",
+               const unsigned int sgWindow = 100,
+               const double sgFriction = 0.1,
+               const double maxSeconds = 0,
+               const double targetEss = 0,
+               const double targetRhat = 0,
+               const unsigned int stopCheckEvery = 100,
+               const unsigned int smcMoves = 5);
 
     void setupPhiSigma();
     void initXmudotmu();
     void initTheta();
     void initMissingComponent();
+    void fitThetaInit();
+    arma::vec dispersedInit(const arma::vec & xthetasigmaInit, RandomStream & rng);
+    RecordLayout makeRecordLayout() const;
+    char * epochSampleMemory(int iEpoch);
+    unsigned int epochBurnin(int iEpoch) const;
+    lp xthetasigmaLlik(const arma::vec & xthetasigma, const arma::vec & temperature) const;
+    void xthetasigmaBounds(arma::vec & lb, arma::vec & ub) const;
+    std::shared_ptr<Sampler> makeSampler() const;
+    std::shared_ptr<SampleSink> makeBlockSink(int iEpoch, unsigned int firstColumn, unsigned int ncols);
+    std::shared_ptr<SampleSink> makeChainSink(int iEpoch, int c);
+    Sampler & replica(int c, unsigned int k);
+    void runParallel(int ntasks, const std::function<void(int)> & task);
+    void swapReplicas(unsigned int iter, unsigned int burnin);
+    // stopping rules of doHMC, see maxSeconds, targetEss and targetRhat
+    bool deadlinePassed() const;
+    std::string stoppingRule(int iEpoch, unsigned int burnin);
+    void thetaDiagnostics(int iEpoch, unsigned int burnin);
+    void fillNotTaken(int iEpoch, const arma::uvec & keptPerChain);
+    void completePhase(int done);
+    void saveCheckpoint();
+    void loadCheckpoint();
     void doHMC(int iEpoch);
+    void doSMC(int iEpoch);
     void sampleInEpochs();
+    void drawLaplace(int iEpoch, const arma::vec & mode, double modeLlik);
+    void optimizeInEpochs();
 };
 
 
@@ -1,49 +1,725 @@
 #include "Sampler.h"
 #include "xthetasigma.h"
 #include "hmc.h"
+#include "nuts.h"
+#include "diagnostics.h"
+#include "checkpoint.h"
+#include "blockedposterior.h"
+#include "ellipticalslice.h"
+#include "sghmc.h"
 
+hmcstate Sampler::sampleKernel(const std::function<lp(arma::vec)> & target,
+                               const arma::vec & init,
+                               const arma::vec & step,
+                               const arma::vec & lbKernel,
+                               const arma::vec & ubKernel,
+                               const lp * lpInitial) {
+    if (samplerMethod == "nuts") {
+        return nuts_hmcC(target, init, step, lbKernel, ubKernel, rng, maxTreeDepth, lpInitial);
+    } else if (samplerMethod == "hmc" || samplerMethod == "ellipticalslice") {
+        // k stage steps of k times the step, as many gradients and as long a trajectory as the leapfrog
+        const int stages = integratorStages(integrator);
+        return basic_hmcC(target, init, step * stages, lbKernel, ubKernel, std::max(1, currentSteps / stages),
+                          traj, rng, lpInitial, integrator);
+    } else if (samplerMethod == "splithmc") {
+        updateGaussianPrior();
+        return split_hmcC(target, gaussianPrior, init, step, lbKernel, ubKernel, currentSteps, traj, rng, lpInitial);
+    }
+    throw std::runtime_error("samplerMethod is not specified correctly");
+}
+
+// the level term -0.5 (x - mu)' Cinv (x - mu) of each component exactly as xthetasigmallik
+// evaluates it, banded Cinv included, so the kicks only carry the derivative and
+// observation terms
+void Sampler::updateGaussianPrior() {
+    const unsigned int n = yobs.n_rows;
+    if (gaussianPrior.blocks.size() != yobs.n_cols) {
+        gaussianPrior.blocks.clear();
+        gaussianPrior.precisions.clear();
+        for (unsigned int d = 0; d < yobs.n_cols; d++) {
+            gaussianPrior.blocks.push_back(arma::regspace<arma::uvec>(d * n, d * n + n - 1));
+            arma::mat precision = covAllDimensions[d].Cinv;
+            if (useBand) {
+                const int bandsize = covAllDimensions[d].bandsize;
+                for (unsigned int j = 0; j < n; j++) {
+                    for (unsigned int i = 0; i < n; i++) {
+                        if (std::abs(static_cast<int>(i) - static_cast<int>(j)) > bandsize) {
+                            precision(i, j) = 0;
+                        }
+                    }
+                }
+            }
+            gaussianPrior.precisions.push_back(precision);
+        }
+        gaussianPrior.reset();
+    }
+    gaussianPrior.centers.resize(yobs.n_cols);
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        gaussianPrior.centers[d] = useMean ? covAllDimensions[d].mu : arma::vec(n, arma::fill::zeros);
+    }
+    const double levelTemperature = priorTemperature.n_elem == 1 ? priorTemperature(0) : priorTemperature(1);
+    gaussianPrior.temperature = levelTemperature * temperature;
+}
+
+// the GP prior of each component as updateGaussianPrior has it, N(center, inverse precision
+// times temperature), with the precision factored once until invalidateCache
+void Sampler::updateSlicePrior() {
+    updateGaussianPrior();
+    if (slicePriorFactors.size() == yobs.n_cols) {
+        return;
+    }
+    slicePriorFactors.clear();
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        arma::mat factor;
+        if (!arma::chol(factor, arma::symmatu(gaussianPrior.precisions[d]))) {
+            throw std::runtime_error("ellipticalslice: the GP precision of component " + std::to_string(d) +
+                                     " is not positive definite");
+        }
+        slicePriorFactors.push_back(factor);
+    }
+}
 
 hmcstate Sampler::sampleSingle(const arma::vec &xthetasigmaInit, const arma::vec &step) {
-    hmcstate post = basic_hmcC(tgt, xthetasigmaInit, step, lb, ub, nsteps, traj);
+    if (samplerMethod == "sghmc") {
+        return sampleStochastic(xthetasigmaInit, step);
+    }
+    if (blocking == "components" || samplerMethod == "ellipticalslice") {
+        return sampleBlocked(xthetasigmaInit, step);
+    }
+    if (transformBounds) {
+        return sampleUnconstrained(xthetasigmaInit, step);
+    }
+    if (adaptMethod != "windowed" || metric == "diag") {
+        // starting from the previous final state, its log density and gradient are already known
+        const bool reuse = cachedState.n_elem == xthetasigmaInit.n_elem &&
+                           std::equal(xthetasigmaInit.begin(), xthetasigmaInit.end(), cachedState.begin());
+        hmcstate post = sampleKernel(tgt, xthetasigmaInit, step, lb, ub, reuse ? &cachedLp : nullptr);
+        cachedState = post.final;
+        cachedLp.value = post.lprvalue;
+        cachedLp.gradient = post.gradient;
+        return post;
+    }
+    // dense and low rank metrics: integrate in z with xthetasigma = init + metricApply(z).
+    // Bounds are no longer axis aligned in z, so leaving them rejects the trajectory.
+    const std::function<lp(arma::vec)> & tgtMetric = [&](const arma::vec & z) -> lp {
+        const arma::vec & xthetasigma = xthetasigmaInit + metricApply(z);
+        if (arma::any(xthetasigma < lb) || arma::any(xthetasigma > ub)) {
+            lp outside(-1e+9);
+            outside.gradient = arma::zeros(z.size());
+            return outside;
+        }
+        lp ret = tgt(xthetasigma);
+        ret.gradient = metricApplyT(ret.gradient);
+        return ret;
+    };
+    hmcstate post = sampleKernel(tgtMetric, arma::zeros(xthetasigmaInit.size()), step,
+                                 {-arma::datum::inf}, {arma::datum::inf}, nullptr);
+    post.final = xthetasigmaInit + metricApply(post.final);
     return post;
 }
 
+// the kernel moves u = boundTransform.toUnconstrained(xthetasigma) without bounds, on the log
+// density plus the log Jacobian; the result is mapped back, so the cache, the chain and the
+// tempering all keep the log density of xthetasigma
+hmcstate Sampler::sampleUnconstrained(const arma::vec &xthetasigmaInit, const arma::vec &step) {
+    const arma::vec & uInit = boundTransform.toUnconstrained(xthetasigmaInit);
+    const std::function<lp(arma::vec)> & tgtU = [&](const arma::vec & u) -> lp {
+        return boundTransform.toUnconstrained(u, tgt(boundTransform.toConstrained(u)));
+    };
+    const arma::vec unbounded = {arma::datum::inf};
+    hmcstate post;
+    if (adaptMethod != "windowed" || metric == "diag") {
+        const bool reuse = cachedState.n_elem == xthetasigmaInit.n_elem &&
+                           std::equal(xthetasigmaInit.begin(), xthetasigmaInit.end(), cachedState.begin());
+        const lp & lpInit = reuse ? boundTransform.toUnconstrained(uInit, cachedLp) : lp();
+        post = sampleKernel(tgtU, uInit, step, -unbounded, unbounded, reuse ? &lpInit : nullptr);
+    } else {
+        const std::function<lp(arma::vec)> & tgtMetric = [&](const arma::vec & z) -> lp {
+            lp ret = tgtU(uInit + metricApply(z));
+            ret.gradient = metricApplyT(ret.gradient);
+            return ret;
+        };
+        post = sampleKernel(tgtMetric, arma::zeros(xthetasigmaInit.size()), step, -unbounded, unbounded, nullptr);
+        post.final = uInit + metricApply(post.final);
+        post.gradient = arma::vec(post.final.size()).fill(arma::datum::nan);
+    }
+    lp lpU(post.lprvalue);
+    lpU.gradient = post.gradient;
+    lp lpQ;
+    const bool gradientKept = boundTransform.toConstrained(post.final, lpU, lpQ);
+    post.final = boundTransform.toConstrained(post.final);
+    post.lprvalue = lpQ.value;
+    post.gradient = lpQ.gradient;
+    if (gradientKept && post.gradient.is_finite()) {
+        cachedState = post.final;
+        cachedLp = lpQ;
+    } else {
+        cachedState.reset();
+    }
+    return post;
+}
+
+// one sweep of theta, sigma and each component of x, each block moved by the kernel with the
+// others fixed. A block evaluation counts as one gradient, though it only recomputes the GP
+// products of its own component; fOde couples the components, so it is always recomputed.
+// For "ellipticalslice" the components of x take elliptical slice moves instead, whose
+// likelihood evaluations count as gradients too.
+hmcstate Sampler::sampleBlocked(const arma::vec &xthetasigmaInit, const arma::vec &step) {
+    const unsigned int n = yobs.n_rows;
+    const unsigned int xSize = yobs.size();
+    BlockedPosterior blocked(yobs, covAllDimensions, model, priorTemperature, sigmaSize, useBand, useMean);
+    blocked.temperature = temperature;
+    blocked.reset(xthetasigmaInit);
+
+    hmcstate ret;
+    ret.acc = 0;
+    ret.ngrad = 0;
+    double aprSum = 0;
+    unsigned int nblocks = 0;
+    auto moveBlock = [&](const std::function<lp(arma::vec)> & target, const arma::uvec & idx,
+                         const std::function<void(const arma::vec &)> & commit) {
+        const arma::vec & blockStep = step.elem(idx);
+        if (!arma::any(blockStep > 0)) {
+            return;
+        }
+        const hmcstate & post = sampleKernel(target, blocked.state().elem(idx), blockStep,
+                                             lb.elem(idx), ub.elem(idx), nullptr);
+        commit(post.final);
+        aprSum += post.apr;
+        ret.acc += post.acc;
+        ret.ngrad += post.ngrad;
+        nblocks++;
+    };
+
+    const arma::uvec & thetaIdx = arma::regspace<arma::uvec>(xSize, xSize + model.thetaSize - 1);
+    moveBlock([&](const arma::vec & theta) { return blocked.thetaTarget(theta); }, thetaIdx,
+              [&](const arma::vec & theta) { blocked.setTheta(theta); });
+    const arma::uvec & sigmaIdx = arma::regspace<arma::uvec>(xSize + model.thetaSize,
+                                                             xSize + model.thetaSize + sigmaSize - 1);
+    moveBlock([&](const arma::vec & sigma) { return blocked.sigmaTarget(sigma); }, sigmaIdx,
+              [&](const arma::vec & sigma) { blocked.setSigma(sigma); });
+    if (samplerMethod == "ellipticalslice") {
+        updateSlicePrior();
+    }
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        const arma::uvec & xIdx = arma::regspace<arma::uvec>(d * n, d * n + n - 1);
+        if (samplerMethod != "ellipticalslice") {
+            moveBlock([&](const arma::vec & xd) { return blocked.componentTarget(d, xd); }, xIdx,
+                      [&](const arma::vec & xd) { blocked.setComponent(d, xd); });
+            continue;
+        }
+        if (!arma::any(step.elem(xIdx) > 0)) {
+            continue;
+        }
+        const arma::vec & lbX = lb.elem(xIdx);
+        const arma::vec & ubX = ub.elem(xIdx);
+        const std::function<double(const arma::vec &)> & loglik = [&](const arma::vec & xd) -> double {
+            if (arma::any(xd < lbX) || arma::any(xd > ubX)) {
+                return -arma::datum::inf;
+            }
+            return blocked.componentLikelihood(d, xd);
+        };
+        const arma::vec & xd = blocked.state().elem(xIdx);
+        const arma::vec & priorDraw = std::sqrt(gaussianPrior.temperature) *
+                                      arma::solve(arma::trimatu(slicePriorFactors[d]), rng.normal(n));
+        const hmcstate & post = elliptical_sliceC(loglik, xd, loglik(xd), gaussianPrior.centers[d], priorDraw, rng);
+        blocked.setComponent(d, post.final);
+        ret.acc += post.acc;
+        ret.ngrad += post.ngrad + 1;
+    }
+
+    ret.final = blocked.state();
+    ret.finalp = arma::zeros(ret.final.size());
+    ret.lprvalue = blocked.value();
+    ret.gradient = arma::vec(ret.final.size()).fill(arma::datum::nan);
+    // acc counts the accepted blocks, apr is the mean acceptance probability of the kernel moves
+    ret.apr = nblocks > 0 ? aprSum / nblocks : 0;
+    ret.step = step;
+    cachedState.reset();
+    return ret;
+}
+
+// the windowed gradients count by the share of the time points they evaluate. The final state
+// is evaluated in full once, for the log density the chain records.
+hmcstate Sampler::sampleStochastic(const arma::vec &xthetasigmaInit, const arma::vec &step) {
+    if (!useBand) {
+        throw std::runtime_error("sghmc needs the band likelihood");
+    }
+    WindowedGradient windowed(yobs, covAllDimensions, model, priorTemperature, sigmaSize, useMean, sgWindow);
+    windowed.temperature = temperature;
+    double evaluated = 0;
+    const std::function<arma::vec(const arma::vec &)> & gradientEstimate = [&](const arma::vec & xthetasigma) {
+        double share;
+        const arma::vec & gradient = windowed.estimate(xthetasigma, rng, share);
+        evaluated += share;
+        return gradient;
+    };
+    hmcstate post = sghmcC(gradientEstimate, xthetasigmaInit, step, lb, ub, currentSteps, sgFriction, rng);
+    const lp & lpFinal = tgt(post.final);
+    post.lprvalue = lpFinal.value;
+    post.gradient = lpFinal.gradient;
+    post.ngrad = static_cast<int>(std::ceil(evaluated)) + 1;
+    cachedState.reset();
+    return post;
+}
+
+arma::vec Sampler::kernelCoordinates(const arma::vec & xthetasigma) const {
+    return transformBounds ? boundTransform.toUnconstrained(xthetasigma) : xthetasigma;
+}
+
 void Sampler::sampleChian(const arma::vec &xthetasigmaInit, const arma::vec &stepLowInit, bool verbose=false) {
-    lliklist.fill(arma::datum::nan);
-    xth.fill(arma::datum::nan);
+    startChian(xthetasigmaInit, stepLowInit);
+    advance(niter, verbose);
+}
+
+// Continue from the final state of the previous run, keeping the adapted step sizes
+// and metric; only the first nwarmup iterations re-adapt and count as burn-in.
+void Sampler::continueChian(const unsigned int nwarmup, bool verbose) {
+    startContinuation(nwarmup);
+    advance(niter, verbose);
+}
+
+void Sampler::startChian(const arma::vec &xthetasigmaInit, const arma::vec &stepLowInit) {
+    cachedState.reset();
     stepLow = stepLowInit;
-    arma::vec accepts = arma::vec(niter).fill(arma::datum::nan);
-    accepts(0) = 0;
-    xth.col(0) = xthetasigmaInit;
     const unsigned int burnin = static_cast<unsigned int>(niter * burninRatio);
-    for (int t = 1; t < niter; t++){
-        arma::vec stepRandom = arma::randu(stepLow.size());
-        const arma::vec & rstep = stepRandom % stepLow + stepLow;
-        hmcstate hmcpostsample = sampleSingle(xth.col(t-1), rstep);
-        xth.col(t) = hmcpostsample.final;
-        accepts(t) = static_cast<double>(hmcpostsample.acc);
+    if (adaptMethod == "windowed") {
+        startWindowedAdaptation(stepLowInit, burnin > 0 ? burnin - 1 : 0);
+        if (metric == "band") {
+            updateBandMetric(xthetasigmaInit.tail(sigmaSize));
+        }
+    } else if (adaptMethod != "legacy") {
+        throw std::runtime_error("adaptMethod is not specified correctly");
+    }
+    if (lengthAdaptation != "fixed" && lengthAdaptation != "jitter" && lengthAdaptation != "chees") {
+        throw std::runtime_error("lengthAdaptation is not specified correctly");
+    }
+    lengthAdapter.restart(nsteps, 10.0 * nsteps, xthetasigmaInit.size());
+    startRun(xthetasigmaInit, burnin);
+}
+
+void Sampler::startContinuation(const unsigned int nwarmup) {
+    if (chainState.empty() || !finished()) {
+        throw std::runtime_error("no finished run to continue");
+    }
+    if (adaptMethod == "windowed") {
+        stepAdapter = DualAveraging(targetAcceptRate);
+        stepAdapter.restart(stepScale);
+        metricEstimator.restart(activeIdx.size(), metric == "dense");
+        warmup = WarmupSchedule(nwarmup > 0 ? nwarmup - 1 : 0);
+        windowDraws.clear();
+    }
+    lengthAdapter.restart(lengthAdapter.length(), lengthAdapter.maxLength, chainState.size());
+    startRun(chainState, nwarmup);
+}
+
+// the target changed, e.g. through mu and dotmu, so the cached log density is stale
+void Sampler::invalidateCache() {
+    cachedState.reset();
+    gaussianPrior.blocks.clear();
+    slicePriorFactors.clear();
+}
+
+double Sampler::stateLogDensity() {
+    if (std::isnan(chainLp)) {
+        chainLp = tgt(chainState).value;
+    }
+    return chainLp * temperature;
+}
+
+// the cached log densities are rescaled to the new temperature, no evaluation is needed
+void Sampler::exchangeState(Sampler & other) {
+    const double lpThis = stateLogDensity();
+    const double lpOther = other.stateLogDensity();
+    std::swap(chainState, other.chainState);
+    chainLp = lpOther / temperature;
+    other.chainLp = lpThis / other.temperature;
+    std::swap(cachedState, other.cachedState);
+    std::swap(cachedLp, other.cachedLp);
+    cachedLp.value *= other.temperature / temperature;
+    cachedLp.gradient *= other.temperature / temperature;
+    other.cachedLp.value *= temperature / other.temperature;
+    other.cachedLp.gradient *= temperature / other.temperature;
+}
+
+void Sampler::setTemperature(const double temperatureInput) {
+    const double ratio = temperature / temperatureInput;
+    chainLp *= ratio;
+    cachedLp.value *= ratio;
+    cachedLp.gradient *= ratio;
+    temperature = temperatureInput;
+}
+
+bool Sampler::finished() const {
+    return runIter >= niter;
+}
+
+void Sampler::stopRun() {
+    runIter = niter;
+}
+
+// record iteration 0 of a run; the sink and summary must be set by now
+void Sampler::startRun(const arma::vec &xthetasigmaInit, const unsigned int burnin) {
+    ngradlist.zeros();
+    runBurnin = burnin;
+    if (!sink) {
+        sink = std::make_shared<InMemorySink>(xthetasigmaInit.size() + 1, niter);
+    }
+    accepts = arma::vec(niter).fill(arma::datum::nan);
+    accepts(0) = 0;
+    // the last 100 draws, for the legacy step size heuristic
+    recentDraws.set_size(xthetasigmaInit.size(), std::min(100u, niter));
+    chainState = xthetasigmaInit;
+    chainLp = arma::datum::nan;
+    recentDraws.col(0) = kernelCoordinates(chainState);
+    sink->push(0, arma::datum::nan, chainState);
+    if (summary && burnin == 0) {
+        summary->update(chainState);
+    }
+    runIter = 1;
+}
+
+// run the iterations before untilIter, so a run can be split into segments
+void Sampler::advance(const unsigned int untilIter, bool verbose) {
+    const unsigned int end = std::min(untilIter, niter);
+    for (; runIter < end; runIter++){
+        const int t = runIter;
+        arma::vec rstep;
+        if (adaptMethod == "windowed") {
+            rstep = windowedStep();
+        } else {
+            arma::vec stepRandom = rng.uniform(stepLow.size());
+            rstep = stepRandom % stepLow + stepLow;
+        }
+        if (lengthAdaptation != "fixed") {
+            currentSteps = lengthAdapter.jitteredSteps(rng.uniform());
+        }
+        const arma::vec before = chainState;
+        hmcstate hmcpostsample = sampleSingle(chainState, rstep);
+        chainState = hmcpostsample.final;
+        chainLp = hmcpostsample.lprvalue;
+        recentDraws.col(t % recentDraws.n_cols) = kernelCoordinates(chainState);
+        // nuts and a blocked sweep have no single accept/reject, use the average acceptance statistic instead
+        accepts(t) = samplerMethod == "nuts" || samplerMethod == "ellipticalslice" || blocking == "components" ? hmcpostsample.apr : static_cast<double>(hmcpostsample.acc);
+        ngradlist(t) = hmcpostsample.ngrad;
         double acceptRate = arma::mean(accepts(arma::span(std::max(0, t - 99), t)));
-        if (t < burnin && t > 10){
-            if (acceptRate > 0.9){
-                stepLow *= 1.005;
-            }else if (acceptRate < 0.6){
-                stepLow *= 0.995;
+        if (lengthAdaptation == "chees" && t < runBurnin) {
+            // finalp is the negated momentum at the end, in the integration coordinates
+            const arma::vec & velocity = -rstep % hmcpostsample.finalp;
+            lengthAdapter.update(kernelCoordinates(before), kernelCoordinates(chainState),
+                                 adaptMethod == "windowed" && metric != "diag" ? metricApply(velocity) : velocity,
+                                 currentSteps);
+        }
+        if (adaptMethod == "windowed") {
+            if (t < runBurnin) {
+                adaptWindowed(t - 1, hmcpostsample.apr, kernelCoordinates(chainState));
+            }
+        } else if (t < runBurnin && t > 10){
+            // sghmc accepts every move, so only the relative steps follow the draws
+            if (samplerMethod != "sghmc"){
+                if (acceptRate > 0.9){
+                    stepLow *= 1.005;
+                }else if (acceptRate < 0.6){
+                    stepLow *= 0.995;
+                }
             }
             if (t % 100 == 0){
-                arma::vec xthsd = arma::stddev(xth.cols(std::max(0, t - 99), t), 0, 1);
+                arma::vec xthsd = arma::stddev(recentDraws, 0, 1);
                 if (arma::mean(xthsd) > 0){
                     stepLow = 0.05 * xthsd / arma::mean(xthsd) * arma::mean(stepLow) + 0.95 * stepLow;
                 }
             }
         }
-        lliklist(t) = hmcpostsample.lprvalue;
+        sink->push(t, hmcpostsample.lprvalue, chainState);
+        if (summary && t >= runBurnin) {
+            summary->update(chainState);
+        }
 
         if (verbose && (t % 100 == 1)){
             std::cout << "t = " << t << "; acceptance rate = " << acceptRate
                       << "; log-posterior value = " << hmcpostsample.lprvalue << "; theta ="
-                      << xth.submat(arma::span(yobs.size(), yobs.size() + model.thetaSize - 1), arma::span(t, t)).t();
+                      << chainState.subvec(yobs.size(), yobs.size() + model.thetaSize - 1).t();
+        }
+    }
+    if (verbose && finished()) {
+        std::cout << "gradient evaluations per effective sample of theta = "
+                  << gradientsPerEffectiveSample().t();
+    }
+}
+
+void Sampler::startWindowedAdaptation(const arma::vec & stepLowInit, const unsigned int nwarmup) {
+    activeIdx = arma::find(stepLowInit > 0);
+    if (activeIdx.empty()) {
+        throw std::runtime_error("windowed adaptation needs at least one nonzero step");
+    }
+    if (metric != "diag" && metric != "dense" && metric != "lowrank" && metric != "band") {
+        throw std::runtime_error("metric is not specified correctly");
+    }
+    if (metric == "band" && arma::any(stepLowInit.head(yobs.size()) <= 0)) {
+        throw std::runtime_error("the band metric needs a nonzero step for every x");
+    }
+    if (samplerMethod == "splithmc" && metric != "diag") {
+        throw std::runtime_error("splithmc needs the diag metric");
+    }
+    // split stepLowInit into a scalar step and a metric of geometric mean one
+    stepScale = std::exp(arma::mean(arma::log(stepLowInit.elem(activeIdx))));
+    metricSd = stepLowInit / stepScale;
+    metricChol = arma::diagmat(metricSd.elem(activeIdx));
+    metricU = arma::zeros(activeIdx.size(), 0);
+    metricLambda = arma::zeros(0);
+    metricEstimator.restart(activeIdx.size(), metric == "dense");
+    stepAdapter = DualAveraging(targetAcceptRate);
+    stepAdapter.restart(stepScale);
+    warmup = WarmupSchedule(nwarmup);
+    windowDraws.clear();
+}
+
+// adapt after warmup iteration iter, whose draw is draw
+void Sampler::adaptWindowed(const unsigned int iter, const double acceptStat, const arma::vec & draw) {
+    stepScale = stepAdapter.update(acceptStat);
+    if (warmup.inWindow(iter)) {
+        const arma::vec & drawActive = draw.elem(activeIdx);
+        metricEstimator.update(drawActive);
+        if (metric == "lowrank") {
+            windowDraws.push_back(drawActive);
+        }
+    }
+    if (warmup.endOfWindow(iter)) {
+        // keep the typical step of the active coordinates when the metric changes
+        const double stepTypicalOld = stepScale * std::exp(arma::mean(arma::log(metricSd.elem(activeIdx))));
+        updateMetric();
+        stepScale = stepTypicalOld / std::exp(arma::mean(arma::log(metricSd.elem(activeIdx))));
+        stepAdapter.restart(stepScale);
+        metricEstimator.restart(activeIdx.size(), metric == "dense");
+        windowDraws.clear();
+        warmup.nextWindow();
+    }
+    if (iter + 1 == warmup.nwarmup) {
+        stepScale = stepAdapter.finalStep();
+    }
+    stepLow = stepScale * metricSd;
+}
+
+// re-estimate the metric from the draws of the slow window that just ended
+void Sampler::updateMetric() {
+    metricSd.elem(activeIdx) = arma::sqrt(metricEstimator.variance());
+    if (metric == "band") {
+        // x keeps unit scale in the band metric, its window variance goes unused
+        metricSd.head(yobs.size()).fill(1);
+        updateBandMetric(chainState.tail(sigmaSize));
+    } else if (metric == "dense") {
+        if (!arma::chol(metricChol, metricEstimator.covariance(), "lower")) {
+            metricChol = arma::diagmat(metricSd.elem(activeIdx));
+        }
+    } else if (metric == "lowrank") {
+        // leading eigenpairs of the correlation of the window draws
+        arma::mat draws(activeIdx.size(), windowDraws.size());
+        for (unsigned int i = 0; i < windowDraws.size(); i++) {
+            draws.col(i) = windowDraws[i];
+        }
+        draws.each_col() -= metricEstimator.mean;
+        draws.each_col() /= metricSd.elem(activeIdx);
+        const double n = draws.n_cols;
+        arma::mat U, V;
+        arma::vec s;
+        if (n > 1 && metricRank > 0 && arma::svd_econ(U, s, V, draws / std::sqrt(n - 1), "left")) {
+            const unsigned int rank = std::min<unsigned int>(metricRank, s.size());
+            metricU = U.cols(0, rank - 1);
+            metricLambda = (n / (n + 5.0)) * arma::square(s.subvec(0, rank - 1)) + 5.0 / (n + 5.0);
+        }
+    }
+}
+
+// fixed mass matrix of component d of x: the Hessian of minus the log posterior without the ODE
+// Jacobian, Cinv / T1 + mphi' Kinv mphi / T0 + 1 / (sigma^2 T2) on the observed diagonal, from
+// Cinv, Kinv and mphi cut to the GP band and cut to that band itself. Momentum draws and the
+// inverse mass are then banded triangular solves of O(n * band). Should the truncation lose
+// positive definiteness, the off-diagonal band is shrunk until it factors.
+void Sampler::updateBandMetric(const arma::vec & sigma) {
+    bandMetricSigma = sigma;
+    const unsigned int n = yobs.n_rows;
+    arma::vec priorT(3);
+    if (priorTemperature.n_elem == 1) {
+        priorT.fill(priorTemperature(0));
+    } else if (priorTemperature.n_elem == 2) {
+        priorT = {priorTemperature(0), priorTemperature(1), 1.0};
+    } else {
+        priorT = priorTemperature;
+    }
+    bandFactors.clear();
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        const gpcov & cov = covAllDimensions[d];
+        const int w = std::min<int>(cov.bandsize, n - 1);
+        // Kinv mphi of the cut matrices, within 2 w of the diagonal
+        arma::mat kinvMphi(n, n, arma::fill::zeros);
+        for (int j = 0; j < static_cast<int>(n); j++) {
+            for (int a = std::max(0, j - 2 * w); a <= std::min<int>(n - 1, j + 2 * w); a++) {
+                double entry = 0;
+                const int bLast = std::min<int>(n - 1, std::min(a, j) + w);
+                for (int b = std::max(0, std::max(a, j) - w); b <= bLast; b++) {
+                    entry += cov.Kinv(a, b) * cov.mphi(b, j);
+                }
+                kinvMphi(a, j) = entry;
+            }
+        }
+        const double sigmaD = sigma(sigma.size() == 1 ? 0 : d);
+        ArrowheadMatrix precision(n, 0, w);
+        for (int j = 0; j < static_cast<int>(n); j++) {
+            for (int i = j; i <= std::min<int>(n - 1, j + w); i++) {
+                double deriv = 0;
+                for (int a = std::max(0, i - w); a <= std::min<int>(n - 1, i + w); a++) {
+                    deriv += cov.mphi(a, i) * kinvMphi(a, j);
+                }
+                double entry = cov.Cinv(i, j) / priorT(1) + deriv / priorT(0);
+                if (i == j && std::isfinite(yobs(i, d))) {
+                    entry += 1 / (sigmaD * sigmaD * priorT(2));
+                }
+                precision.band(i - j, j) = entry / temperature;
+            }
+        }
+        for (double shrink = 1; ; shrink *= 0.5) {
+            ArrowheadMatrix shrunk = precision;
+            if (w > 0) {
+                shrunk.band.rows(1, w) *= shrink;
+            }
+            try {
+                bandFactors.emplace_back(shrunk);
+                break;
+            } catch (const std::runtime_error &) {
+                if (shrink < 1e-6) {
+                    throw;
+                }
+            }
+        }
+    }
+}
+
+arma::vec Sampler::windowedStep() const {
+    if (metric == "diag") {
+        return stepScale * metricSd;
+    }
+    arma::vec step = arma::zeros(metricSd.size());
+    step.elem(activeIdx).fill(stepScale);
+    return step;
+}
+
+arma::vec Sampler::metricApply(const arma::vec & z) const {
+    arma::vec dq = arma::zeros(z.size());
+    const arma::vec & zActive = z.elem(activeIdx);
+    if (metric == "band") {
+        dq.elem(activeIdx) = metricSd.elem(activeIdx) % zActive;
+        const unsigned int n = yobs.n_rows;
+        for (unsigned int d = 0; d < bandFactors.size(); d++) {
+            dq.subvec(d * n, d * n + n - 1) = bandFactors[d].solveTransposed(z.subvec(d * n, d * n + n - 1));
+        }
+    } else if (metric == "dense") {
+        dq.elem(activeIdx) = metricChol * zActive;
+    } else {
+        dq.elem(activeIdx) = metricSd.elem(activeIdx) %
+                (zActive + metricU * ((arma::sqrt(metricLambda) - 1) % (metricU.t() * zActive)));
+    }
+    return dq;
+}
+
+arma::vec Sampler::metricApplyT(const arma::vec & gradient) const {
+    arma::vec gz = arma::zeros(gradient.size());
+    const arma::vec & gActive = gradient.elem(activeIdx);
+    if (metric == "band") {
+        gz.elem(activeIdx) = metricSd.elem(activeIdx) % gActive;
+        const unsigned int n = yobs.n_rows;
+        for (unsigned int d = 0; d < bandFactors.size(); d++) {
+            gz.subvec(d * n, d * n + n - 1) = bandFactors[d].solve(gradient.subvec(d * n, d * n + n - 1));
+        }
+    } else if (metric == "dense") {
+        gz.elem(activeIdx) = metricChol.t() * gActive;
+    } else {
+        const arma::vec & gScaled = metricSd.elem(activeIdx) % gActive;
+        gz.elem(activeIdx) = gScaled + metricU * ((arma::sqrt(metricLambda) - 1) % (metricU.t() * gScaled));
+    }
+    return gz;
+}
+
+void Sampler::save(CheckpointWriter & out) const {
+    rng.save(out);
+    out.put(stepLow);
+    out.put(ngradlist);
+    out.put(chainState);
+    out.put(chainLp);
+    out.put(temperature);
+    out.put(runBurnin);
+    out.put(runIter);
+    out.put(accepts);
+    out.put(recentDraws);
+    out.put(cachedState);
+    out.put(cachedLp.value);
+    out.put(cachedLp.gradient);
+    out.put(activeIdx);
+    out.put(stepScale);
+    out.put(metricSd);
+    out.put(metricChol);
+    out.put(metricU);
+    out.put(metricLambda);
+    out.put<uint64_t>(windowDraws.size());
+    for (const auto & draw : windowDraws) {
+        out.put(draw);
+    }
+    metricEstimator.save(out);
+    stepAdapter.save(out);
+    warmup.save(out);
+    lengthAdapter.save(out);
+    out.put(currentSteps);
+    out.put(bandMetricSigma);
+}
+
+void Sampler::load(CheckpointReader & in) {
+    rng.load(in);
+    in.get(stepLow);
+    in.get(ngradlist);
+    in.get(chainState);
+    chainLp = in.get<double>();
+    temperature = in.get<double>();
+    runBurnin = in.get<unsigned int>();
+    runIter = in.get<unsigned int>();
+    in.get(accepts);
+    in.get(recentDraws);
+    in.get(cachedState);
+    cachedLp.value = in.get<double>();
+    in.get(cachedLp.gradient);
+    in.get(activeIdx);
+    stepScale = in.get<double>();
+    in.get(metricSd);
+    in.get(metricChol);
+    in.get(metricU);
+    in.get(metricLambda);
+    windowDraws.resize(in.get<uint64_t>());
+    for (auto & draw : windowDraws) {
+        in.get(draw);
+    }
+    metricEstimator.load(in);
+    stepAdapter.load(in);
+    warmup.load(in);
+    lengthAdapter.load(in);
+    currentSteps = in.get<int>();
+    in.get(bandMetricSigma);
+    bandFactors.clear();
+    if (metric == "band" && !bandMetricSigma.empty()) {
+        updateBandMetric(bandMetricSigma);
+    }
+}
+
+// total gradient evaluations after burn-in divided by the effective sample size of each theta
+arma::vec Sampler::gradientsPerEffectiveSample() const {
+    const unsigned int burnin = runBurnin;
+    const arma::uvec & thetaRows = arma::regspace<arma::uvec>(1 + yobs.size(), yobs.size() + model.thetaSize);
+    for (unsigned int i = 0; i < thetaRows.size(); i++) {
+        if (!sink->layout().keeps(thetaRows(i))) {
+            // theta is not recorded
+            return arma::vec(model.thetaSize).fill(arma::datum::nan);
         }
     }
+    const arma::mat & thetaDraws = sink->samples(thetaRows).cols(sink->columnsBefore(burnin), sink->size() - 1);
+    const double ngrad = arma::sum(ngradlist.subvec(burnin, niter - 1));
+    return ngrad / effectiveSampleSizeRows(thetaDraws);
 }
 
 Sampler::Sampler(const arma::mat & yobsInput,
@@ -70,8 +746,7 @@ Sampler::Sampler(const arma::mat & yobsInput,
         positiveSystem(positiveSystem),
         lb(yobsInput.size() + modelInput.thetaSize + sigmaSizeInput),
         ub(yobsInput.size() + modelInput.thetaSize + sigmaSizeInput),
-        lliklist(arma::vec(niterInput)),
-        xth(arma::mat(yobsInput.size() + modelInput.thetaSize + sigmaSizeInput, niterInput).fill(arma::datum::nan))
+        ngradlist(arma::vec(niterInput))
 {
     useBand = false;
     if(loglikflag == "band" || loglikflag == "withmeanBand"){
@@ -85,7 +760,7 @@ Sampler::Sampler(const arma::mat & yobsInput,
         const arma::mat & xlatent = arma::mat(const_cast<double*>( xthetasigma.memptr()), yobs.n_rows, yobs.n_cols, false, false);
         const arma::vec & theta = arma::vec(const_cast<double*>( xthetasigma.memptr() + yobs.size()), model.thetaSize, false, false);
         const arma::vec & sigma = arma::vec(const_cast<double*>( xthetasigma.memptr() + yobs.size() + theta.size()), sigmaSize, false, false);
-        return xthetasigmallik( xlatent,
+        lp ret = xthetasigmallik( xlatent,
                                 theta,
                                 sigma,
                                 yobs,
@@ -94,6 +769,11 @@ Sampler::Sampler(const arma::mat & yobsInput,
                                 priorTemperature,
                                 useBand,
                                 useMean);
+        if (temperature != 1) {
+            ret.value /= temperature;
+            ret.gradient /= temperature;
+        }
+        return ret;
     };
     
     if (positiveSystem) {
@@ -103,8 +783,18 @@ Sampler::Sampler(const arma::mat & yobsInput,
       lb.subvec(0, yobs.size()-1).fill(-arma::datum::inf);
     }
     
+    ub.fill(arma::datum::inf);
+    // bounds of x on the model, per component or per element, narrow the ones above
+    if (!model.xLowerBound.empty()) {
+        lb.subvec(0, yobs.size()-1) = arma::max(lb.subvec(0, yobs.size()-1), OdeSystem::xBoundElements(model.xLowerBound, yobs.n_rows, yobs.n_cols));
+    }
+    if (!model.xUpperBound.empty()) {
+        ub.subvec(0, yobs.size()-1) = arma::min(ub.subvec(0, yobs.size()-1), OdeSystem::xBoundElements(model.xUpperBound, yobs.n_rows, yobs.n_cols));
+    }
+
     lb.subvec(yobs.size(), yobs.size() + model.thetaSize - 1) = model.thetaLowerBound;
     lb.subvec(yobs.size() + model.thetaSize, yobs.size() + model.thetaSize + sigmaSize - 1).fill(1e-7);
-    ub.fill(arma::datum::inf);
     ub.subvec(yobs.size(), yobs.size() + model.thetaSize - 1) = model.thetaUpperBound;
+    boundTransform = BoundTransform(lb, ub);
+    currentSteps = nsteps;
 }
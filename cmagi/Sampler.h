@@ -2,6 +2,13 @@
 #define SAMPLER_H
 
 #include "classDefinition.h"
+#include "adaptation.h"
+#include "rng.h"
+#include "samplesink.h"
+#include "onlinestats.h"
+#include "hmc.h"
+#include "boundtransform.h"
+#include "laplace.h"
 
 class Sampler {
     const arma::mat & yobs;
@@ -19,13 +26,120 @@ class Sampler {
     bool positiveSystem;
     std::function<lp(arma::vec)> tgt;
     arma::vec lb, ub;
+    BoundTransform boundTransform;
+
+    // windowed adaptation state; coordinates outside activeIdx have zero step and stay fixed
+    arma::uvec activeIdx;
+    double stepScale = 1;
+    arma::vec metricSd;
+    arma::mat metricChol;
+    arma::mat metricU;
+    arma::vec metricLambda;
+    std::vector<arma::vec> windowDraws;  // only kept for the lowrank metric
+    // factors of the fixed banded mass matrix of each component of x, for the band metric
+    std::vector<ArrowheadCholesky> bandFactors;
+    arma::vec bandMetricSigma;
+    WelfordEstimator metricEstimator;
+    DualAveraging stepAdapter;
+    WarmupSchedule warmup;
+    TrajectoryLengthAdapter lengthAdapter;
+    int currentSteps;  // leapfrog steps of the current iteration
+
+    // log density and gradient of the last final state, reused as the next initial one
+    arma::vec cachedState;
+    lp cachedLp;
+    arma::mat recentDraws;
+    // state of the current run: the chain, its burn-in and the next iteration
+    arma::vec chainState;
+    double chainLp = arma::datum::nan;  // tempered log density of chainState, nan until known
+    unsigned int runBurnin = 0;
+    unsigned int runIter = 0;
+    arma::vec accepts;
+    // GP prior of x split off for samplerMethod "splithmc", rebuilt after invalidateCache
+    GaussianSplit gaussianPrior;
+    // upper Cholesky factors of its precisions, for the prior draws of "ellipticalslice"
+    std::vector<arma::mat> slicePriorFactors;
+
+    void updateGaussianPrior();
+    void updateSlicePrior();
+    hmcstate sampleUnconstrained(const arma::vec & xthetasigmaInit, const arma::vec & step);
+    hmcstate sampleBlocked(const arma::vec & xthetasigmaInit, const arma::vec & step);
+    hmcstate sampleStochastic(const arma::vec & xthetasigmaInit, const arma::vec & step);
+    // coordinates the kernel moves in, where the steps and metric are adapted
+    arma::vec kernelCoordinates(const arma::vec & xthetasigma) const;
+    void startRun(const arma::vec & xthetasigmaInit, unsigned int burnin);
+    hmcstate sampleKernel(const std::function<lp(arma::vec)> & target, const arma::vec & init, const arma::vec & step,
+                          const arma::vec & lbKernel, const arma::vec & ubKernel, const lp * lpInitial);
+    void startWindowedAdaptation(const arma::vec & stepLowInit, unsigned int nwarmup);
+    void adaptWindowed(unsigned int iter, double acceptStat, const arma::vec & draw);
+    void updateMetric();
+    void updateBandMetric(const arma::vec & sigma);
+    arma::vec windowedStep() const;
+    arma::vec metricApply(const arma::vec & z) const;
+    arma::vec metricApplyT(const arma::vec & gradient) const;
 public:
+    // "hmc" for fixed length basic_hmcC, "nuts" for the no-u-turn sampler, "splithmc" for
+    // split_hmcC with the GP prior of x followed exactly, "ellipticalslice" for elliptical slice
+    // moves of each component of x between basic_hmcC moves of theta and sigma, "sghmc" for
+    // sghmcC on gradients of the band likelihood over random time windows
+    std::string samplerMethod = "hmc";
+    int maxTreeDepth = 10;
+    // integrator of "hmc", see basic_hmcC; multi-stage steps keep the gradients per iteration
+    std::string integrator = "leapfrog";
+    // leapfrog steps of "hmc" and "splithmc": "fixed" at nsteps, "jitter" uniform on 1 to 2 nsteps,
+    // or "chees" jittered around a mean tuned in warmup
+    std::string lengthAdaptation = "fixed";
+    // time points per gradient window and friction of "sghmc"
+    unsigned int sgWindow = 100;
+    double sgFriction = 0.1;
+    // "joint" moves all of xthetasigma at once; "components" is HMC within Gibbs over theta,
+    // sigma and each component of x in turn, see BlockedPosterior
+    std::string blocking = "joint";
+    // "legacy" acceptance rate heuristic on stepLow, or "windowed" Stan-style warmup
+    std::string adaptMethod = "legacy";
+    // metric estimated in windowed warmup: "diag", "dense" or "lowrank", or "band" with a
+    // banded GP mass matrix for x and diag for theta and sigma
+    std::string metric = "diag";
+    unsigned int metricRank = 5;
+    double targetAcceptRate = 0.8;
+    // sample log / logit transformed coordinates instead of reflecting at the bounds, which include
+    // the xLowerBound and xUpperBound of the model;
+    // steps and metric then refer to the transformed coordinates
+    bool transformBounds = false;
+    // the target is the posterior to the power 1 / temperature, for parallel tempering
+    double temperature = 1;
+    // source of all draws of this sampler, give each chain its own stream
+    RandomStream rng;
+
+    // where the draws go, an in-memory sink for the whole chain is made if unset
+    std::shared_ptr<SampleSink> sink;
+    // optional running summaries, fed every post burn-in draw whether or not the sink keeps it
+    std::shared_ptr<OnlineSummary> summary;
+
     arma::vec stepLow;
-    arma::vec lliklist;
-    arma::mat xth;
+    arma::vec ngradlist;
 
     hmcstate sampleSingle(const arma::vec &xthetasigmaInit, const arma::vec & step);
     void sampleChian(const arma::vec &xthetasigmaInit, const arma::vec &stepLowInit, bool verbose);
+    void continueChian(unsigned int nwarmup, bool verbose);
+    // the same in steps: start a run, then advance it segment by segment
+    void startChian(const arma::vec &xthetasigmaInit, const arma::vec &stepLowInit);
+    void startContinuation(unsigned int nwarmup);
+    void advance(unsigned int untilIter, bool verbose);
+    bool finished() const;
+    // end the run before niter, e.g. when a stopping rule is met, so it can be continued
+    void stopRun();
+    void invalidateCache();
+    // untempered log posterior of the current state
+    double stateLogDensity();
+    // swap current states with another replica, e.g. one at a different temperature
+    void exchangeState(Sampler & other);
+    // change the temperature, rescaling the known log densities
+    void setTemperature(double temperatureInput);
+    // run and adaptation state, for checkpoints; the sink and summary are saved by their owner
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+    arma::vec gradientsPerEffectiveSample() const;
     Sampler(const arma::mat & yobsInput,
             const std::vector<gpcov> & covAllDimensionsInput,
             const int nstepsInput,
@@ -0,0 +1,223 @@
+#include "adaptation.h"
+#include "checkpoint.h"
+
+void WelfordEstimator::restart(const unsigned int dim, const bool denseInput) {
+    count = 0;
+    dense = denseInput;
+    mean = arma::zeros(dim);
+    m2 = arma::zeros(dim);
+    if (dense) {
+        m2Dense = arma::zeros(dim, dim);
+    } else {
+        m2Dense.reset();
+    }
+}
+
+void WelfordEstimator::update(const arma::vec & x) {
+    count++;
+    const arma::vec & delta = x - mean;
+    mean += delta / count;
+    const arma::vec & delta2 = x - mean;
+    m2 += delta % delta2;
+    if (dense) {
+        m2Dense += delta * delta2.t();
+    }
+}
+
+// sample variance shrunk towards 1e-3, as in Stan
+arma::vec WelfordEstimator::variance() const {
+    const double n = count;
+    const arma::vec & var = m2 / std::max(n - 1.0, 1.0);
+    return (n / (n + 5.0)) * var + 1e-3 * (5.0 / (n + 5.0));
+}
+
+arma::mat WelfordEstimator::covariance() const {
+    if (!dense) {
+        return arma::diagmat(variance());
+    }
+    const double n = count;
+    arma::mat cov = (n / (n + 5.0)) * m2Dense / std::max(n - 1.0, 1.0);
+    cov.diag() += 1e-3 * (5.0 / (n + 5.0));
+    return cov;
+}
+
+void WelfordEstimator::save(CheckpointWriter & out) const {
+    out.put(count);
+    out.put(dense);
+    out.put(mean);
+    out.put(m2);
+    out.put(m2Dense);
+}
+
+void WelfordEstimator::load(CheckpointReader & in) {
+    count = in.get<unsigned int>();
+    dense = in.get<bool>();
+    in.get(mean);
+    in.get(m2);
+    in.get(m2Dense);
+}
+
+DualAveraging::DualAveraging(const double targetAcceptRateInput) :
+        targetAcceptRate(targetAcceptRateInput),
+        gamma(0.05),
+        t0(10),
+        kappa(0.75) {
+    restart(1.0);
+}
+
+void DualAveraging::restart(const double step) {
+    mu = std::log(10 * step);
+    logStep = std::log(step);
+    logStepBar = 0;
+    hbar = 0;
+    counter = 0;
+}
+
+double DualAveraging::update(const double acceptStat) {
+    counter++;
+    const double stat = std::isnan(acceptStat) ? 0 : std::min(1.0, acceptStat);
+    const double eta = 1.0 / (counter + t0);
+    hbar = (1 - eta) * hbar + eta * (targetAcceptRate - stat);
+    logStep = mu - std::sqrt(static_cast<double>(counter)) / gamma * hbar;
+    const double weight = std::pow(static_cast<double>(counter), -kappa);
+    logStepBar = weight * logStep + (1 - weight) * logStepBar;
+    return std::exp(logStep);
+}
+
+double DualAveraging::finalStep() const {
+    return std::exp(logStepBar);
+}
+
+void DualAveraging::save(CheckpointWriter & out) const {
+    out.put(targetAcceptRate);
+    out.put(mu);
+    out.put(logStep);
+    out.put(logStepBar);
+    out.put(hbar);
+    out.put(counter);
+}
+
+void DualAveraging::load(CheckpointReader & in) {
+    targetAcceptRate = in.get<double>();
+    mu = in.get<double>();
+    logStep = in.get<double>();
+    logStepBar = in.get<double>();
+    hbar = in.get<double>();
+    counter = in.get<unsigned int>();
+}
+
+void TrajectoryLengthAdapter::restart(const double length, const double maxLengthInput, const unsigned int dim) {
+    maxLength = std::max(maxLengthInput, 1.0);
+    logLength = std::log(std::min(std::max(length, 1.0), maxLength));
+    v = 0;
+    counter = 0;
+    center.restart(dim, false);
+}
+
+void TrajectoryLengthAdapter::update(const arma::vec & before, const arma::vec & after,
+                                     const arma::vec & velocity, const int steps) {
+    center.update(after);
+    if (center.count < 2) {
+        return;
+    }
+    // a rejected trajectory ends where it started and contributes zero, so the accepted state
+    // estimates the acceptance weighted gradient of the proposal
+    const arma::vec & offsetAfter = after - center.mean;
+    const arma::vec & offsetBefore = before - center.mean;
+    const double change = arma::dot(offsetAfter, offsetAfter) - arma::dot(offsetBefore, offsetBefore);
+    const double gradient = steps * change * arma::dot(offsetAfter, velocity);
+    if (!std::isfinite(gradient)) {
+        return;
+    }
+    counter++;
+    v = beta2 * v + (1 - beta2) * gradient * gradient;
+    const double vhat = v / (1 - std::pow(beta2, counter));
+    logLength += learningRate * gradient / (std::sqrt(vhat) + 1e-8);
+    logLength = std::min(std::max(logLength, 0.0), std::log(maxLength));
+}
+
+double TrajectoryLengthAdapter::length() const {
+    return std::exp(logLength);
+}
+
+int TrajectoryLengthAdapter::jitteredSteps(const double u) const {
+    return std::max(1, static_cast<int>(std::ceil(2 * u * length())));
+}
+
+void TrajectoryLengthAdapter::save(CheckpointWriter & out) const {
+    out.put(logLength);
+    out.put(maxLength);
+    out.put(v);
+    out.put(counter);
+    center.save(out);
+}
+
+void TrajectoryLengthAdapter::load(CheckpointReader & in) {
+    logLength = in.get<double>();
+    maxLength = in.get<double>();
+    v = in.get<double>();
+    counter = in.get<unsigned int>();
+    center.load(in);
+}
+
+WarmupSchedule::WarmupSchedule(const unsigned int nwarmupInput,
+                               const unsigned int initBufferInput,
+                               const unsigned int termBufferInput,
+                               const unsigned int baseWindowInput) :
+        nwarmup(nwarmupInput),
+        initBuffer(initBufferInput),
+        termBuffer(termBufferInput),
+        windowSize(baseWindowInput),
+        adaptMetric(true) {
+    if (nwarmup < 20) {
+        // too short for anything but step size adaptation
+        adaptMetric = false;
+        windowEnd = 0;
+        return;
+    }
+    if (initBuffer + termBuffer + windowSize > nwarmup) {
+        initBuffer = static_cast<unsigned int>(0.15 * nwarmup);
+        termBuffer = static_cast<unsigned int>(0.1 * nwarmup);
+        windowSize = nwarmup - initBuffer - termBuffer;
+    }
+    windowEnd = initBuffer + windowSize - 1;
+}
+
+bool WarmupSchedule::inWindow(const unsigned int iter) const {
+    return adaptMetric && iter >= initBuffer && iter < nwarmup - termBuffer;
+}
+
+bool WarmupSchedule::endOfWindow(const unsigned int iter) const {
+    return adaptMetric && iter == windowEnd;
+}
+
+void WarmupSchedule::nextWindow() {
+    const unsigned int lastWindowEnd = nwarmup - termBuffer - 1;
+    if (windowEnd == lastWindowEnd) {
+        return;
+    }
+    windowSize *= 2;
+    windowEnd += windowSize;
+    // stretch the current window when the following one would not fit
+    if (windowEnd + 2 * windowSize > lastWindowEnd) {
+        windowEnd = lastWindowEnd;
+    }
+}
+
+void WarmupSchedule::save(CheckpointWriter & out) const {
+    out.put(nwarmup);
+    out.put(initBuffer);
+    out.put(termBuffer);
+    out.put(windowSize);
+    out.put(windowEnd);
+    out.put(adaptMetric);
+}
+
+void WarmupSchedule::load(CheckpointReader & in) {
+    nwarmup = in.get<unsigned int>();
+    initBuffer = in.get<unsigned int>();
+    termBuffer = in.get<unsigned int>();
+    windowSize = in.get<unsigned int>();
+    windowEnd = in.get<unsigned int>();
+    adaptMetric = in.get<bool>();
+}
@@ -0,0 +1,84 @@
+#ifndef ADAPTATION_H
+#define ADAPTATION_H
+
+#include "classDefinition.h"
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// running mean and (co)variance by Welford's algorithm
+class WelfordEstimator {
+public:
+    unsigned int count = 0;
+    bool dense = false;
+    arma::vec mean;
+    arma::vec m2;
+    arma::mat m2Dense;
+
+    void restart(const unsigned int dim, const bool denseInput);
+    void update(const arma::vec & x);
+    arma::vec variance() const;
+    arma::mat covariance() const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// Nesterov dual averaging of the log step size, see Hoffman and Gelman 2014
+class DualAveraging {
+public:
+    double targetAcceptRate;
+    double gamma, t0, kappa;
+    double mu, logStep, logStepBar, hbar;
+    unsigned int counter;
+
+    explicit DualAveraging(const double targetAcceptRateInput = 0.8);
+    void restart(const double step);
+    double update(const double acceptStat);
+    double finalStep() const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// number of leapfrog steps by ChEES, Hoffman, Radul and Sountsov 2021: Adam ascent in the log
+// length on the change in squared distance from the mean over a trajectory. One chain stands
+// in for the ensemble, with its running mean as the center. Lengths are jittered uniformly
+// on (0, 2 * length], which also keeps the expected gradient well defined.
+class TrajectoryLengthAdapter {
+public:
+    double logLength = 0;
+    double maxLength = 1;
+    double learningRate = 0.025;
+    double beta2 = 0.95;
+    double v = 0;
+    unsigned int counter = 0;
+    WelfordEstimator center;
+
+    void restart(const double length, const double maxLengthInput, const unsigned int dim);
+    // one update from the states before and after a trajectory of jittered length steps,
+    // with the velocity at its end, all in the coordinates the kernel moves in
+    void update(const arma::vec & before, const arma::vec & after, const arma::vec & velocity, const int steps);
+    double length() const;
+    int jitteredSteps(const double u) const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// Stan-style warmup: fast initial buffer, doubling slow windows for the
+// metric, fast terminal buffer. Iterations are counted from 0.
+class WarmupSchedule {
+public:
+    unsigned int nwarmup, initBuffer, termBuffer, windowSize, windowEnd;
+    bool adaptMetric;
+
+    WarmupSchedule(const unsigned int nwarmupInput = 0,
+                   const unsigned int initBufferInput = 75,
+                   const unsigned int termBufferInput = 50,
+                   const unsigned int baseWindowInput = 25);
+    bool inWindow(const unsigned int iter) const;
+    bool endOfWindow(const unsigned int iter) const;
+    void nextWindow();
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+#endif //ADAPTATION_H
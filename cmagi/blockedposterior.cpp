@@ -0,0 +1,223 @@
+#include "blockedposterior.h"
+#include "band.h"
+
+BlockedPosterior::BlockedPosterior(const arma::mat & yobsInput,
+                                   const std::vector<gpcov> & covAllDimensionsInput,
+                                   const OdeSystem & modelInput,
+                                   const arma::vec & priorTemperatureInput,
+                                   const unsigned int sigmaSizeInput,
+                                   const bool useBandInput,
+                                   const bool useMean) :
+        yobs(yobsInput),
+        covAllDimensions(covAllDimensionsInput),
+        model(modelInput),
+        sigmaSize(sigmaSizeInput),
+        useBand(useBandInput),
+        priorTemperature(3),
+        mu(yobsInput.n_rows, yobsInput.n_cols, arma::fill::zeros),
+        dotmu(yobsInput.n_rows, yobsInput.n_cols, arma::fill::zeros) {
+    if (priorTemperatureInput.n_elem == 1) {
+        priorTemperature.fill(priorTemperatureInput(0));
+    } else if (priorTemperatureInput.n_elem == 2) {
+        priorTemperature = {priorTemperatureInput(0), priorTemperatureInput(1), 1.0};
+    } else if (priorTemperatureInput.n_elem == 3) {
+        priorTemperature = priorTemperatureInput;
+    } else {
+        throw std::invalid_argument("priorTemperatureInput must be scaler, 2-vector or 3-vector");
+    }
+    if (useMean) {
+        for (unsigned int d = 0; d < yobs.n_cols; d++) {
+            mu.col(d) = covAllDimensions[d].mu;
+            dotmu.col(d) = covAllDimensions[d].dotmu;
+        }
+    }
+    observed = arma::zeros(yobs.n_rows, yobs.n_cols);
+    observed.elem(arma::find_finite(yobs)).fill(1);
+    yShifted = yobs - mu;
+    yShifted.elem(arma::find_nonfinite(yShifted)).fill(0);
+    nobs = arma::sum(observed, 0).t();
+}
+
+arma::vec BlockedPosterior::gpProduct(const arma::mat & dense, const arma::mat & band,
+                                      const unsigned int d, const arma::vec & v) const {
+    if (!useBand) {
+        return dense * v;
+    }
+    const int n = v.size();
+    arma::vec out(n);
+    bmatvecmult(band.memptr(), v.memptr(), &(covAllDimensions[d].bandsize), &n, out.memptr());
+    return out;
+}
+
+arma::vec BlockedPosterior::gpProductT(const arma::mat & dense, const arma::mat & band,
+                                       const unsigned int d, const arma::vec & v) const {
+    if (!useBand) {
+        return dense.t() * v;
+    }
+    const int n = v.size();
+    arma::vec out(n);
+    bmatvecmultT(band.memptr(), v.memptr(), &(covAllDimensions[d].bandsize), &n, out.memptr());
+    return out;
+}
+
+double BlockedPosterior::sigmaOf(const arma::vec & sigmaInput, const unsigned int d) const {
+    return sigmaInput.size() == 1 ? sigmaInput(0) : sigmaInput(d);
+}
+
+double BlockedPosterior::observationTerm(const unsigned int d, const double squaredErrorD, const double sigmaD) const {
+    return (-0.5 * squaredErrorD / (sigmaD * sigmaD) - nobs(d) * std::log(sigmaD)) / priorTemperature(2);
+}
+
+arma::mat BlockedPosterior::derivResidual(const arma::vec & thetaInput, const arma::mat & xInput,
+                                          const arma::mat & mphiXInput, arma::vec & derivTermOut) const {
+    const arma::mat & f = model.fOde(thetaInput, xInput, covAllDimensions[0].tvecCovInput) - dotmu;
+    arma::mat kinvR(f.n_rows, f.n_cols);
+    derivTermOut.set_size(f.n_cols);
+    for (unsigned int d = 0; d < f.n_cols; d++) {
+        const arma::vec & r = f.col(d) - mphiXInput.col(d);
+        kinvR.col(d) = gpProduct(covAllDimensions[d].Kinv, covAllDimensions[d].KinvBand, d, r);
+        derivTermOut(d) = -0.5 * arma::dot(r, kinvR.col(d)) / priorTemperature(0);
+    }
+    return kinvR;
+}
+
+void BlockedPosterior::reset(const arma::vec & xthetasigma) {
+    const unsigned int n = yobs.n_rows;
+    const unsigned int p = yobs.n_cols;
+    x = arma::reshape(xthetasigma.head(n * p), n, p);
+    theta = xthetasigma.subvec(n * p, n * p + model.thetaSize - 1);
+    sigma = xthetasigma.tail(sigmaSize);
+    cinvX.set_size(n, p);
+    mphiX.set_size(n, p);
+    levelTerm.set_size(p);
+    squaredError.set_size(p);
+    for (unsigned int d = 0; d < p; d++) {
+        componentTerms(d);
+    }
+    derivResidual(theta, x, mphiX, derivTerm);
+}
+
+arma::vec BlockedPosterior::state() const {
+    return arma::join_vert(arma::vectorise(x), theta, sigma);
+}
+
+double BlockedPosterior::value() const {
+    double obs = 0;
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        obs += observationTerm(d, squaredError(d), sigmaOf(sigma, d));
+    }
+    return (arma::accu(levelTerm) + arma::accu(derivTerm) + obs) / temperature;
+}
+
+lp BlockedPosterior::thetaTarget(const arma::vec & thetaInput) const {
+    lp outside;
+    if (model.checkBound(x, thetaInput, &outside)) {
+        lp ret(outside.value / temperature);
+        ret.gradient = outside.gradient.tail(thetaInput.size()) / temperature;
+        return ret;
+    }
+    arma::vec derivNew;
+    const arma::mat & kinvR = derivResidual(thetaInput, x, mphiX, derivNew);
+    const arma::cube & fDtheta = model.fOdeDtheta(thetaInput, x, covAllDimensions[0].tvecCovInput);
+    lp ret(value() + (arma::accu(derivNew) - arma::accu(derivTerm)) / temperature);
+    ret.gradient = arma::zeros(thetaInput.size());
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        ret.gradient -= fDtheta.slice(d).t() * kinvR.col(d);
+    }
+    ret.gradient /= priorTemperature(0) * temperature;
+    return ret;
+}
+
+lp BlockedPosterior::sigmaTarget(const arma::vec & sigmaInput) const {
+    lp ret((arma::accu(levelTerm) + arma::accu(derivTerm)) / temperature);
+    arma::vec gradient(yobs.n_cols);
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        const double sigmaD = sigmaOf(sigmaInput, d);
+        ret.value += observationTerm(d, squaredError(d), sigmaD) / temperature;
+        gradient(d) = (squaredError(d) / (sigmaD * sigmaD * sigmaD) - nobs(d) / sigmaD) / priorTemperature(2);
+    }
+    ret.gradient = sigmaInput.size() == 1 ? arma::vec({arma::accu(gradient)}) : gradient;
+    ret.gradient /= temperature;
+    return ret;
+}
+
+lp BlockedPosterior::componentTarget(const unsigned int d, const arma::vec & xd) const {
+    const unsigned int n = yobs.n_rows;
+    arma::mat xNew = x;
+    xNew.col(d) = xd;
+    lp outside;
+    if (model.checkBound(xNew, theta, &outside)) {
+        lp ret(outside.value / temperature);
+        ret.gradient = outside.gradient.subvec(d * n, d * n + n - 1) / temperature;
+        return ret;
+    }
+    const gpcov & cov = covAllDimensions[d];
+    const arma::vec & xs = xd - mu.col(d);
+    const arma::vec & cinvXd = gpProduct(cov.Cinv, cov.CinvBand, d, xs);
+    arma::mat mphiXNew = mphiX;
+    mphiXNew.col(d) = gpProduct(cov.mphi, cov.mphiBand, d, xs);
+    arma::vec derivNew;
+    const arma::mat & kinvR = derivResidual(theta, xNew, mphiXNew, derivNew);
+    const arma::cube & fDx = model.fOdeDx(theta, xNew, cov.tvecCovInput);
+    const arma::vec & error = (xs - yShifted.col(d)) % observed.col(d);
+    const double sigmaD = sigmaOf(sigma, d);
+
+    const double levelNew = -0.5 * arma::dot(xs, cinvXd) / priorTemperature(1);
+    const double obsChange = observationTerm(d, arma::dot(error, error), sigmaD) -
+                             observationTerm(d, squaredError(d), sigmaD);
+    lp ret(value() + (levelNew - levelTerm(d) + arma::accu(derivNew) - arma::accu(derivTerm) + obsChange) / temperature);
+    ret.gradient = gpProductT(cov.mphi, cov.mphiBand, d, kinvR.col(d));
+    for (unsigned int k = 0; k < yobs.n_cols; k++) {
+        ret.gradient -= fDx.slice(k).col(d) % kinvR.col(k);
+    }
+    ret.gradient /= priorTemperature(0);
+    ret.gradient -= cinvXd / priorTemperature(1);
+    ret.gradient -= error / (sigmaD * sigmaD * priorTemperature(2));
+    ret.gradient /= temperature;
+    return ret;
+}
+
+double BlockedPosterior::componentLikelihood(const unsigned int d, const arma::vec & xd) const {
+    arma::mat xNew = x;
+    xNew.col(d) = xd;
+    lp outside;
+    if (model.checkBound(xNew, theta, &outside)) {
+        return -arma::datum::inf;
+    }
+    const gpcov & cov = covAllDimensions[d];
+    const arma::vec & xs = xd - mu.col(d);
+    arma::mat mphiXNew = mphiX;
+    mphiXNew.col(d) = gpProduct(cov.mphi, cov.mphiBand, d, xs);
+    arma::vec derivNew;
+    derivResidual(theta, xNew, mphiXNew, derivNew);
+    const arma::vec & error = (xs - yShifted.col(d)) % observed.col(d);
+    const double sigmaD = sigmaOf(sigma, d);
+    const double obsChange = observationTerm(d, arma::dot(error, error), sigmaD) -
+                             observationTerm(d, squaredError(d), sigmaD);
+    return value() + (-levelTerm(d) + arma::accu(derivNew) - arma::accu(derivTerm) + obsChange) / temperature;
+}
+
+void BlockedPosterior::setTheta(const arma::vec & thetaInput) {
+    theta = thetaInput;
+    derivResidual(theta, x, mphiX, derivTerm);
+}
+
+void BlockedPosterior::setSigma(const arma::vec & sigmaInput) {
+    sigma = sigmaInput;
+}
+
+void BlockedPosterior::componentTerms(const unsigned int d) {
+    const gpcov & cov = covAllDimensions[d];
+    const arma::vec & xs = x.col(d) - mu.col(d);
+    cinvX.col(d) = gpProduct(cov.Cinv, cov.CinvBand, d, xs);
+    mphiX.col(d) = gpProduct(cov.mphi, cov.mphiBand, d, xs);
+    levelTerm(d) = -0.5 * arma::dot(xs, cinvX.col(d)) / priorTemperature(1);
+    const arma::vec & error = (xs - yShifted.col(d)) % observed.col(d);
+    squaredError(d) = arma::dot(error, error);
+}
+
+void BlockedPosterior::setComponent(const unsigned int d, const arma::vec & xd) {
+    x.col(d) = xd;
+    componentTerms(d);
+    derivResidual(theta, x, mphiX, derivTerm);
+}
@@ -0,0 +1,65 @@
+#ifndef BLOCKEDPOSTERIOR_H
+#define BLOCKEDPOSTERIOR_H
+
+#include "classDefinition.h"
+
+// the log posterior of xthetasigmallik as a function of one block, theta, sigma or one component
+// of x, with the other blocks held at a cached state. The cache keeps what a block cannot change:
+// Cinv x and mphi x of every component, the level and observation terms, and fOde with the
+// Kinv-weighted derivative residuals, so a theta block only recomputes the ODE terms and a
+// component of x only its own GP products plus the ODE terms.
+class BlockedPosterior {
+    const arma::mat & yobs;
+    const std::vector<gpcov> & covAllDimensions;
+    const OdeSystem & model;
+    const unsigned int sigmaSize;
+    const bool useBand;
+    arma::vec priorTemperature;  // derivative, level and observation temperatures
+    arma::mat mu, dotmu;         // zero unless useMean
+    arma::mat yShifted;          // yobs - mu, unobserved entries zero
+    arma::mat observed;          // 1 where yobs is finite
+    arma::vec nobs;
+
+    // cached state, x unshifted; the rest refer to x - mu
+    arma::mat x;
+    arma::vec theta, sigma;
+    arma::mat cinvX, mphiX;
+    arma::vec levelTerm, derivTerm, squaredError;
+
+    arma::vec gpProduct(const arma::mat & dense, const arma::mat & band, unsigned int d, const arma::vec & v) const;
+    arma::vec gpProductT(const arma::mat & dense, const arma::mat & band, unsigned int d, const arma::vec & v) const;
+    double sigmaOf(const arma::vec & sigmaInput, unsigned int d) const;
+    double observationTerm(unsigned int d, double squaredErrorD, double sigmaD) const;
+    // residual fOde(theta, x) - dotmu - mphi x of every component, returning Kinv times it
+    arma::mat derivResidual(const arma::vec & thetaInput, const arma::mat & xInput, const arma::mat & mphiXInput,
+                            arma::vec & derivTermOut) const;
+    // the cached terms of component d that depend on x.col(d) alone, all but derivTerm
+    void componentTerms(unsigned int d);
+public:
+    // the log posterior and its gradients are divided by temperature, as in Sampler
+    double temperature = 1;
+
+    BlockedPosterior(const arma::mat & yobsInput,
+                     const std::vector<gpcov> & covAllDimensionsInput,
+                     const OdeSystem & modelInput,
+                     const arma::vec & priorTemperatureInput,
+                     unsigned int sigmaSizeInput,
+                     bool useBandInput,
+                     bool useMean);
+
+    void reset(const arma::vec & xthetasigma);
+    arma::vec state() const;
+    double value() const;
+
+    lp thetaTarget(const arma::vec & thetaInput) const;
+    lp sigmaTarget(const arma::vec & sigmaInput) const;
+    lp componentTarget(unsigned int d, const arma::vec & xd) const;
+    // componentTarget without the GP level term of xd and without gradients, i.e. the
+    // likelihood that multiplies its Gaussian prior; -inf outside the bounds of the model
+    double componentLikelihood(unsigned int d, const arma::vec & xd) const;
+    void setTheta(const arma::vec & thetaInput);
+    void setSigma(const arma::vec & sigmaInput);
+    void setComponent(unsigned int d, const arma::vec & xd);
+};
+
+#endif //BLOCKEDPOSTERIOR_H
@@ -0,0 +1,115 @@
+#include "boundtransform.h"
+
+BoundTransform::BoundTransform(const arma::vec & lbInput, const arma::vec & ubInput) : lb(lbInput), ub(ubInput) {
+    if (lb.size() != ub.size()) {
+        throw std::runtime_error("BoundTransform: lb and ub dimension not matched");
+    }
+    kind.resize(lb.size());
+    for (unsigned int i = 0; i < lb.size(); i++) {
+        if (std::isfinite(lb(i)) && std::isfinite(ub(i))) {
+            kind[i] = interval;
+        } else if (std::isfinite(lb(i))) {
+            kind[i] = lower;
+        } else if (std::isfinite(ub(i))) {
+            kind[i] = upper;
+        } else {
+            kind[i] = identity;
+        }
+    }
+}
+
+void BoundTransform::evaluate(const unsigned int i, const double u, double & q, double & dqdu,
+                              double & logJ, double & dlogJ) const {
+    switch (kind[i]) {
+        case lower:
+            dqdu = std::exp(u);
+            q = lb(i) + dqdu;
+            logJ = u;
+            dlogJ = 1;
+            break;
+        case upper:
+            dqdu = -std::exp(u);
+            q = ub(i) + dqdu;
+            logJ = u;
+            dlogJ = 1;
+            break;
+        case interval: {
+            const double s = 1 / (1 + std::exp(-u));
+            const double width = ub(i) - lb(i);
+            q = lb(i) + width * s;
+            dqdu = width * s * (1 - s);
+            // log s and log(1 - s) without cancellation for large |u|
+            logJ = std::log(width) - std::log1p(std::exp(-u)) - std::log1p(std::exp(u));
+            dlogJ = 1 - 2 * s;
+            break;
+        }
+        default:
+            q = u;
+            dqdu = 1;
+            logJ = 0;
+            dlogJ = 0;
+    }
+}
+
+// a point on a bound maps to a large finite u rather than an infinite one
+arma::vec BoundTransform::toUnconstrained(const arma::vec & q) const {
+    arma::vec u(q.size());
+    for (unsigned int i = 0; i < q.size(); i++) {
+        switch (kind[i]) {
+            case lower:
+                u(i) = std::log(q(i) - lb(i));
+                break;
+            case upper:
+                u(i) = std::log(ub(i) - q(i));
+                break;
+            case interval:
+                u(i) = std::log(q(i) - lb(i)) - std::log(ub(i) - q(i));
+                break;
+            default:
+                u(i) = q(i);
+                continue;
+        }
+        u(i) = std::min(std::max(u(i), -700.0), 700.0);
+    }
+    return u;
+}
+
+arma::vec BoundTransform::toConstrained(const arma::vec & u) const {
+    arma::vec q(u.size());
+    double qi, dqdu, logJ, dlogJ;
+    for (unsigned int i = 0; i < u.size(); i++) {
+        evaluate(i, u(i), qi, dqdu, logJ, dlogJ);
+        q(i) = qi;
+    }
+    return q;
+}
+
+lp BoundTransform::toUnconstrained(const arma::vec & u, const lp & lpq) const {
+    lp ret(lpq.value);
+    ret.gradient.set_size(u.size());
+    double q, dqdu, logJ, dlogJ;
+    for (unsigned int i = 0; i < u.size(); i++) {
+        evaluate(i, u(i), q, dqdu, logJ, dlogJ);
+        ret.value += logJ;
+        ret.gradient(i) = lpq.gradient(i) * dqdu + dlogJ;
+    }
+    return ret;
+}
+
+bool BoundTransform::toConstrained(const arma::vec & u, const lp & lpu, lp & lpq) const {
+    lpq.value = lpu.value;
+    lpq.gradient.set_size(u.size());
+    double q, dqdu, logJ, dlogJ;
+    bool ok = true;
+    for (unsigned int i = 0; i < u.size(); i++) {
+        evaluate(i, u(i), q, dqdu, logJ, dlogJ);
+        lpq.value -= logJ;
+        if (dqdu == 0) {
+            ok = false;
+            lpq.gradient(i) = 0;
+        } else {
+            lpq.gradient(i) = (lpu.gradient(i) - dlogJ) / dqdu;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef BOUNDTRANSFORM_H
+#define BOUNDTRANSFORM_H
+
+#include "classDefinition.h"
+
+// coordinatewise bijection u = g(q) from a box onto the real line: log(q - lb) or log(ub - q)
+// when one bound is finite, logit((q - lb) / (ub - lb)) when both are, the identity when none.
+// Sampling u with the log Jacobian log |dq/du| added keeps the distribution of q.
+class BoundTransform {
+    enum Kind { identity, lower, upper, interval };
+    arma::vec lb, ub;
+    std::vector<Kind> kind;
+
+    // q, dq/du, log |dq/du| and its derivative in u of coordinate i
+    void evaluate(unsigned int i, double u, double & q, double & dqdu, double & logJ, double & dlogJ) const;
+public:
+    BoundTransform(const arma::vec & lbInput = arma::vec(), const arma::vec & ubInput = arma::vec());
+    arma::vec toUnconstrained(const arma::vec & q) const;
+    arma::vec toConstrained(const arma::vec & u) const;
+    // log density and gradient in u from those in q at q = toConstrained(u)
+    lp toUnconstrained(const arma::vec & u, const lp & lpq) const;
+    // the inverse, false if dq/du underflowed and the gradient in q is lost
+    bool toConstrained(const arma::vec & u, const lp & lpu, lp & lpq) const;
+};
+
+#endif //BOUNDTRANSFORM_H
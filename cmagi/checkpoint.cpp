@@ -0,0 +1,93 @@
+#include <cmath>
+#include <cstdio>
+
+#include "checkpoint.h"
+
+CheckpointWriter::CheckpointWriter(const std::string & pathInput) :
+        path(pathInput),
+        out(pathInput + ".tmp", std::ios::binary | std::ios::trunc) {
+    if (!out) {
+        throw std::runtime_error("cannot write checkpoint " + path);
+    }
+}
+
+void CheckpointWriter::write(const void * data, const size_t bytes) {
+    out.write(static_cast<const char *>(data), bytes);
+    if (!out) {
+        throw std::runtime_error("cannot write checkpoint " + path);
+    }
+}
+
+void CheckpointWriter::put(const std::string & value) {
+    put<uint64_t>(value.size());
+    write(value.data(), value.size());
+}
+
+void CheckpointWriter::close() {
+    out.close();
+    if (!out || std::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("cannot write checkpoint " + path);
+    }
+}
+
+CheckpointReader::CheckpointReader(const std::string & pathInput) :
+        path(pathInput),
+        in(pathInput, std::ios::binary) {
+    if (!in) {
+        throw std::runtime_error("cannot read checkpoint " + path);
+    }
+}
+
+void CheckpointReader::read(void * data, const size_t bytes) {
+    in.read(static_cast<char *>(data), bytes);
+    if (!in) {
+        throw std::runtime_error("checkpoint " + path + " is truncated");
+    }
+}
+
+std::string CheckpointReader::getString() {
+    std::string value(get<uint64_t>(), '\0');
+    if (!value.empty()) {
+        read(&value[0], value.size());
+    }
+    return value;
+}
+
+void CheckpointReader::expect(const std::string & expected, const std::string & what) {
+    if (getString() != expected) {
+        throw std::runtime_error("checkpoint " + path + " does not match: " + what);
+    }
+}
+
+// equal shapes and values, NaN matching NaN as for missing observations
+static bool sameValues(const arma::mat & value, const arma::mat & expected) {
+    if (value.n_rows != expected.n_rows || value.n_cols != expected.n_cols) {
+        return false;
+    }
+    for (arma::uword i = 0; i < value.n_elem; i++) {
+        if (value(i) != expected(i) && !(std::isnan(value(i)) && std::isnan(expected(i)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CheckpointReader::expect(const arma::vec & expected, const std::string & what) {
+    arma::vec value;
+    get(value);
+    if (!sameValues(value, expected)) {
+        throw std::runtime_error("checkpoint " + path + " does not match: " + what);
+    }
+}
+
+void CheckpointReader::expect(const arma::mat & expected, const std::string & what) {
+    arma::mat value;
+    get(value);
+    if (!sameValues(value, expected)) {
+        throw std::runtime_error("checkpoint " + path + " does not match: " + what);
+    }
+}
+
+bool checkpointExists(const std::string & path) {
+    return std::ifstream(path, std::ios::binary).good();
+}
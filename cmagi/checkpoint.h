@@ -0,0 +1,86 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include "classDefinition.h"
+
+// Flat binary checkpoint in native byte order. The writer fills path.tmp and
+// renames it over path on close, so an interrupted write keeps the previous
+// checkpoint intact.
+class CheckpointWriter {
+    std::string path;
+    std::ofstream out;
+public:
+    explicit CheckpointWriter(const std::string & path);
+    void write(const void * data, size_t bytes);
+    void close();
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value>::type put(const T value) {
+        write(&value, sizeof(T));
+    }
+    void put(const std::string & value);
+    template <typename eT>
+    void put(const arma::Mat<eT> & value) {
+        put<uint64_t>(value.n_rows);
+        put<uint64_t>(value.n_cols);
+        write(value.memptr(), sizeof(eT) * value.n_elem);
+    }
+    template <typename eT>
+    void put(const arma::Cube<eT> & value) {
+        put<uint64_t>(value.n_rows);
+        put<uint64_t>(value.n_cols);
+        put<uint64_t>(value.n_slices);
+        write(value.memptr(), sizeof(eT) * value.n_elem);
+    }
+};
+
+class CheckpointReader {
+    std::string path;
+    std::ifstream in;
+public:
+    explicit CheckpointReader(const std::string & path);
+    void read(void * data, size_t bytes);
+
+    template <typename T>
+    T get() {
+        static_assert(std::is_arithmetic<T>::value, "only arithmetic values are read directly");
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+    std::string getString();
+    template <typename eT>
+    void get(arma::Mat<eT> & value) {
+        const uint64_t rows = get<uint64_t>();
+        const uint64_t cols = get<uint64_t>();
+        value.set_size(rows, cols);
+        read(value.memptr(), sizeof(eT) * value.n_elem);
+    }
+    template <typename eT>
+    void get(arma::Cube<eT> & value) {
+        const uint64_t rows = get<uint64_t>();
+        const uint64_t cols = get<uint64_t>();
+        const uint64_t slices = get<uint64_t>();
+        value.set_size(rows, cols, slices);
+        read(value.memptr(), sizeof(eT) * value.n_elem);
+    }
+    // fails unless the next value equals expected, to catch a checkpoint of another problem;
+    // NaN in a vector or matrix matches NaN
+    template <typename T>
+    void expect(const T expected, const std::string & what) {
+        if (get<T>() != expected) {
+            throw std::runtime_error("checkpoint " + path + " does not match: " + what);
+        }
+    }
+    void expect(const std::string & expected, const std::string & what);
+    void expect(const arma::vec & expected, const std::string & what);
+    void expect(const arma::mat & expected, const std::string & what);
+};
+
+bool checkpointExists(const std::string & path);
+
+#endif //CHECKPOINT_H
@@ -3,14 +3,27 @@
 using namespace arma;
 using namespace std;
 
+arma::vec OdeSystem::xBoundElements(const arma::vec & bound, const unsigned int nrow, const unsigned int ncol){
+  if(bound.size() == 1){
+    return vec(nrow * ncol).fill(bound(0));
+  }
+  if(bound.size() == ncol){
+    return vectorise(repmat(bound.t(), nrow, 1));
+  }
+  if(bound.size() == nrow * ncol){
+    return bound;
+  }
+  throw std::runtime_error("xLowerBound and xUpperBound need one value, one per component or one per element of x");
+}
+
 bool OdeSystem::checkBound(const arma::mat & xlatent, const arma::vec & theta, lp* retPtr) const{
   uvec x2Large;
   if( xUpperBound.size() > 0 && any( xUpperBound < datum::inf)){
-    x2Large = find(xlatent > xUpperBound);  // FIXME bug here for comparison
+    x2Large = find(vectorise(xlatent) > xBoundElements(xUpperBound, xlatent.n_rows, xlatent.n_cols));
   }
   uvec x2Small;
   if( xLowerBound.size() > 0 && any( xLowerBound > -datum::inf)){
-    x2Small = find(xlatent < xLowerBound); // FIXME bug here for comparison
+    x2Small = find(vectorise(xlatent) < xBoundElements(xLowerBound, xlatent.n_rows, xlatent.n_cols));
   }
   uvec theta2Large = find(theta > thetaUpperBound);
   uvec theta2Small = find(theta < thetaLowerBound);
@@ -27,4 +40,28 @@ bool OdeSystem::checkBound(const arma::mat & xlatent, const arma::vec & theta, l
     return true;
   }
   return false;
-}
\ No newline at end of file
+}
+
+OdeSystem OdeSystem::shifted(const arma::mat & mu, const arma::mat & dotmu) const{
+  const OdeSystem & base = *this;
+  OdeSystem ret(
+    [&base, &mu, &dotmu](const vec & theta, const mat & x, const vec & tvec) -> mat{
+      return base.fOde(theta, x+mu, tvec) - dotmu;
+    },
+    [&base, &mu](const vec & theta, const mat & x, const vec & tvec) -> cube{
+      return base.fOdeDx(theta, x+mu, tvec);
+    },
+    [&base, &mu](const vec & theta, const mat & x, const vec & tvec) -> cube{
+      return base.fOdeDtheta(theta, x+mu, tvec);
+    },
+    thetaLowerBound, thetaUpperBound);
+  ret.name = name;
+  // the bounds are on x, so they move with it to one per element of x - mu
+  if(!xLowerBound.empty()){
+    ret.xLowerBound = xBoundElements(xLowerBound, mu.n_rows, mu.n_cols) - vectorise(mu);
+  }
+  if(!xUpperBound.empty()){
+    ret.xUpperBound = xBoundElements(xUpperBound, mu.n_rows, mu.n_cols) - vectorise(mu);
+  }
+  return ret;
+}
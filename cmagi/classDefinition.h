@@ -9,8 +9,9 @@
 
 struct hmcstate{
     arma::vec final, finalp, step, trajH;
+    arma::vec gradient;  // log density gradient at final
     double lprvalue, apr, delta;
-    int acc;
+    int acc, ngrad;
     arma::mat trajq, trajp;
 };
 
@@ -65,6 +66,7 @@ public:
     arma::vec thetaUpperBound;
     unsigned int thetaSize;
 
+    // a scalar, one value per component or one per element of x
     arma::vec xLowerBound;
     arma::vec xUpperBound;
 
@@ -79,6 +81,12 @@ public:
 
     OdeSystem() {};
     bool checkBound(const arma::mat & xlatent, const arma::vec & theta, lp* retPtr) const;
+    // an x bound as one value per element of the column major nrow x ncol x
+    static arma::vec xBoundElements(const arma::vec & bound, unsigned int nrow, unsigned int ncol);
+    // the system of x - mu, whose derivative is fOde - dotmu; it calls this system through a
+    // reference instead of copying its functions, which may hold interpreter objects, so both
+    // this system and mu, dotmu must outlive it. Its x bounds are those of this system less mu
+    OdeSystem shifted(const arma::mat & mu, const arma::mat & dotmu) const;
 };
 
 #endif
@@ -0,0 +1,209 @@
+#include <boost/math/special_functions/erf.hpp>
+
+#include "diagnostics.h"
+
+//' autocovariance of a chain at all lags, computed by fft
+//'
+//' @param draws  one chain of a scalar quantity
+arma::vec autocovariance(const arma::vec & draws) {
+    const unsigned int n = draws.size();
+    unsigned int nfft = 1;
+    while (nfft < 2 * n) {
+        nfft *= 2;
+    }
+    arma::vec centered = arma::zeros(nfft);
+    centered.subvec(0, n - 1) = draws - arma::mean(draws);
+    const arma::cx_vec & freq = arma::fft(centered);
+    const arma::cx_vec & acovfull = arma::ifft(freq % arma::conj(freq));
+    return arma::real(acovfull.subvec(0, n - 1)) / n;
+}
+
+//' effective sample size of one chain
+//'
+//' Geyer's initial monotone sequence estimator, see Stan reference manual.
+//'
+//' @param draws  one chain of a scalar quantity
+double effectiveSampleSize(const arma::vec & draws) {
+    const unsigned int n = draws.size();
+    if (n < 4) {
+        return n;
+    }
+    const arma::vec & acov = autocovariance(draws);
+    if (acov(0) <= 0) {
+        return n;
+    }
+    const arma::vec & rho = acov / acov(0);
+
+    // sum of autocorrelation over consecutive pairs, truncated at the first
+    // negative pair sum and forced to be monotone
+    double tau = -1;
+    double pairPrevious = arma::datum::inf;
+    for (unsigned int k = 0; k + 1 < n; k += 2) {
+        double pair = rho(k) + rho(k + 1);
+        if (pair < 0) {
+            break;
+        }
+        pair = std::min(pair, pairPrevious);
+        tau += 2 * pair;
+        pairPrevious = pair;
+    }
+    tau = std::max(tau, 1.0 / std::log10(static_cast<double>(n)));
+    return n / tau;
+}
+
+//' effective sample size of each row of draws
+//'
+//' @param draws  each row is one chain of a scalar quantity, each column is an iteration
+arma::vec effectiveSampleSizeRows(const arma::mat & draws) {
+    arma::vec ess(draws.n_rows);
+    for (unsigned int i = 0; i < draws.n_rows; i++) {
+        ess(i) = effectiveSampleSize(arma::vec(draws.row(i).t()));
+    }
+    return ess;
+}
+
+//' split each chain into its first and second half
+//'
+//' @param draws  each column is one chain of a scalar quantity
+arma::mat splitChains(const arma::mat & draws) {
+    const unsigned int half = draws.n_rows / 2;
+    const unsigned int offset = draws.n_rows - half;  // drop the middle draw of odd length chains
+    arma::mat split(half, 2 * draws.n_cols);
+    for (unsigned int c = 0; c < draws.n_cols; c++) {
+        split.col(2 * c) = draws(arma::span(0, half - 1), c);
+        split.col(2 * c + 1) = draws(arma::span(offset, draws.n_rows - 1), c);
+    }
+    return split;
+}
+
+//' normal scores of the ranks pooled over all chains, ties get the average rank
+//'
+//' see Vehtari, Gelman, Simpson, Carpenter and Burkner 2021.
+//'
+//' @param draws  each column is one chain of a scalar quantity
+arma::mat rankNormalize(const arma::mat & draws) {
+    const arma::vec & pooled = arma::vectorise(draws);
+    const unsigned int n = pooled.size();
+    const arma::uvec & order = arma::stable_sort_index(pooled);
+    arma::vec ranks(n);
+    unsigned int i = 0;
+    while (i < n) {
+        unsigned int j = i;
+        while (j + 1 < n && pooled(order(j + 1)) == pooled(order(i))) {
+            j++;
+        }
+        const double averageRank = (i + j) / 2.0 + 1.0;
+        for (unsigned int k = i; k <= j; k++) {
+            ranks(order(k)) = averageRank;
+        }
+        i = j + 1;
+    }
+    arma::mat z(arma::size(draws));
+    for (unsigned int k = 0; k < n; k++) {
+        const double prob = (ranks(k) - 0.375) / (n + 0.25);
+        z(k) = std::sqrt(2.0) * boost::math::erf_inv(2.0 * prob - 1.0);
+    }
+    return z;
+}
+
+//' effective sample size pooled over chains
+//'
+//' autocorrelations are combined across chains with the between-chain variance,
+//' then truncated as in effectiveSampleSize.
+//'
+//' @param draws  each column is one chain of a scalar quantity
+double effectiveSampleSizeChains(const arma::mat & draws) {
+    const unsigned int n = draws.n_rows;
+    const unsigned int m = draws.n_cols;
+    if (n < 4) {
+        return n * m;
+    }
+    arma::mat acov(n, m);
+    for (unsigned int c = 0; c < m; c++) {
+        acov.col(c) = autocovariance(draws.col(c));
+    }
+    return effectiveSampleSizeAutocovariance(acov, arma::vec(arma::mean(draws, 0).t()), n);
+}
+
+// acov may hold fewer lags than n, the sum of autocorrelations is then truncated
+double effectiveSampleSizeAutocovariance(const arma::mat & acov, const arma::vec & chainMeans, const unsigned int n) {
+    const unsigned int m = acov.n_cols;
+    if (n < 4 || acov.n_rows < 2) {
+        return n * m;
+    }
+    const arma::vec & withinVar = arma::mean(acov, 1) * n / (n - 1.0);
+    double varPlus = withinVar(0) * (n - 1.0) / n;
+    if (m > 1) {
+        varPlus += arma::var(chainMeans);
+    }
+    if (varPlus <= 0) {
+        return n * m;
+    }
+    const arma::vec & rho = 1.0 - (withinVar(0) - arma::mean(acov, 1)) / varPlus;
+
+    double tau = -1;
+    double pairPrevious = arma::datum::inf;
+    for (unsigned int k = 0; k + 1 < acov.n_rows; k += 2) {
+        double pair = rho(k) + rho(k + 1);
+        if (pair < 0) {
+            break;
+        }
+        pair = std::min(pair, pairPrevious);
+        tau += 2 * pair;
+        pairPrevious = pair;
+    }
+    tau = std::max(tau, 1.0 / std::log10(static_cast<double>(n * m)));
+    return n * m / tau;
+}
+
+static double basicRhat(const arma::mat & draws) {
+    const double n = draws.n_rows;
+    const double withinVar = arma::mean(arma::var(draws, 0, 0));
+    const double betweenVar = n * arma::var(arma::vec(arma::mean(draws, 0).t()));
+    if (withinVar <= 0) {
+        return arma::datum::nan;
+    }
+    return std::sqrt(((n - 1) / n * withinVar + betweenVar / n) / withinVar);
+}
+
+//' rank-normalized split R-hat
+//'
+//' maximum of the bulk R-hat and the R-hat of the folded draws, which picks
+//' up chains that agree in location but not in scale.
+//'
+//' @param draws  each column is one chain of a scalar quantity
+double splitRhat(const arma::mat & draws) {
+    if (draws.n_rows < 4) {
+        return arma::datum::nan;
+    }
+    const arma::mat & split = splitChains(draws);
+    const double rhatBulk = basicRhat(rankNormalize(split));
+    const arma::mat & folded = arma::abs(split - arma::median(arma::vectorise(split)));
+    const double rhatTail = basicRhat(rankNormalize(folded));
+    return std::max(rhatBulk, rhatTail);
+}
+
+//' effective sample size of the rank-normalized split chains
+//'
+//' @param draws  each column is one chain of a scalar quantity
+double bulkEffectiveSampleSize(const arma::mat & draws) {
+    if (draws.n_rows < 4) {
+        return draws.size();
+    }
+    return effectiveSampleSizeChains(rankNormalize(splitChains(draws)));
+}
+
+//' minimum effective sample size of the 5% and 95% quantile indicators
+//'
+//' @param draws  each column is one chain of a scalar quantity
+double tailEffectiveSampleSize(const arma::mat & draws) {
+    if (draws.n_rows < 4) {
+        return draws.size();
+    }
+    const arma::mat & split = splitChains(draws);
+    const arma::vec & pooled = arma::vectorise(split);
+    const arma::vec & q = arma::quantile(pooled, arma::vec({0.05, 0.95}));
+    const arma::mat lower = arma::conv_to<arma::mat>::from(split <= q(0));
+    const arma::mat upper = arma::conv_to<arma::mat>::from(split <= q(1));
+    return std::min(effectiveSampleSizeChains(lower), effectiveSampleSizeChains(upper));
+}
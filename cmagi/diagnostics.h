@@ -0,0 +1,20 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "classDefinition.h"
+
+arma::vec autocovariance(const arma::vec & draws);
+double effectiveSampleSize(const arma::vec & draws);
+arma::vec effectiveSampleSizeRows(const arma::mat & draws);
+
+// multi-chain diagnostics of one scalar quantity; each column of draws is a chain
+arma::mat splitChains(const arma::mat & draws);
+arma::mat rankNormalize(const arma::mat & draws);
+double effectiveSampleSizeChains(const arma::mat & draws);
+// same from per-chain autocovariances (lags x chains) of chains of length n
+double effectiveSampleSizeAutocovariance(const arma::mat & acov, const arma::vec & chainMeans, unsigned int n);
+double splitRhat(const arma::mat & draws);
+double bulkEffectiveSampleSize(const arma::mat & draws);
+double tailEffectiveSampleSize(const arma::mat & draws);
+
+#endif //DIAGNOSTICS_H
@@ -0,0 +1,41 @@
+#include "ellipticalslice.h"
+
+hmcstate elliptical_sliceC(const std::function<double (const arma::vec &)> & loglik,
+                           const arma::vec & initial,
+                           const double loglikInitial,
+                           const arma::vec & center,
+                           const arma::vec & priorDraw,
+                           RandomStream & rng,
+                           const int maxShrink) {
+    hmcstate ret;
+    ret.final = initial;
+    ret.lprvalue = loglikInitial;
+    ret.acc = 0;
+    ret.apr = 0;
+    ret.ngrad = 0;
+
+    const arma::vec & offset = initial - center;
+    const double threshold = loglikInitial + std::log(rng.uniform());
+    double angle = 2 * arma::datum::pi * rng.uniform();
+    double angleMin = angle - 2 * arma::datum::pi;
+    double angleMax = angle;
+    for (int k = 0; k < maxShrink; k++) {
+        const arma::vec & proposal = center + offset * std::cos(angle) + priorDraw * std::sin(angle);
+        const double value = loglik(proposal);
+        ret.ngrad++;
+        if (value > threshold) {
+            ret.final = proposal;
+            ret.lprvalue = value;
+            ret.acc = 1;
+            ret.apr = 1;
+            return ret;
+        }
+        if (angle < 0) {
+            angleMin = angle;
+        } else {
+            angleMax = angle;
+        }
+        angle = angleMin + (angleMax - angleMin) * rng.uniform();
+    }
+    return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef ELLIPTICALSLICE_H
+#define ELLIPTICALSLICE_H
+
+#include "classDefinition.h"
+#include "rng.h"
+
+// One elliptical slice sampling update (Murray, Adams and MacKay 2010) of x under the prior
+// N(center, S) times exp(loglik(x)), given priorDraw ~ N(0, S). Proposals on the ellipse through
+// x - center and priorDraw shrink towards x until one is above the slice, so no step size is
+// needed. loglik may return -inf outside the support. ngrad counts the loglik evaluations; acc
+// is 0 only if the bracket shrinks maxShrink times and x is kept.
+hmcstate elliptical_sliceC(const std::function<double (const arma::vec &)> & loglik,
+                           const arma::vec & initial,
+                           double loglikInitial,
+                           const arma::vec & center,
+                           const arma::vec & priorDraw,
+                           RandomStream & rng,
+                           int maxShrink = 100);
+
+#endif //ELLIPTICALSLICE_H
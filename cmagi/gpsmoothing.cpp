@@ -8,6 +8,8 @@
 
 #include "tgtdistr.h"
 #include "fullloglikelihood.h"
+#include "xthetasigma.h"
+#include "newtoncg.h"
 
 
 // [[Rcpp::export]]
@@ -450,7 +452,31 @@ arma::vec optimizeThetaInit(const arma::mat & yobsInput,
                             const arma::vec & sigmaAllDimensionsInput,
                             const arma::vec & priorTemperatureInput,
                             const arma::mat & xInitInput,
-                            const bool useBandInput) {
+                            const bool useBandInput,
+                            const bool newtonCg) {
+    if (newtonCg){
+        // curvature in theta from the theta block of the exact Hessian-vector product
+        NewtonCg solver;
+        solver.lb = fOdeModelInput.thetaLowerBound + 1e-6;
+        solver.ub = fOdeModelInput.thetaUpperBound - 1e-6;
+        solver.objective = [&](const arma::vec & theta) {
+            const lp & out = xthetallik(arma::join_vert(arma::vectorise(xInitInput), theta),
+                                        covAllDimensionsInput, sigmaAllDimensionsInput, yobsInput,
+                                        fOdeModelInput, useBandInput, priorTemperatureInput);
+            lp ret(-out.value);
+            ret.gradient = -out.gradient.tail(theta.size());
+            return ret;
+        };
+        solver.hessianVector = [&](const arma::vec & theta, const arma::vec & v) {
+            arma::vec direction(xInitInput.size() + theta.size() + sigmaAllDimensionsInput.size(), arma::fill::zeros);
+            direction.subvec(xInitInput.size(), xInitInput.size() + theta.size() - 1) = v;
+            const arma::vec & hv = xthetasigmallikHessianVector(xInitInput, theta, sigmaAllDimensionsInput, yobsInput,
+                                                                covAllDimensionsInput, fOdeModelInput, direction,
+                                                                priorTemperatureInput, useBandInput, false);
+            return arma::vec(-hv.subvec(xInitInput.size(), xInitInput.size() + theta.size() - 1));
+        };
+        return solver.minimize(arma::ones(fOdeModelInput.thetaSize));
+    }
     ThetaOptim objective(yobsInput, fOdeModelInput, covAllDimensionsInput, sigmaAllDimensionsInput, priorTemperatureInput, xInitInput, useBandInput);
     cppoptlib::LbfgsbSolver<ThetaOptim> solver;
     Eigen::VectorXd theta(fOdeModelInput.thetaSize);
@@ -833,3 +859,173 @@ arma::mat optimizeXmissingThetaPhi(const arma::mat & yobsInput,
         return xThetaPhiArgmin;
     }
 }
+
+class XthetasigmaOptim : public cppoptlib::BoundedProblem<double> {
+public:
+    const arma::mat & yobs;
+    const OdeSystem & fOdeModel;
+    const std::vector<gpcov> & covAllDimensions;
+    const arma::vec & priorTemperature;
+    const arma::vec & sigmaFixed;  // empty when sigma is optimised too
+    const unsigned int sigmaSize;
+    const bool useBand;
+    const bool useMean;
+
+    lp evaluate(const Eigen::VectorXd & xthetasigmaInput) const {
+        const arma::mat xlatent(const_cast<double*>(xthetasigmaInput.data()), yobs.n_rows, yobs.n_cols, false, false);
+        const arma::vec theta(const_cast<double*>(xthetasigmaInput.data() + yobs.size()), fOdeModel.thetaSize, false, false);
+        const arma::vec & sigma = sigmaFixed.empty() ?
+                                  arma::vec(const_cast<double*>(xthetasigmaInput.data() + yobs.size() + fOdeModel.thetaSize), sigmaSize, false, false) :
+                                  sigmaFixed;
+        return xthetasigmallik(xlatent, theta, sigma, yobs, covAllDimensions, fOdeModel, priorTemperature, useBand, useMean);
+    }
+
+    double value(const Eigen::VectorXd & xthetasigmaInput) override {
+        if ((xthetasigmaInput.array() < this->lowerBound().array()).any()){
+            return INFINITY;
+        }
+        if ((xthetasigmaInput.array() > this->upperBound().array()).any()){
+            return INFINITY;
+        }
+        if (xthetasigmaInput.array().isNaN().any()){
+            return INFINITY;
+        }
+        const lp & out = evaluate(xthetasigmaInput);
+        if (std::isnan(out.value)){
+            return INFINITY;
+        }
+        return -out.value;
+    }
+
+    void gradient(const Eigen::VectorXd & xthetasigmaInput, Eigen::VectorXd & grad) override {
+        if ((xthetasigmaInput.array() < this->lowerBound().array()).any()){
+            grad.fill(0);
+            for(unsigned i = 0; i < xthetasigmaInput.size(); i++){
+                if(xthetasigmaInput[i] < this->lowerBound()[i]){
+                    grad[i] = -1;
+                }
+            }
+            return;
+        }
+        if ((xthetasigmaInput.array() > this->upperBound().array()).any()){
+            grad.fill(0);
+            for(unsigned i = 0; i < xthetasigmaInput.size(); i++){
+                if(xthetasigmaInput[i] > this->upperBound()[i]){
+                    grad[i] = 1;
+                }
+            }
+            return;
+        }
+        const lp & out = evaluate(xthetasigmaInput);
+        for(unsigned i = 0; i < xthetasigmaInput.size(); i++){
+            grad[i] = -out.gradient(i);
+        }
+    }
+
+    XthetasigmaOptim(const arma::mat & yobsInput,
+                     const OdeSystem & fOdeModelInput,
+                     const std::vector<gpcov> & covAllDimensionsInput,
+                     const arma::vec & priorTemperatureInput,
+                     const arma::vec & sigmaFixedInput,
+                     const unsigned int sigmaSizeInput,
+                     const bool positiveSystem,
+                     const bool useBandInput,
+                     const bool useMeanInput) :
+            BoundedProblem(yobsInput.size() + fOdeModelInput.thetaSize + (sigmaFixedInput.empty() ? sigmaSizeInput : 0)),
+            yobs(yobsInput),
+            fOdeModel(fOdeModelInput),
+            covAllDimensions(covAllDimensionsInput),
+            priorTemperature(priorTemperatureInput),
+            sigmaFixed(sigmaFixedInput),
+            sigmaSize(sigmaSizeInput),
+            useBand(useBandInput),
+            useMean(useMeanInput) {
+        const unsigned int nparam = yobs.size() + fOdeModel.thetaSize + (sigmaFixed.empty() ? sigmaSize : 0);
+        Eigen::VectorXd lb(nparam);
+        lb.fill(positiveSystem ? 0 : -INFINITY);
+        Eigen::VectorXd ub(nparam);
+        ub.fill(INFINITY);
+        for (unsigned j = 0; j < fOdeModel.thetaSize; j++){
+            lb[yobs.size() + j] = fOdeModel.thetaLowerBound(j) + 1e-6;
+            ub[yobs.size() + j] = fOdeModel.thetaUpperBound(j) - 1e-6;
+        }
+        for (unsigned j = yobs.size() + fOdeModel.thetaSize; j < nparam; j++){
+            lb[j] = 1e-7;
+        }
+        this->setLowerBound(lb);
+        this->setUpperBound(ub);
+    }
+};
+
+// joint maximiser of xthetasigmallik over x, theta and sigma, or over x and theta
+// with sigma kept at its initial value when fixSigma; returns the full [x, theta, sigma].
+// newtonCg replaces L-BFGS-B by truncated Newton on exact Hessian-vector products.
+arma::vec optimizeXthetasigma(const arma::mat & yobsInput,
+                              const OdeSystem & fOdeModelInput,
+                              const std::vector<gpcov> & covAllDimensionsInput,
+                              const arma::vec & priorTemperatureInput,
+                              const arma::vec & xthetasigmaInit,
+                              const unsigned int sigmaSize,
+                              const bool fixSigma,
+                              const bool positiveSystem,
+                              const bool useBandInput,
+                              const bool useMeanInput,
+                              const bool newtonCg) {
+    const unsigned int sigmaStart = yobsInput.size() + fOdeModelInput.thetaSize;
+    const arma::vec & sigmaFixed = fixSigma ? arma::vec(xthetasigmaInit.tail(sigmaSize)) : arma::vec();
+    XthetasigmaOptim objective(yobsInput, fOdeModelInput, covAllDimensionsInput, priorTemperatureInput,
+                               sigmaFixed, sigmaSize, positiveSystem, useBandInput, useMeanInput);
+
+    const unsigned int nparam = fixSigma ? sigmaStart : xthetasigmaInit.size();
+    if (newtonCg){
+        NewtonCg solver;
+        solver.lb.set_size(nparam);
+        solver.ub.set_size(nparam);
+        for (unsigned i = 0; i < nparam; i++){
+            solver.lb(i) = objective.lowerBound()[i];
+            solver.ub(i) = objective.upperBound()[i];
+        }
+        auto split = [&](const arma::vec & free) {
+            arma::vec xthetasigma = xthetasigmaInit;
+            xthetasigma.head(nparam) = free;
+            return xthetasigma;
+        };
+        solver.objective = [&](const arma::vec & free) {
+            const arma::vec & xthetasigma = split(free);
+            const arma::mat xlatent(const_cast<double*>(xthetasigma.memptr()), yobsInput.n_rows, yobsInput.n_cols, false, false);
+            const lp & out = xthetasigmallik(xlatent, xthetasigma.subvec(yobsInput.size(), sigmaStart - 1),
+                                             xthetasigma.tail(sigmaSize), yobsInput, covAllDimensionsInput,
+                                             fOdeModelInput, priorTemperatureInput, useBandInput, useMeanInput);
+            lp ret(std::isnan(out.value) ? INFINITY : -out.value);
+            ret.gradient = -out.gradient.head(nparam);
+            return ret;
+        };
+        solver.hessianVector = [&](const arma::vec & free, const arma::vec & v) {
+            const arma::vec & xthetasigma = split(free);
+            const arma::mat xlatent(const_cast<double*>(xthetasigma.memptr()), yobsInput.n_rows, yobsInput.n_cols, false, false);
+            arma::vec direction(xthetasigma.size(), arma::fill::zeros);
+            direction.head(nparam) = v;
+            const arma::vec & hv = xthetasigmallikHessianVector(xlatent, xthetasigma.subvec(yobsInput.size(), sigmaStart - 1),
+                                                                xthetasigma.tail(sigmaSize), yobsInput, covAllDimensionsInput,
+                                                                fOdeModelInput, direction, priorTemperatureInput,
+                                                                useBandInput, useMeanInput);
+            return arma::vec(-hv.head(nparam));
+        };
+        return split(solver.minimize(xthetasigmaInit.head(nparam)));
+    }
+
+    cppoptlib::LbfgsbSolver<XthetasigmaOptim> solver;
+    Eigen::VectorXd xthetasigma(nparam);
+    for (unsigned i = 0; i < nparam; i++){
+        xthetasigma[i] = std::min(std::max(xthetasigmaInit(i), objective.lowerBound()[i]), objective.upperBound()[i]);
+    }
+    const Eigen::VectorXd xthetasigmaStart = xthetasigma;
+    solver.minimize(objective, xthetasigma);
+
+    arma::vec xthetasigmaArgmax = xthetasigmaInit;
+    const Eigen::VectorXd & best = objective.value(xthetasigma) < objective.value(xthetasigmaStart) ? xthetasigma : xthetasigmaStart;
+    for (unsigned i = 0; i < nparam; i++){
+        xthetasigmaArgmax(i) = best[i];
+    }
+    return xthetasigmaArgmax;
+}
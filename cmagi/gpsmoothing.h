@@ -14,7 +14,8 @@ arma::vec optimizeThetaInit(const arma::mat & yobsInput,
                             const arma::vec & sigmaAllDimensionsInput,
                             const arma::vec & priorTemperatureInput,
                             const arma::mat & xInitInput,
-                            const bool useBandInput);
+                            const bool useBandInput,
+                            const bool newtonCg = false);
 
 arma::vec gpsmooth(const arma::mat & yobsInput,
                    const arma::mat & distInput,
@@ -57,4 +58,16 @@ arma::mat optimizeXmissingThetaPhi(const arma::mat & yobsInput,
                                    const arma::mat & phiInitInput,
                                    const arma::uvec & missingComponentDim);
 
+arma::vec optimizeXthetasigma(const arma::mat & yobsInput,
+                              const OdeSystem & fOdeModelInput,
+                              const std::vector<gpcov> & covAllDimensionsInput,
+                              const arma::vec & priorTemperatureInput,
+                              const arma::vec & xthetasigmaInit,
+                              const unsigned int sigmaSize,
+                              const bool fixSigma,
+                              const bool positiveSystem,
+                              const bool useBandInput,
+                              const bool useMeanInput,
+                              const bool newtonCg = false);
+
 #endif //MAGI_MULTI_LANG_GPSMOOTHING_H
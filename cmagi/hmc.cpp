@@ -3,6 +3,35 @@
 
 using namespace arma;
 
+// BCSS coefficients minimise the expected energy error for Gaussian targets,
+// Blanes, Casas and Sanz-Serna 2014, SIAM J Sci Comput 36(4)
+const std::vector<double> & integratorKicks(const std::string & integrator){
+  static const double b2 = 0.211781;
+  static const double b3 = 0.11888010966548;
+  static const std::vector<double> leapfrog = {0.5, 0.5};
+  static const std::vector<double> twostage = {b2, 1 - 2 * b2, b2};
+  static const std::vector<double> threestage = {b3, 0.5 - b3, 0.5 - b3, b3};
+  if(integrator == "leapfrog") return leapfrog;
+  if(integrator == "twostage") return twostage;
+  if(integrator == "threestage") return threestage;
+  throw std::runtime_error("integrator is not specified correctly");
+}
+
+const std::vector<double> & integratorDrifts(const std::string & integrator){
+  static const double a3 = 0.29619504261126;
+  static const std::vector<double> leapfrog = {1};
+  static const std::vector<double> twostage = {0.5, 0.5};
+  static const std::vector<double> threestage = {a3, 1 - 2 * a3, a3};
+  if(integrator == "leapfrog") return leapfrog;
+  if(integrator == "twostage") return twostage;
+  if(integrator == "threestage") return threestage;
+  throw std::runtime_error("integrator is not specified correctly");
+}
+
+unsigned int integratorStages(const std::string & integrator){
+  return integratorDrifts(integrator).size();
+}
+
 //' basic_hmcC
 //' 
 //' BASIC HAMILTONIAN MONTE CARLO UPDATE
@@ -18,37 +47,46 @@ using namespace arma;
 //'                  equal to the dimensionality of the state.
 //' @param traj      TRUE if values of q and p along the trajectory should be 
 //'                  returned (default is FALSE).
+//' @param rng       Random stream for the momentum and the accept step.
+//' @param lpInitial Log probability and gradient at initial if already known,
+//'                  e.g. from the final state of the previous update.
+//' @param integrator "leapfrog", or the "twostage" and "threestage" schemes of
+//'                  Blanes, Casas and Sanz-Serna 2014, with 2 and 3 gradients per step.
 //' @noRd
 hmcstate basic_hmcC(const std::function<lp (vec)> & lpr, 
                     const vec & initial, 
                     const vec & step, 
-                    vec lb, 
-                    vec ub,
-                    const int nsteps = 1, 
-                    const bool traj = false){
+                    const vec & lbInput, 
+                    const vec & ubInput,
+                    const int nsteps,
+                    const bool traj,
+                    RandomStream & rng,
+                    const lp * lpInitial,
+                    const std::string & integrator){
   // Check and process the arguments
   if(step.size() != initial.size())
     throw std::runtime_error("step and initial dimension not matched");
   if(nsteps <= 0)
     throw std::runtime_error("Invalid nsteps argument");
-  if(lb.size() != initial.size()){
-    if(lb.size() == 1){
-      double lbval = lb(0);
-      lb = vec(initial.size());
-      lb.fill(lbval);
+  vec lbExpanded, ubExpanded;
+  if(lbInput.size() != initial.size()){
+    if(lbInput.size() == 1){
+      lbExpanded = vec(initial.size());
+      lbExpanded.fill(lbInput(0));
     }else{
       throw std::runtime_error("lb and initial dimention note matched");  
     }
   }
-  if(ub.size() != initial.size()){
-    if(ub.size() == 1){
-      double ubval = ub(0);
-      ub = vec(initial.size());
-      ub.fill(ubval);
+  if(ubInput.size() != initial.size()){
+    if(ubInput.size() == 1){
+      ubExpanded = vec(initial.size());
+      ubExpanded.fill(ubInput(0));
     }else{
       throw std::runtime_error("ub and initial dimention note matched");  
     }
   }
+  const vec & lb = lbExpanded.is_empty() ? lbInput : lbExpanded;
+  const vec & ub = ubExpanded.is_empty() ? ubInput : ubExpanded;
   
   
   // Allocate space for the trajectory, if its return is requested.
@@ -62,15 +100,23 @@ hmcstate basic_hmcC(const std::function<lp (vec)> & lpr,
     // std::cout << "trajq" << (*trajq)(1,1) << endl;
   }
   
-  // Evaluate the log probability and gradient at the initial position
-  lp lpx = lpr(initial);
+  // Evaluate the log probability and gradient at the initial position,
+  // unless the caller already has them
+  int ngrad = 0;
+  lp lpx;
+  if(lpInitial != 0){
+    lpx = *lpInitial;
+  }else{
+    lpx = lpr(initial);
+    ngrad++;
+  }
   if(std::isnan(lpx.value)){
     throw std::runtime_error("hmc evaluates the log target density to be NaN at initial value");
   }
   // std::cout << "Finish Evaluate the log probability and gradient at the initial position" << endl;
   
   // Compute the kinetic energy at the start of the trajectory
-  vec initialp = randn<vec>(initial.size());
+  vec initialp = rng.normal(initial.size());
 //  std::cout << "HMC initialp = " << initialp.subvec(0, 4).t();
   double kineticinitial = sum(square(initialp)) / 2.0;
   
@@ -86,29 +132,62 @@ hmcstate basic_hmcC(const std::function<lp (vec)> & lpr,
   double Hinitial = -lpx.value + kineticinitial;
   // std::cout << "Finish Compute the trajectory by the leapfrog method" << endl;
   
-  // Make a half step for momentum at the beginning
-  p = p + ((step/2.0) % lpx.gradient);
+  // q, p and gr are updated in place through raw pointers, so the integrator
+  // itself does not allocate
+  const uword n = initial.size();
+  const double * stepmem = step.memptr();
+  const double * lbmem = lb.memptr();
+  const double * ubmem = ub.memptr();
+  double * qmem = q.memptr();
+  double * pmem = p.memptr();
+  double * grmem = gr.memptr();
+  
+  // kicks b_0 .. b_k around drifts a_1 .. a_k of a k stage palindromic step;
+  // the last kick of a step merges with the first kick of the next one
+  const std::vector<double> & kicks = integratorKicks(integrator);
+  const std::vector<double> & drifts = integratorDrifts(integrator);
+  const size_t nstages = drifts.size();
+  
+  // Make a partial step for momentum at the beginning
+  for(uword j = 0; j < n; j++){
+    pmem[j] += kicks[0] * stepmem[j] * grmem[j];
+  }
   
   // Alternate full steps for position and momentum.
   lp lprq;
-  for( int i = 0; i < nsteps; i++){
-    // Make a full step for the position, and evaluate the gradient at the new position.
-    q = q + step % p;
-    // Fig 8: Modification to the leapfrog update of q (eq 2.29) to handle constraints
-    mat bounces = bouncebyconstraint(q, lb, ub);
-    q = bounces.col(0);
-    p = p % bounces.col(1);
-    
-    lprq = lpr(q);
-    if(std::isnan(lprq.value) || lprq.value < -1e8){
+  bool stop = false;
+  for( int i = 0; i < nsteps && !stop; i++){
+    for(size_t s = 0; s < nstages; s++){
+      // Make a step for the position, reflecting at the bounds on the way
+      // Fig 8: Modification to the leapfrog update of q (eq 2.29) to handle constraints
+      for(uword j = 0; j < n; j++){
+        qmem[j] += drifts[s] * stepmem[j] * pmem[j];
+        reflectbyconstraint(qmem[j], pmem[j], lbmem[j], ubmem[j]);
+      }
+      
+      // Evaluate the gradient at the new position.
+      lprq = lpr(q);
+      ngrad++;
+      if(std::isnan(lprq.value) || lprq.value < -1e8){
+        stop = true;
+        break;
+      }
+      std::copy(lprq.gradient.memptr(), lprq.gradient.memptr() + n, grmem);
+      
+      if(s + 1 < nstages){
+        for(uword j = 0; j < n; j++){
+          pmem[j] += kicks[s + 1] * stepmem[j] * grmem[j];
+        }
+      }
+    }
+    if (stop){
       break;
     }
-    gr = lprq.gradient;
     
-    // Record trajectory if asked to, with half-step for momentum.
+    // Record trajectory if asked to, with the closing kick for momentum.
     if (traj){ 
       (*trajq).row(i+1) = q.t();
-      (*trajp).row(i+1) = (p + (step/2.0) % gr).t();
+      (*trajp).row(i+1) = (p + kicks[nstages] * step % gr).t();
       (*trajH)(i+1) = sum(square( (*trajp).row(i+1) ))/2.0 - lprq.value;
       
       if ((*trajH)(i+1) - Hinitial > 50.0) {
@@ -117,11 +196,17 @@ hmcstate basic_hmcC(const std::function<lp (vec)> & lpr,
     }
     
     // Make a full step for the momentum, except when we're coming to the end of the trajectory.  
-    if (i != nsteps-1)
-      p = p + step % gr;
+    if (i != nsteps-1){
+      const double kick = kicks[nstages] + kicks[0];
+      for(uword j = 0; j < n; j++){
+        pmem[j] += kick * stepmem[j] * grmem[j];
+      }
+    }
+  }
+  // Make a partial step for momentum at the end.  
+  for(uword j = 0; j < n; j++){
+    pmem[j] += kicks[nstages] * stepmem[j] * grmem[j];
   }
-  // Make a half step for momentum at the end.  
-  p = p + (step/2.0) % gr;
   
   // Negate momentum at end of trajectory to make the proposal symmetric.
   p = -p;
@@ -139,33 +224,30 @@ hmcstate basic_hmcC(const std::function<lp (vec)> & lpr,
   double delta = Hprop - Hinitial;
   double apr = std::min(1.0,  std::exp(-delta));
   
-  // default REJECT 
-  vec finalq = initial;
-  vec finalp = initialp;
-  double lprfinal = lpx.value;
-  int acc = 0;
-
-  arma::vec accSample = randu(1);
-//  std::cout << "HMC accSample = " << accSample;
-
-  if (as_scalar(accSample) < apr) { // ACCEPT
-    finalq = q;
-    finalp = p;
-    lprfinal = lprq.value;
-    acc = 1;
-  }
-  
   // Return new state, its log probability and gradient, plus additional
   // information, including the trajectory, if requested.
-  
   hmcstate ret;
-  ret.final = finalq;
-  ret.finalp = finalp;
-  ret.lprvalue = lprfinal;
   ret.step = step;
   ret.apr = apr;
-  ret.acc = acc;
   ret.delta = delta;
+  ret.ngrad = ngrad;
+
+  double accSample = rng.uniform();
+//  std::cout << "HMC accSample = " << accSample;
+
+  if (accSample < apr) { // ACCEPT
+    ret.final = q;
+    ret.finalp = p;
+    ret.lprvalue = lprq.value;
+    ret.gradient = lprq.gradient;
+    ret.acc = 1;
+  }else{ // default REJECT
+    ret.final = initial;
+    ret.finalp = initialp;
+    ret.lprvalue = lpx.value;
+    ret.gradient = lpx.gradient;
+    ret.acc = 0;
+  }
   
   if (traj) { 
     ret.trajq = (*trajq);
@@ -181,6 +263,240 @@ hmcstate basic_hmcC(const std::function<lp (vec)> & lpr,
   return ret;
 }
 
+//' basic_hmcC drawing from a stream seeded by armadillo's global generator,
+//' for callers that do not manage their own streams.
+//' @noRd
+hmcstate basic_hmcC(const std::function<lp (vec)> & lpr, 
+                    const vec & initial, 
+                    const vec & step, 
+                    vec lb, 
+                    vec ub,
+                    const int nsteps = 1, 
+                    const bool traj = false){
+  RandomStream rng(resolveSeed(-1));
+  return basic_hmcC(lpr, initial, step, lb, ub, nsteps, traj, rng, 0);
+}
+
+void GaussianSplit::reset(){
+  preparedStep.reset();
+}
+
+void GaussianSplit::prepare(const vec & step){
+  if(preparedStep.n_elem == step.n_elem && preparedTemperature == temperature &&
+     movingIdx.size() == blocks.size() &&
+     std::equal(step.begin(), step.end(), preparedStep.begin())){
+    return;
+  }
+  if(centers.size() != blocks.size() || precisions.size() != blocks.size())
+    throw std::runtime_error("GaussianSplit needs one center and precision per block");
+  const size_t nblocks = blocks.size();
+  movingLocal.assign(nblocks, uvec());
+  movingIdx.assign(nblocks, uvec());
+  movingPrecision.assign(nblocks, mat());
+  eigenvectors.assign(nblocks, mat());
+  propagators.assign(nblocks, mat());
+  uvec inBlock(step.size(), fill::zeros);
+  for(size_t b = 0; b < nblocks; b++){
+    inBlock.elem(blocks[b]).fill(1);
+    // coordinates of zero step stay where they are, their coupling goes to the remainder
+    movingLocal[b] = find(step.elem(blocks[b]) > 0);
+    movingIdx[b] = blocks[b].elem(movingLocal[b]);
+    movingPrecision[b] = precisions[b].submat(movingLocal[b], movingLocal[b]) / temperature;
+    
+    // Hessian of the potential in z = q / step, where the kinetic energy is sum(p^2) / 2
+    const vec & s = step.elem(movingIdx[b]);
+    mat hessian = movingPrecision[b];
+    hessian.each_col() %= s;
+    hessian.each_row() %= s.t();
+    vec lambda;
+    if(!eig_sym(lambda, eigenvectors[b], symmatu(0.5 * (hessian + hessian.t()))))
+      throw std::runtime_error("GaussianSplit: eigendecomposition failed");
+    
+    // exact solution of w'' = -lambda w over unit time, mode by mode
+    mat & propagator = propagators[b];
+    propagator.set_size(lambda.size(), 4);
+    for(uword k = 0; k < lambda.size(); k++){
+      const double omega = std::sqrt(std::abs(lambda(k)));
+      if(lambda(k) > 0){
+        propagator.row(k) = rowvec({std::cos(omega), std::sin(omega) / omega, -omega * std::sin(omega), std::cos(omega)});
+      }else if(lambda(k) < 0){
+        propagator.row(k) = rowvec({std::cosh(omega), std::sinh(omega) / omega, omega * std::sinh(omega), std::cosh(omega)});
+      }else{
+        propagator.row(k) = rowvec({1.0, 1.0, 0.0, 1.0});
+      }
+    }
+  }
+  freeIdx = find(inBlock == 0);
+  preparedStep = step;
+  preparedTemperature = temperature;
+}
+
+void GaussianSplit::removeGradient(const vec & q, vec & gradient) const {
+  for(size_t b = 0; b < movingIdx.size(); b++){
+    gradient.elem(movingIdx[b]) += movingPrecision[b] * (q.elem(movingIdx[b]) - centers[b].elem(movingLocal[b]));
+  }
+}
+
+bool GaussianSplit::flow(vec & q, vec & p, const vec & step, const vec & lb, const vec & ub) const {
+  for(uword j : freeIdx){
+    q(j) += step(j) * p(j);
+    reflectbyconstraint(q(j), p(j), lb(j), ub(j));
+  }
+  bool inside = true;
+  for(size_t b = 0; b < movingIdx.size(); b++){
+    const uvec & idx = movingIdx[b];
+    const mat & V = eigenvectors[b];
+    const mat & c = propagators[b];
+    const vec & s = step.elem(idx);
+    const vec & center = centers[b].elem(movingLocal[b]);
+    const vec & w = V.t() * ((q.elem(idx) - center) / s);
+    const vec & pw = V.t() * p.elem(idx);
+    q.elem(idx) = center + s % (V * (c.col(0) % w + c.col(1) % pw));
+    p.elem(idx) = V * (c.col(2) % w + c.col(3) % pw);
+    // a reflection would not commute with the rotation, so leaving the bounds ends the trajectory
+    if(any(q.elem(idx) < lb.elem(idx)) || any(q.elem(idx) > ub.elem(idx)) || !q.elem(idx).is_finite())
+      inside = false;
+  }
+  return inside;
+}
+
+//' split_hmcC
+//'
+//' HMC UPDATE SPLITTING OFF A GAUSSIAN PART OF THE TARGET
+//' Shahbaba, Lan, Johnson and Neal, 2014. The Hamiltonian of the Gaussian part and
+//' the kinetic energy is followed exactly by GaussianSplit::flow, between half step
+//' kicks by the gradient of the remainder. The Gaussian part only has to resemble
+//' the target for the speed up, the chain is exact for any choice.
+//'
+//' @param lpr       Log probability of the whole target with gradient, as for basic_hmcC.
+//' @param gaussian  Gaussian part split off, prepared here for the given step.
+//' @param initial   The initial position part of the state.
+//' @param step      Stepsizes, the whole trajectory covers nsteps units of time in q / step.
+//' @param lb, ub    Bounds of each coordinate.
+//' @param nsteps    Number of split steps in the trajectory.
+//' @param traj      TRUE if the trajectory should be returned.
+//' @param rng       Random stream for the momentum and the accept step.
+//' @param lpInitial Log probability and gradient at initial if already known.
+//' @noRd
+hmcstate split_hmcC(const std::function<lp (vec)> & lpr,
+                    GaussianSplit & gaussian,
+                    const vec & initial,
+                    const vec & step,
+                    const vec & lb,
+                    const vec & ub,
+                    const int nsteps,
+                    const bool traj,
+                    RandomStream & rng,
+                    const lp * lpInitial){
+  if(step.size() != initial.size())
+    throw std::runtime_error("step and initial dimension not matched");
+  if(lb.size() != initial.size() || ub.size() != initial.size())
+    throw std::runtime_error("lb and ub must match initial dimension in split_hmcC");
+  if(nsteps <= 0)
+    throw std::runtime_error("Invalid nsteps argument");
+  gaussian.prepare(step);
+  
+  const uword n = initial.size();
+  mat trajq, trajp;
+  vec trajH;
+  if (traj){
+    trajq.zeros(nsteps+1, n);
+    trajp.zeros(nsteps+1, n);
+    trajH.zeros(nsteps+1);
+  }
+  
+  int ngrad = 0;
+  lp lpx;
+  if(lpInitial != 0){
+    lpx = *lpInitial;
+  }else{
+    lpx = lpr(initial);
+    ngrad++;
+  }
+  if(std::isnan(lpx.value)){
+    throw std::runtime_error("hmc evaluates the log target density to be NaN at initial value");
+  }
+  
+  vec initialp = rng.normal(n);
+  double kineticinitial = sum(square(initialp)) / 2.0;
+  double Hinitial = -lpx.value + kineticinitial;
+  
+  vec q = initial;
+  vec p = initialp;
+  vec kick = lpx.gradient;
+  gaussian.removeGradient(q, kick);
+  if (traj){
+    trajq.row(0) = initial.t();
+    trajp.row(0) = initialp.t();
+    trajH(0) = Hinitial;
+  }
+  
+  // Strang splitting: half kick, exact Gaussian flow, half kick
+  p += 0.5 * step % kick;
+  lp lprq = lpx;
+  bool diverged = false;
+  for(int i = 0; i < nsteps; i++){
+    if(!gaussian.flow(q, p, step, lb, ub)){
+      diverged = true;
+      break;
+    }
+    lprq = lpr(q);
+    ngrad++;
+    if(std::isnan(lprq.value) || lprq.value < -1e8){
+      diverged = true;
+      break;
+    }
+    kick = lprq.gradient;
+    gaussian.removeGradient(q, kick);
+    
+    if (traj){
+      trajq.row(i+1) = q.t();
+      trajp.row(i+1) = (p + 0.5 * step % kick).t();
+      trajH(i+1) = sum(square(trajp.row(i+1))) / 2.0 - lprq.value;
+    }
+    
+    if (i != nsteps-1){
+      p += step % kick;
+    }
+  }
+  p += 0.5 * step % kick;
+  p = -p;
+  
+  double Hprop = diverged ? arma::datum::inf : -lprq.value + sum(square(p)) / 2.0;
+  if(std::isnan(Hprop)){
+    Hprop = arma::datum::inf;
+  }
+  double delta = Hprop - Hinitial;
+  double apr = std::min(1.0, std::exp(-delta));
+  
+  hmcstate ret;
+  ret.step = step;
+  ret.apr = apr;
+  ret.delta = delta;
+  ret.ngrad = ngrad;
+  
+  if (rng.uniform() < apr) { // ACCEPT
+    ret.final = q;
+    ret.finalp = p;
+    ret.lprvalue = lprq.value;
+    ret.gradient = lprq.gradient;
+    ret.acc = 1;
+  }else{ // default REJECT
+    ret.final = initial;
+    ret.finalp = initialp;
+    ret.lprvalue = lpx.value;
+    ret.gradient = lpx.gradient;
+    ret.acc = 0;
+  }
+  
+  if (traj) {
+    ret.trajq = trajq;
+    ret.trajp = trajp;
+    ret.trajH = trajH;
+  }
+  return ret;
+}
+
 lp lpnormal(vec x){
   lp lpx;
   lpx.value = -sum(square(x))/2.0;
@@ -192,39 +508,44 @@ lp lpnormal(vec x){
 
 
 
-mat bouncebyconstraint(vec x, vec lb, vec ub){
-  uvec toolow = x < lb;
-  uvec toohigh = x > ub;
-  vec uturn = ones<vec>(x.size());
-  
-  for(unsigned int i = 0; i < toolow.size(); i++){
-    if(toolow(i)){
-      if(is_finite(ub(i))){
-        int k = ceil((lb(i) - x(i))/(2.0*(ub(i)-lb(i))));
-        x(i) = x(i) + 2.0*(ub(i)-lb(i))*double(k);
-        if(x(i) > ub(i)){
-          x(i) = 2.0*ub(i) - x(i);
-          uturn(i) = -uturn(i);
-        }
-      }else{
-        x(i) = 2.0*lb(i) - x(i);
-        uturn(i) = -uturn(i);
+//' reflect one coordinate back into [lb, ub], flipping its momentum on each
+//' odd number of reflections. A two sided box is handled by wrapping first.
+//' @noRd
+void reflectbyconstraint(double & x, double & p, const double lb, const double ub){
+  if(x < lb){
+    if(std::isfinite(ub)){
+      int k = ceil((lb - x)/(2.0*(ub-lb)));
+      x = x + 2.0*(ub-lb)*double(k);
+      if(x > ub){
+        x = 2.0*ub - x;
+        p = -p;
       }
+    }else{
+      x = 2.0*lb - x;
+      p = -p;
     }
-    if(toohigh(i)){
-      if(is_finite(lb(i))){
-        int k = ceil((lb(i) - x(i))/(2.0*(ub(i)-lb(i))));
-        x(i) = x(i) + 2.0*(ub(i)-lb(i))*double(k);
-        if(x(i) > ub(i)){
-          x(i) = 2.0*ub(i) - x(i);
-          uturn(i) = -uturn(i);
-        }
-      }else{
-        x(i) = 2.0*ub(i) - x(i);
-        uturn(i) = -uturn(i);
+  }else if(x > ub){
+    if(std::isfinite(lb)){
+      int k = ceil((lb - x)/(2.0*(ub-lb)));
+      x = x + 2.0*(ub-lb)*double(k);
+      if(x > ub){
+        x = 2.0*ub - x;
+        p = -p;
       }
+    }else{
+      x = 2.0*ub - x;
+      p = -p;
     }
   }
+}
+
+mat bouncebyconstraint(const vec & x, const vec & lb, const vec & ub){
+  mat bounces(x.size(), 2);
+  bounces.col(0) = x;
+  bounces.col(1).ones();
+  for(unsigned int i = 0; i < x.size(); i++){
+    reflectbyconstraint(bounces(i, 0), bounces(i, 1), lb(i), ub(i));
+  }
   // std::cout << x << endl;
-  return join_horiz(x,uturn);
-}
\ No newline at end of file
+  return bounces;
+}
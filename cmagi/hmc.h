@@ -4,6 +4,7 @@
 #include <cmath>
 #include <vector>
 #include "classDefinition.h"
+#include "rng.h"
 
 using namespace std;
 
@@ -15,7 +16,65 @@ hmcstate basic_hmcC(const std::function<lp (arma::vec)> &,
                     int,
                     bool);
 
+hmcstate basic_hmcC(const std::function<lp (arma::vec)> &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    int,
+                    bool,
+                    RandomStream &,
+                    const lp * lpInitial = 0,
+                    const std::string & integrator = "leapfrog");
+
+// gradient evaluations per step of an integrator of basic_hmcC, throws for unknown names
+unsigned int integratorStages(const std::string & integrator);
+
+// Gaussian part -0.5 (q - center)' precision (q - center) / temperature of a log density,
+// on disjoint blocks of coordinates, whose Hamiltonian flow split_hmcC follows exactly.
+// The precision need not be positive definite, negative curvature gives hyperbolic modes.
+class GaussianSplit {
+public:
+  std::vector<arma::uvec> blocks;
+  std::vector<arma::vec> centers;
+  std::vector<arma::mat> precisions;
+  double temperature = 1;
+
+  // eigendecomposition of each block in the coordinates q / step, kept while step,
+  // temperature and the number of blocks do not change
+  void prepare(const arma::vec & step);
+  void reset();
+  // add the gradient of minus the Gaussian part, leaving the gradient of the remainder
+  void removeGradient(const arma::vec & q, arma::vec & gradient) const;
+  // move (q, p) for unit time under the Gaussian part and the kinetic energy; coordinates
+  // outside the blocks drift and reflect at the bounds, false if a block leaves them
+  bool flow(arma::vec & q, arma::vec & p, const arma::vec & step,
+            const arma::vec & lb, const arma::vec & ub) const;
+
+private:
+  arma::vec preparedStep;
+  double preparedTemperature = 0;
+  arma::uvec freeIdx;
+  std::vector<arma::uvec> movingLocal;   // block coordinates of nonzero step, within the block
+  std::vector<arma::uvec> movingIdx;     // the same as indices of q
+  std::vector<arma::mat> movingPrecision;  // precision of the moving coordinates over temperature
+  std::vector<arma::mat> eigenvectors;
+  std::vector<arma::mat> propagators;    // per mode [w, pw] -> [w', pw'] as (cww, cwp, cpw, cpp) columns
+};
+
+hmcstate split_hmcC(const std::function<lp (arma::vec)> &,
+                    GaussianSplit &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    const arma::vec &,
+                    int,
+                    bool,
+                    RandomStream &,
+                    const lp * lpInitial = 0);
+
 lp lpnormal(arma::vec);
-arma::mat bouncebyconstraint(arma::vec, arma::vec, arma::vec);
+void reflectbyconstraint(double &, double &, double, double);
+arma::mat bouncebyconstraint(const arma::vec &, const arma::vec &, const arma::vec &);
 
 #endif
@@ -0,0 +1,139 @@
+#include <limits>
+
+#include "laplace.h"
+
+ArrowheadMatrix::ArrowheadMatrix(const unsigned int nb, const unsigned int nd, const unsigned int bandwidthInput) :
+        bandwidth(nb == 0 ? 0 : std::min(bandwidthInput, nb - 1)),
+        band(bandwidth + 1, nb, arma::fill::zeros),
+        border(nd, nb, arma::fill::zeros),
+        corner(nd, nd, arma::fill::zeros) {
+}
+
+ArrowheadCholesky::ArrowheadCholesky(const ArrowheadMatrix & a) : factor(a) {
+    const unsigned int nb = a.band.n_cols;
+    const unsigned int w = a.bandwidth;
+    arma::mat & L = factor.band;
+    // banded Cholesky of A in place, L(i, j) at L(i - j, j)
+    for (unsigned int j = 0; j < nb; j++) {
+        const unsigned int kStart = j > w ? j - w : 0;
+        double diagonal = L(0, j);
+        for (unsigned int k = kStart; k < j; k++) {
+            diagonal -= L(j - k, k) * L(j - k, k);
+        }
+        if (!(diagonal > 0)) {
+            throw std::runtime_error("ArrowheadCholesky: matrix is not positive definite");
+        }
+        L(0, j) = std::sqrt(diagonal);
+        for (unsigned int i = j + 1; i <= std::min(nb - 1, j + w); i++) {
+            double entry = L(i - j, j);
+            for (unsigned int k = i > w ? i - w : 0; k < j; k++) {
+                entry -= L(i - k, k) * L(j - k, k);
+            }
+            L(i - j, j) = entry / L(0, j);
+        }
+    }
+    // Y = B La^-T, one forward substitution per row of B
+    arma::mat & Y = factor.border;
+    for (unsigned int d = 0; d < Y.n_rows; d++) {
+        for (unsigned int i = 0; i < nb; i++) {
+            double entry = Y(d, i);
+            for (unsigned int k = i > w ? i - w : 0; k < i; k++) {
+                entry -= L(i - k, k) * Y(d, k);
+            }
+            Y(d, i) = entry / L(0, i);
+        }
+    }
+    if (factor.corner.n_rows > 0) {
+        const arma::mat & schur = a.corner - Y * Y.t();
+        if (!arma::chol(factor.corner, arma::symmatl(schur), "lower")) {
+            throw std::runtime_error("ArrowheadCholesky: matrix is not positive definite");
+        }
+    }
+}
+
+double ArrowheadCholesky::logDeterminant() const {
+    double ret = 2 * arma::accu(arma::log(factor.band.row(0)));
+    if (factor.corner.n_rows > 0) {
+        ret += 2 * arma::accu(arma::log(factor.corner.diag()));
+    }
+    return ret;
+}
+
+arma::vec ArrowheadCholesky::solveTransposed(const arma::vec & e) const {
+    const unsigned int nb = factor.band.n_cols;
+    const unsigned int nd = factor.corner.n_rows;
+    const unsigned int w = factor.bandwidth;
+    const arma::mat & L = factor.band;
+    arma::vec z(nb + nd);
+    arma::vec rhs = e.head(nb);
+    if (nd > 0) {
+        z.tail(nd) = arma::solve(arma::trimatu(factor.corner.t()), e.tail(nd));
+        rhs -= factor.border.t() * z.tail(nd);
+    }
+    for (unsigned int i = nb; i-- > 0;) {
+        double entry = rhs(i);
+        for (unsigned int k = i + 1; k <= std::min(nb - 1, i + w); k++) {
+            entry -= L(k - i, i) * z(k);
+        }
+        z(i) = entry / L(0, i);
+    }
+    return z;
+}
+
+arma::vec ArrowheadCholesky::solve(const arma::vec & e) const {
+    const unsigned int nb = factor.band.n_cols;
+    const unsigned int nd = factor.corner.n_rows;
+    const unsigned int w = factor.bandwidth;
+    const arma::mat & L = factor.band;
+    arma::vec z(nb + nd);
+    for (unsigned int i = 0; i < nb; i++) {
+        double entry = e(i);
+        for (unsigned int k = i > w ? i - w : 0; k < i; k++) {
+            entry -= L(i - k, k) * z(k);
+        }
+        z(i) = entry / L(0, i);
+    }
+    if (nd > 0) {
+        z.tail(nd) = arma::solve(arma::trimatl(factor.corner), arma::vec(e.tail(nd) - factor.border * z.head(nb)));
+    }
+    return z;
+}
+
+ArrowheadMatrix finiteDifferenceHessian(const std::function<arma::vec(const arma::vec &)> & gradient,
+                                        const arma::vec & at,
+                                        const arma::vec & scale,
+                                        const unsigned int nb,
+                                        const unsigned int bandwidth) {
+    const unsigned int nd = at.size() - nb;
+    ArrowheadMatrix hessian(nb, nd, bandwidth);
+    const unsigned int w = hessian.bandwidth;
+    const arma::vec & step = std::cbrt(std::numeric_limits<double>::epsilon()) * scale;
+    auto difference = [&](const arma::vec & direction) -> arma::vec {
+        return 0.5 * (gradient(at + direction) - gradient(at - direction));
+    };
+
+    // no two columns of a group reach the same row of the band
+    const unsigned int ngroups = std::min(nb, 2 * w + 1);
+    for (unsigned int g = 0; g < ngroups; g++) {
+        arma::vec direction(at.size(), arma::fill::zeros);
+        for (unsigned int j = g; j < nb; j += ngroups) {
+            direction(j) = step(j);
+        }
+        const arma::vec & change = difference(direction);
+        for (unsigned int j = g; j < nb; j += ngroups) {
+            for (unsigned int i = j; i <= std::min(nb - 1, j + w); i++) {
+                hessian.band(i - j, j) = change(i) / step(j);
+            }
+        }
+    }
+    // the dense columns give the border by symmetry
+    for (unsigned int d = 0; d < nd; d++) {
+        arma::vec direction(at.size(), arma::fill::zeros);
+        direction(nb + d) = step(nb + d);
+        const arma::vec & change = difference(direction) / step(nb + d);
+        hessian.border.row(d) = change.head(nb).t();
+        hessian.corner.col(d) = change.tail(nd);
+    }
+    hessian.corner = 0.5 * (hessian.corner + hessian.corner.t());
+    return hessian;
+}
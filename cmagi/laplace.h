@@ -0,0 +1,46 @@
+#ifndef LAPLACE_H
+#define LAPLACE_H
+
+#include <functional>
+
+#include "classDefinition.h"
+
+// symmetric matrix [A B'; B D] whose leading nb x nb block A is banded with the given
+// half bandwidth and whose trailing nd x nd block D is dense, e.g. the Hessian of
+// [x, theta, sigma] with x ordered by time point
+class ArrowheadMatrix {
+public:
+    unsigned int bandwidth;
+    arma::mat band;    // (bandwidth + 1) x nb, band(k, j) = A(j + k, j)
+    arma::mat border;  // B, nd x nb
+    arma::mat corner;  // D, nd x nd
+
+    ArrowheadMatrix(unsigned int nb = 0, unsigned int nd = 0, unsigned int bandwidthInput = 0);
+    unsigned int size() const { return band.n_cols + corner.n_rows; }
+};
+
+// lower Cholesky factor [La 0; Y Ls] of a positive definite ArrowheadMatrix, with La banded
+// like A, Y = B La^-T dense and Ls the factor of the Schur complement D - Y Y'
+class ArrowheadCholesky {
+    ArrowheadMatrix factor;
+public:
+    // throws if the matrix is not positive definite
+    explicit ArrowheadCholesky(const ArrowheadMatrix & a);
+    double logDeterminant() const;
+    // z with L' z = e, so z ~ N(0, inverse of the matrix) when e ~ N(0, I)
+    arma::vec solveTransposed(const arma::vec & e) const;
+    // z with L z = e
+    arma::vec solve(const arma::vec & e) const;
+};
+
+// Hessian of the function whose gradient is given, at the point at, by central differences
+// of the gradient with steps cbrt(eps) * scale. The first nb coordinates are assumed to couple
+// only within bandwidth of each other, so columns bandwidth * 2 + 1 apart share one pair of
+// gradient evaluations (Curtis, Powell and Reid 1974); the remaining ones take a pair each.
+ArrowheadMatrix finiteDifferenceHessian(const std::function<arma::vec(const arma::vec &)> & gradient,
+                                        const arma::vec & at,
+                                        const arma::vec & scale,
+                                        unsigned int nb,
+                                        unsigned int bandwidth);
+
+#endif //LAPLACE_H
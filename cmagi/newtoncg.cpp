@@ -0,0 +1,94 @@
+#include "newtoncg.h"
+
+arma::vec NewtonCg::minimize(const arma::vec & start) {
+    // no bounds given means none
+    arma::vec lower = lb;
+    arma::vec upper = ub;
+    if (lower.empty()) {
+        lower.set_size(start.size());
+        lower.fill(-arma::datum::inf);
+    }
+    if (upper.empty()) {
+        upper.set_size(start.size());
+        upper.fill(arma::datum::inf);
+    }
+    arma::vec x = start;
+    for (unsigned int i = 0; i < x.size(); i++) {
+        x(i) = std::min(std::max(x(i), lower(i)), upper(i));
+    }
+    iterations = 0;
+    hessianProducts = 0;
+    lp current = objective(x);
+    if (!std::isfinite(current.value)) {
+        return x;
+    }
+
+    for (; iterations < maxIterations; iterations++) {
+        const arma::vec & g = current.gradient;
+        // coordinates at a bound the gradient pushes against stay put
+        arma::vec free(x.size(), arma::fill::ones);
+        for (unsigned int i = 0; i < x.size(); i++) {
+            if ((x(i) <= lower(i) && g(i) > 0) || (x(i) >= upper(i) && g(i) < 0)) {
+                free(i) = 0;
+            }
+        }
+        const arma::vec & gFree = g % free;
+        const double gNorm = arma::norm(gFree);
+        if (arma::norm(gFree, "inf") <= gradientTolerance * std::max(1.0, std::abs(current.value))) {
+            break;
+        }
+
+        // conjugate gradients on H p = -g over the free coordinates
+        const double forcing = std::min(0.5, std::sqrt(gNorm));
+        arma::vec p(x.size(), arma::fill::zeros);
+        arma::vec r = -gFree;
+        arma::vec d = r;
+        double rr = arma::dot(r, r);
+        for (unsigned int k = 0; k < maxCgIterations; k++) {
+            const arma::vec & hd = hessianVector(x, d) % free;
+            hessianProducts++;
+            const double curvature = arma::dot(d, hd);
+            if (!(curvature > 0)) {
+                if (k == 0) {
+                    p = d;
+                }
+                break;
+            }
+            const double alpha = rr / curvature;
+            p += alpha * d;
+            r -= alpha * hd;
+            const double rrNext = arma::dot(r, r);
+            if (std::sqrt(rrNext) <= forcing * gNorm) {
+                break;
+            }
+            d = r + rrNext / rr * d;
+            rr = rrNext;
+        }
+        if (arma::dot(p, gFree) >= 0) {
+            p = -gFree;
+        }
+
+        // projected backtracking with the Armijo condition
+        double step = 1;
+        bool moved = false;
+        for (int k = 0; k < 40; k++) {
+            arma::vec next = x + step * p;
+            for (unsigned int i = 0; i < next.size(); i++) {
+                next(i) = std::min(std::max(next(i), lower(i)), upper(i));
+            }
+            const lp & trial = objective(next);
+            if (std::isfinite(trial.value) && trial.value <= current.value + 1e-4 * arma::dot(g, next - x)) {
+                const double decrease = current.value - trial.value;
+                x = next;
+                current = trial;
+                moved = decrease > 1e-14 * std::max(1.0, std::abs(current.value));
+                break;
+            }
+            step *= 0.5;
+        }
+        if (!moved) {
+            break;
+        }
+    }
+    return x;
+}
@@ -0,0 +1,31 @@
+#ifndef NEWTONCG_H
+#define NEWTONCG_H
+
+#include <functional>
+
+#include "classDefinition.h"
+
+// bound constrained truncated Newton: conjugate gradients on the Newton system of the
+// coordinates not held at a bound, stopped by the Eisenstat-Walker forcing term or at
+// negative curvature, then a projected backtracking line search, see Nocedal and Wright
+// 2006, chapter 7. Needs Hessian-vector products only, never the Hessian.
+class NewtonCg {
+public:
+    // value and gradient of the function to minimise
+    std::function<lp(const arma::vec &)> objective;
+    // Hessian at the first argument times the second
+    std::function<arma::vec(const arma::vec &, const arma::vec &)> hessianVector;
+    arma::vec lb, ub;
+    unsigned int maxIterations = 200;
+    unsigned int maxCgIterations = 100;
+    // stop once the projected gradient is below this, relative to max(1, |value|)
+    double gradientTolerance = 1e-8;
+
+    // counts of the last minimize
+    unsigned int iterations = 0;
+    unsigned int hessianProducts = 0;
+
+    arma::vec minimize(const arma::vec & start);
+};
+
+#endif //NEWTONCG_H
@@ -0,0 +1,240 @@
+#include "nuts.h"
+#include "hmc.h"
+
+// energy error beyond which a trajectory is considered divergent
+static const double maxDeltaH = 1000.0;
+
+namespace {
+    struct nutspoint {
+        arma::vec q, p, gradient;
+        double lprvalue;
+    };
+
+    struct nutstree {
+        nutspoint minus, plus, proposal;
+        arma::vec rho;       // sum of momenta over the tree
+        double logsumw;      // log of the sum of multinomial weights
+        double sumacc;       // sum of min(1, exp(-deltaH)) over the leapfrog steps
+        int nleapfrog;
+        bool divergent;
+        bool turning;
+    };
+}
+
+static double logaddexp(double a, double b) {
+    if (a == -arma::datum::inf) return b;
+    if (b == -arma::datum::inf) return a;
+    return std::max(a, b) + std::log1p(std::exp(-std::abs(a - b)));
+}
+
+static arma::vec expandBound(const arma::vec & bound, const unsigned int n) {
+    if (bound.size() == n) {
+        return bound;
+    }
+    if (bound.size() != 1) {
+        throw std::runtime_error("bound and initial dimension not matched");
+    }
+    arma::vec expanded(n);
+    expanded.fill(bound(0));
+    return expanded;
+}
+
+// The state is integrated in coordinates scaled by step, i.e. with unit step
+// size and identity mass, so the momentum is also the velocity for the
+// no-u-turn criterion.
+static bool isTurning(const arma::vec & rho, const arma::vec & pminus, const arma::vec & pplus) {
+    return arma::dot(rho, pminus) <= 0 || arma::dot(rho, pplus) <= 0;
+}
+
+// criterion on the merge of adjacent trees, left before right in trajectory order: across the
+// whole, and as in Stan across the left tree extended by the first point of the right and the
+// right tree extended by the last point of the left, which catch a U-turn between the two that
+// the sums over the whole miss
+static bool isMergeTurning(const arma::vec & rhoLeft, const arma::vec & leftMinus, const arma::vec & leftPlus,
+                           const arma::vec & rhoRight, const arma::vec & rightMinus, const arma::vec & rightPlus) {
+    return isTurning(rhoLeft + rhoRight, leftMinus, rightPlus) ||
+           isTurning(rhoLeft + rightMinus, leftMinus, rightMinus) ||
+           isTurning(rhoRight + leftPlus, leftPlus, rightPlus);
+}
+
+static nutspoint leapfrog(const std::function<lp (arma::vec)> & lpr,
+                          const nutspoint & from,
+                          const arma::vec & step,
+                          const int direction,
+                          const arma::vec & lb,
+                          const arma::vec & ub) {
+    // the tree keeps the points, so only the new one is allocated
+    nutspoint to;
+    to.q = from.q;
+    to.p = from.p;
+    const unsigned int n = to.q.size();
+    double * q = to.q.memptr();
+    double * p = to.p.memptr();
+    for (unsigned int j = 0; j < n; j++) {
+        const double h = direction * step(j);
+        p[j] += 0.5 * h * from.gradient(j);
+        q[j] += h * p[j];
+        reflectbyconstraint(q[j], p[j], lb(j), ub(j));
+    }
+    lp lpq = lpr(to.q);
+    to.lprvalue = lpq.value;
+    to.gradient.swap(lpq.gradient);
+    for (unsigned int j = 0; j < n; j++) {
+        p[j] += 0.5 * direction * step(j) * to.gradient(j);
+    }
+    return to;
+}
+
+static nutstree buildTree(const std::function<lp (arma::vec)> & lpr,
+                          const nutspoint & from,
+                          const arma::vec & step,
+                          const int direction,
+                          const arma::vec & lb,
+                          const arma::vec & ub,
+                          const int depth,
+                          const double Hinitial,
+                          RandomStream & rng) {
+    nutstree tree;
+    if (depth == 0) {
+        const nutspoint & point = leapfrog(lpr, from, step, direction, lb, ub);
+        double H = -point.lprvalue + arma::sum(arma::square(point.p)) / 2.0;
+        if (std::isnan(H) || point.lprvalue < -1e8) {
+            H = arma::datum::inf;
+        }
+        tree.minus = point;
+        tree.plus = point;
+        tree.proposal = point;
+        tree.rho = point.p;
+        tree.logsumw = Hinitial - H;
+        tree.sumacc = std::min(1.0, std::exp(Hinitial - H));
+        tree.nleapfrog = 1;
+        tree.divergent = (H - Hinitial > maxDeltaH);
+        tree.turning = false;
+        return tree;
+    }
+
+    tree = buildTree(lpr, from, step, direction, lb, ub, depth - 1, Hinitial, rng);
+    if (tree.divergent || tree.turning) {
+        return tree;
+    }
+    // continue from the outer end of the first half
+    const nutspoint & outer = direction > 0 ? tree.plus : tree.minus;
+    const nutstree & second = buildTree(lpr, outer, step, direction, lb, ub, depth - 1, Hinitial, rng);
+    tree.nleapfrog += second.nleapfrog;
+    tree.sumacc += second.sumacc;
+    tree.divergent = second.divergent;
+    tree.turning = second.turning;
+    if (tree.divergent || tree.turning) {
+        return tree;
+    }
+
+    // uniform multinomial sampling within the subtree
+    const double logsumw = logaddexp(tree.logsumw, second.logsumw);
+    if (std::log(rng.uniform()) < second.logsumw - logsumw) {
+        tree.proposal = second.proposal;
+    }
+    tree.logsumw = logsumw;
+    const nutstree & left = direction > 0 ? tree : second;
+    const nutstree & right = direction > 0 ? second : tree;
+    const bool turning = isMergeTurning(left.rho, left.minus.p, left.plus.p,
+                                        right.rho, right.minus.p, right.plus.p);
+    if (direction > 0) {
+        tree.plus = second.plus;
+    } else {
+        tree.minus = second.minus;
+    }
+    tree.rho += second.rho;
+    tree.turning = turning;
+    return tree;
+}
+
+//' nuts_hmcC
+//'
+//' NO-U-TURN SAMPLER UPDATE
+//' multinomial variant with generalized no-u-turn criterion, see Betancourt 2017,
+//' checked across the subtrees of every merge as well, as Stan does.
+//'
+//' @param lpr           Function returning the log probability and its gradient.
+//' @param initial       The initial position part of the state (a vector).
+//' @param step          Stepsizes, same dimension as the state.
+//' @param rng           Random stream for the momentum, directions and proposals.
+//' @param maxTreeDepth  Maximum depth of the trajectory tree, so at most
+//'                      2^maxTreeDepth leapfrog steps are taken.
+//' @param lpInitial     Log probability and gradient at initial if already known.
+//' @noRd
+hmcstate nuts_hmcC(const std::function<lp (arma::vec)> & lpr,
+                   const arma::vec & initial,
+                   const arma::vec & step,
+                   const arma::vec & lbInput,
+                   const arma::vec & ubInput,
+                   RandomStream & rng,
+                   const int maxTreeDepth,
+                   const lp * lpInitial) {
+    if (step.size() != initial.size())
+        throw std::runtime_error("step and initial dimension not matched");
+    if (maxTreeDepth <= 0)
+        throw std::runtime_error("Invalid maxTreeDepth argument");
+    const arma::vec & lb = expandBound(lbInput, initial.size());
+    const arma::vec & ub = expandBound(ubInput, initial.size());
+
+    nutspoint start;
+    start.q = initial;
+    const lp & lpx = lpInitial != nullptr ? *lpInitial : lpr(initial);
+    if (std::isnan(lpx.value)) {
+        throw std::runtime_error("nuts evaluates the log target density to be NaN at initial value");
+    }
+    start.lprvalue = lpx.value;
+    start.gradient = lpx.gradient;
+    start.p = rng.normal(initial.size());
+    // coordinates held fixed by a zero step must not take part in the no-u-turn criterion
+    start.p.elem(arma::find(step == 0)).zeros();
+    const double Hinitial = -start.lprvalue + arma::sum(arma::square(start.p)) / 2.0;
+
+    nutspoint minus = start, plus = start, proposal = start;
+    arma::vec rho = start.p;
+    double logsumw = 0;
+    double sumacc = 0;
+    int nleapfrog = 0;
+
+    for (int depth = 0; depth < maxTreeDepth; depth++) {
+        const bool forward = rng.uniform() < 0.5;
+        const nutstree & subtree = forward ?
+                                   buildTree(lpr, plus, step, 1, lb, ub, depth, Hinitial, rng) :
+                                   buildTree(lpr, minus, step, -1, lb, ub, depth, Hinitial, rng);
+        nleapfrog += subtree.nleapfrog;
+        sumacc += subtree.sumacc;
+        if (subtree.divergent || subtree.turning) {
+            break;
+        }
+
+        // biased progressive sampling favours the newer subtree
+        if (std::log(rng.uniform()) < subtree.logsumw - logsumw) {
+            proposal = subtree.proposal;
+        }
+        logsumw = logaddexp(logsumw, subtree.logsumw);
+        const bool turning = forward ?
+                             isMergeTurning(rho, minus.p, plus.p, subtree.rho, subtree.minus.p, subtree.plus.p) :
+                             isMergeTurning(subtree.rho, subtree.minus.p, subtree.plus.p, rho, minus.p, plus.p);
+        if (forward) {
+            plus = subtree.plus;
+        } else {
+            minus = subtree.minus;
+        }
+        rho += subtree.rho;
+        if (turning) {
+            break;
+        }
+    }
+
+    hmcstate ret;
+    ret.final = proposal.q;
+    ret.finalp = proposal.p;
+    ret.lprvalue = proposal.lprvalue;
+    ret.step = step;
+    ret.apr = nleapfrog > 0 ? sumacc / nleapfrog : 0;
+    ret.acc = arma::any(proposal.q != initial) ? 1 : 0;
+    ret.delta = -proposal.lprvalue + arma::sum(arma::square(proposal.p)) / 2.0 - Hinitial;
+    ret.gradient = proposal.gradient;
+    ret.ngrad = lpInitial != nullptr ? nleapfrog : nleapfrog + 1;
+    return ret;
+}
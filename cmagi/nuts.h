@@ -0,0 +1,16 @@
+#ifndef NUTS_H
+#define NUTS_H
+
+#include "classDefinition.h"
+#include "rng.h"
+
+hmcstate nuts_hmcC(const std::function<lp (arma::vec)> & lpr,
+                   const arma::vec & initial,
+                   const arma::vec & step,
+                   const arma::vec & lb,
+                   const arma::vec & ub,
+                   RandomStream & rng,
+                   const int maxTreeDepth = 10,
+                   const lp * lpInitial = nullptr);
+
+#endif //NUTS_H
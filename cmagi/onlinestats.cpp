@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <limits>
+
+#include "onlinestats.h"
+#include "diagnostics.h"
+#include "checkpoint.h"
+
+P2Quantile::P2Quantile(const double probInput) : prob(probInput), count(0) {
+    if (!(prob > 0 && prob < 1)) {
+        throw std::runtime_error("quantile probability must be in (0, 1)");
+    }
+}
+
+void P2Quantile::update(const double x) {
+    if (count < 5) {
+        height[count] = x;
+        count++;
+        if (count == 5) {
+            std::sort(height, height + 5);
+            for (int i = 0; i < 5; i++) {
+                position[i] = i;
+            }
+            desired[0] = 0;
+            desired[1] = 2 * prob;
+            desired[2] = 4 * prob;
+            desired[3] = 2 + 2 * prob;
+            desired[4] = 4;
+        }
+        return;
+    }
+
+    int k = 0;
+    if (x < height[0]) {
+        height[0] = x;
+    } else if (x >= height[4]) {
+        height[4] = x;
+        k = 3;
+    } else {
+        while (x >= height[k + 1]) {
+            k++;
+        }
+    }
+    for (int i = k + 1; i < 5; i++) {
+        position[i] += 1;
+    }
+    const double increment[5] = {0, prob / 2, prob, (1 + prob) / 2, 1};
+    for (int i = 0; i < 5; i++) {
+        desired[i] += increment[i];
+    }
+
+    // move the middle markers towards their desired positions
+    for (int i = 1; i <= 3; i++) {
+        const double d = desired[i] - position[i];
+        if ((d >= 1 && position[i + 1] - position[i] > 1) || (d <= -1 && position[i - 1] - position[i] < -1)) {
+            const int s = d > 0 ? 1 : -1;
+            double h = height[i] + s / (position[i + 1] - position[i - 1]) *
+                    ((position[i] - position[i - 1] + s) * (height[i + 1] - height[i]) / (position[i + 1] - position[i]) +
+                     (position[i + 1] - position[i] - s) * (height[i] - height[i - 1]) / (position[i] - position[i - 1]));
+            if (!(height[i - 1] < h && h < height[i + 1])) {
+                h = height[i] + s * (height[i + s] - height[i]) / (position[i + s] - position[i]);
+            }
+            height[i] = h;
+            position[i] += s;
+        }
+    }
+    count++;
+}
+
+double P2Quantile::value() const {
+    if (count == 0) {
+        return arma::datum::nan;
+    }
+    if (count >= 5) {
+        return height[2];
+    }
+    // exact interpolated quantile of the few draws seen so far
+    double sorted[5];
+    std::copy(height, height + count, sorted);
+    std::sort(sorted, sorted + count);
+    const double h = prob * (count - 1);
+    const unsigned int lo = static_cast<unsigned int>(h);
+    if (lo + 1 >= count) {
+        return sorted[count - 1];
+    }
+    return sorted[lo] + (h - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+void P2Quantile::save(CheckpointWriter & out) const {
+    out.put(prob);
+    out.write(height, sizeof(height));
+    out.write(position, sizeof(position));
+    out.write(desired, sizeof(desired));
+    out.put(count);
+}
+
+void P2Quantile::load(CheckpointReader & in) {
+    prob = in.get<double>();
+    in.read(height, sizeof(height));
+    in.read(position, sizeof(position));
+    in.read(desired, sizeof(desired));
+    count = in.get<unsigned int>();
+}
+
+RunningAutocovariance::RunningAutocovariance(const unsigned int dim, const unsigned int maxLagInput) :
+        maxLag(maxLagInput),
+        count(0),
+        ringPos(0) {
+    if (maxLag == 0) {
+        throw std::runtime_error("maxLag must be positive");
+    }
+    shift = arma::zeros(dim);
+    total = arma::zeros(dim);
+    lagSums = arma::zeros(dim, maxLag + 1);
+    head = arma::zeros(dim, maxLag);
+    ring = arma::zeros(dim, maxLag);
+}
+
+void RunningAutocovariance::update(const arma::vec & x) {
+    if (count == 0) {
+        shift = x;
+    }
+    const arma::vec & y = x - shift;
+    lagSums.col(0) += arma::square(y);
+    const unsigned int nlag = std::min(count, maxLag);
+    for (unsigned int k = 1; k <= nlag; k++) {
+        lagSums.col(k) += y % ring.col((ringPos + maxLag - k) % maxLag);
+    }
+    if (count < maxLag) {
+        head.col(count) = y;
+    }
+    ring.col(ringPos) = y;
+    ringPos = (ringPos + 1) % maxLag;
+    total += y;
+    count++;
+}
+
+arma::mat RunningAutocovariance::autocovariance() const {
+    const unsigned int n = count;
+    if (n == 0) {
+        return arma::mat(0, total.size());
+    }
+    const unsigned int nlag = std::min(maxLag, n - 1);
+    const arma::vec & ybar = total / n;
+    arma::mat acov(nlag + 1, total.size());
+    arma::vec headSum = arma::zeros(total.size());
+    arma::vec tailSum = arma::zeros(total.size());
+    for (unsigned int k = 0; k <= nlag; k++) {
+        if (k > 0) {
+            headSum += head.col(k - 1);
+            tailSum += ring.col((ringPos + maxLag - k) % maxLag);
+        }
+        // y_k, ..., y_(n-1) sum to total - headSum and y_0, ..., y_(n-1-k) to total - tailSum
+        acov.row(k) = ((lagSums.col(k) - ybar % (2 * total - headSum - tailSum)
+                        + (n - k) * arma::square(ybar)) / n).t();
+    }
+    return acov;
+}
+
+void RunningAutocovariance::save(CheckpointWriter & out) const {
+    out.put(maxLag);
+    out.put(count);
+    out.put(ringPos);
+    out.put(shift);
+    out.put(total);
+    out.put(lagSums);
+    out.put(head);
+    out.put(ring);
+}
+
+void RunningAutocovariance::load(CheckpointReader & in) {
+    maxLag = in.get<unsigned int>();
+    count = in.get<unsigned int>();
+    ringPos = in.get<unsigned int>();
+    in.get(shift);
+    in.get(total);
+    in.get(lagSums);
+    in.get(head);
+    in.get(ring);
+}
+
+OnlineSummary::OnlineSummary(const unsigned int dim,
+                             const arma::vec & probsInput,
+                             const arma::uvec & acfIdxInput,
+                             const unsigned int maxLag) :
+        count(0),
+        mean(arma::zeros(dim)),
+        m2(arma::zeros(dim)),
+        probs(probsInput),
+        acfIdx(acfIdxInput),
+        acf(acfIdxInput.size(), maxLag) {
+    if (!acfIdx.empty() && acfIdx.max() >= dim) {
+        throw std::runtime_error("autocovariance index out of range");
+    }
+    sketches.reserve(dim * probs.size());
+    for (unsigned int i = 0; i < dim; i++) {
+        for (unsigned int j = 0; j < probs.size(); j++) {
+            sketches.emplace_back(probs(j));
+        }
+    }
+}
+
+void OnlineSummary::update(const arma::vec & x) {
+    count++;
+    const arma::vec & delta = x - mean;
+    mean += delta / count;
+    m2 += delta % (x - mean);
+    const unsigned int nprobs = probs.size();
+    for (unsigned int i = 0; i < x.size(); i++) {
+        for (unsigned int j = 0; j < nprobs; j++) {
+            sketches[i * nprobs + j].update(x(i));
+        }
+    }
+    if (!acfIdx.empty()) {
+        acf.update(x.elem(acfIdx));
+    }
+}
+
+arma::vec OnlineSummary::variance() const {
+    return m2 / std::max(count - 1.0, 1.0);
+}
+
+arma::mat OnlineSummary::quantiles() const {
+    const unsigned int nprobs = probs.size();
+    arma::mat ret(mean.size(), nprobs);
+    for (unsigned int i = 0; i < mean.size(); i++) {
+        for (unsigned int j = 0; j < nprobs; j++) {
+            ret(i, j) = sketches[i * nprobs + j].value();
+        }
+    }
+    return ret;
+}
+
+// the summary must have been constructed with the same dimension and probabilities
+void OnlineSummary::save(CheckpointWriter & out) const {
+    out.put(count);
+    out.put(mean);
+    out.put(m2);
+    for (const auto & sketch : sketches) {
+        sketch.save(out);
+    }
+    acf.save(out);
+}
+
+void OnlineSummary::load(CheckpointReader & in) {
+    count = in.get<unsigned int>();
+    in.get(mean);
+    in.get(m2);
+    for (auto & sketch : sketches) {
+        sketch.load(in);
+    }
+    acf.load(in);
+}
+
+arma::vec pooledMean(const std::vector<std::shared_ptr<OnlineSummary>> & chains) {
+    arma::vec total = arma::zeros(chains.at(0)->mean.size());
+    double n = 0;
+    for (const auto & chain : chains) {
+        total += chain->count * chain->mean;
+        n += chain->count;
+    }
+    return total / std::max(n, 1.0);
+}
+
+arma::vec pooledVariance(const std::vector<std::shared_ptr<OnlineSummary>> & chains) {
+    const arma::vec & mean = pooledMean(chains);
+    arma::vec m2 = arma::zeros(mean.size());
+    double n = 0;
+    for (const auto & chain : chains) {
+        m2 += chain->m2 + chain->count * arma::square(chain->mean - mean);
+        n += chain->count;
+    }
+    return m2 / std::max(n - 1.0, 1.0);
+}
+
+arma::mat pooledQuantiles(const std::vector<std::shared_ptr<OnlineSummary>> & chains) {
+    arma::mat total = chains.at(0)->quantiles();
+    for (unsigned int c = 1; c < chains.size(); c++) {
+        total += chains[c]->quantiles();
+    }
+    return total / chains.size();
+}
+
+arma::vec pooledEffectiveSampleSize(const std::vector<std::shared_ptr<OnlineSummary>> & chains) {
+    const arma::uvec & acfIdx = chains.at(0)->acfIdx;
+    std::vector<arma::mat> acovs;
+    unsigned int n = chains[0]->count;
+    unsigned int nlag = std::numeric_limits<unsigned int>::max();
+    for (const auto & chain : chains) {
+        acovs.push_back(chain->acf.autocovariance());
+        n = std::min(n, chain->count);
+        nlag = std::min(nlag, static_cast<unsigned int>(acovs.back().n_rows));
+    }
+    arma::vec ess(acfIdx.size());
+    if (nlag == 0) {
+        ess.zeros();
+        return ess;
+    }
+    for (unsigned int i = 0; i < acfIdx.size(); i++) {
+        arma::mat acov(nlag, chains.size());
+        arma::vec chainMeans(chains.size());
+        for (unsigned int c = 0; c < chains.size(); c++) {
+            acov.col(c) = acovs[c](arma::span(0, nlag - 1), i);
+            chainMeans(c) = chains[c]->mean(acfIdx(i));
+        }
+        ess(i) = effectiveSampleSizeAutocovariance(acov, chainMeans, n);
+    }
+    return ess;
+}
@@ -0,0 +1,83 @@
+#ifndef ONLINESTATS_H
+#define ONLINESTATS_H
+
+#include <memory>
+#include <vector>
+
+#include "classDefinition.h"
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// P-square estimate of one quantile from a stream, in constant memory,
+// see Jain and Chlamtac 1985
+class P2Quantile {
+    double prob;
+    double height[5];
+    double position[5];
+    double desired[5];
+    unsigned int count;
+public:
+    explicit P2Quantile(double probInput = 0.5);
+    void update(double x);
+    double value() const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// autocovariance of a stream up to lag maxLag, normalised by the number of
+// draws as autocovariance() in diagnostics.h. Draws are centred at the first
+// one to keep the running sums of products accurate.
+class RunningAutocovariance {
+    unsigned int maxLag;
+    unsigned int count;
+    unsigned int ringPos;
+    arma::vec shift;
+    arma::vec total;
+    arma::mat lagSums;  // dim x (maxLag + 1), sum over t of y_t y_(t-k)
+    arma::mat head;     // first maxLag draws
+    arma::mat ring;     // last maxLag draws
+public:
+    RunningAutocovariance(unsigned int dim = 0, unsigned int maxLagInput = 1);
+    void update(const arma::vec & x);
+    unsigned int size() const { return count; }
+    // (min(maxLag, size() - 1) + 1) x dim
+    arma::mat autocovariance() const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// posterior summaries of one chain accumulated draw by draw, so no stored
+// draws are needed: Welford mean and variance of every coordinate, quantile
+// sketches at probs, and autocovariances of the coordinates in acfIdx
+class OnlineSummary {
+public:
+    unsigned int count;
+    arma::vec mean;
+    arma::vec m2;
+    arma::vec probs;
+    std::vector<P2Quantile> sketches;  // probs.size() per coordinate
+    arma::uvec acfIdx;
+    RunningAutocovariance acf;
+
+    OnlineSummary(unsigned int dim,
+                  const arma::vec & probsInput,
+                  const arma::uvec & acfIdxInput,
+                  unsigned int maxLag = 250);
+    void update(const arma::vec & x);
+    arma::vec variance() const;
+    // dim x probs.size()
+    arma::mat quantiles() const;
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// pooled summaries of chains of equal length
+arma::vec pooledMean(const std::vector<std::shared_ptr<OnlineSummary>> & chains);
+arma::vec pooledVariance(const std::vector<std::shared_ptr<OnlineSummary>> & chains);
+// P-square sketches cannot be merged, the chain estimates are averaged instead
+arma::mat pooledQuantiles(const std::vector<std::shared_ptr<OnlineSummary>> & chains);
+// multi-chain effective sample size of each coordinate in acfIdx
+arma::vec pooledEffectiveSampleSize(const std::vector<std::shared_ptr<OnlineSummary>> & chains);
+
+#endif //ONLINESTATS_H
@@ -1,16 +1,18 @@
 // [[Rcpp::plugins(cpp11)]]
 #include "paralleltempering.h"
+#include "hmc.h"
+#include "checkpoint.h"
 
 using arma::vec;
 using arma::mat;
 using arma::cube;
 
-void print_info(const arma::umat & swapindicator, const arma::umat & mcmcindicator,
+void print_info(const arma::uvec & swapattempt, const arma::uvec & swapaccept, const arma::umat & mcmcindicator,
                 const vec & temperature, const int & niter) {
   std::cout << "Parallel tempering finished:\n"
        << "\tOut of " << niter << " iterations, " 
-       << arma::accu(swapindicator.col(0) > 0) << " swap is performed, \n"
-       << "swap rate is " << double(arma::accu(swapindicator.col(0) > 0)) / niter
+       << arma::accu(swapattempt) << " swaps are proposed, " 
+       << arma::accu(swapaccept) << " are accepted"
        << endl;
   
   for(unsigned int i=0; i<temperature.size(); i++){
@@ -21,95 +23,261 @@ void print_info(const arma::umat & swapindicator, const arma::umat & mcmcindicat
   std::cout << "\n========================\n";
   
   for(unsigned int i=1; i<temperature.size(); i++){
-    int nswap = arma::accu(swapindicator.col(0)==i);
-    int nacceptswap = arma::accu(swapindicator.col(0)==i && swapindicator.col(2)==1);
     std::cout << "Swap between chain " << i << " and chain " << i+1 << ":\n"
-         << "\ttotal swap is " << nswap
-         << ", acceptance number = " << nacceptswap
-         << ", acceptance rate = " << double(nacceptswap) / double(nswap) << endl;
+         << "\ttotal swap is " << swapattempt(i-1)
+         << ", acceptance number = " << swapaccept(i-1)
+         << ", acceptance rate = " << double(swapaccept(i-1)) / double(swapattempt(i-1)) << endl;
+  }
+}
+
+TemperatureLadder::TemperatureLadder(const vec & temperatureInput, double lagInput) :
+  temperature(temperatureInput), lag(lagInput) {
+  restart();
+}
+
+void TemperatureLadder::restart(){
+  rounds = 0;
+  acceptRate = arma::vec(temperature.size() > 1 ? temperature.size()-1 : 0).fill(0.5);
+  energy.restart(temperature.size(), false);
+}
+
+void TemperatureLadder::adapt(const arma::uvec & attempted, const arma::uvec & accepted){
+  const unsigned int n = temperature.size();
+  if(n < 3){
+    return;
+  }
+  for(unsigned int i=0; i+1<n; i++){
+    if(attempted(i) > 0){
+      acceptRate(i) += 0.1 * (double(accepted(i))/attempted(i) - acceptRate(i));
+    }
+  }
+  rounds++;
+  const double gain = 0.1 * lag / (lag + rounds);
+  // pairs accepting more often than the average move apart
+  vec gap = arma::exp(arma::log(arma::diff(temperature)) + gain * (acceptRate - arma::mean(acceptRate)));
+  const double hottest = temperature(n-1);
+  gap *= (hottest - temperature(0)) / arma::sum(gap);
+  temperature.subvec(1, n-1) = temperature(0) + arma::cumsum(gap);
+  temperature(n-1) = hottest;
+}
+
+double TemperatureLadder::thermodynamicLength() const {
+  if(energy.count < 2){
+    return arma::datum::nan;
+  }
+  const vec & sd = arma::sqrt(energy.variance());
+  double length = 0;
+  for(unsigned int i=0; i+1<temperature.size(); i++){
+    length += 0.5 * (sd(i) + sd(i+1)) * (1.0/temperature(i) - 1.0/temperature(i+1));
+  }
+  return length;
+}
+
+// neighbours dbeta apart in inverse temperature, with log density sd s, swap with
+// probability about erfc(dbeta * s / 2) when the log density is close to normal
+unsigned int TemperatureLadder::recommendedSize(double targetAccept) const {
+  const double length = thermodynamicLength();
+  if(!std::isfinite(length)){
+    return temperature.size();
+  }
+  double lo = 0, hi = 10;
+  for(int i=0; i<100; i++){
+    const double mid = (lo + hi) / 2;
+    if(std::erfc(mid) > targetAccept){
+      lo = mid;
+    }else{
+      hi = mid;
+    }
+  }
+  return std::max(2u, 1 + static_cast<unsigned int>(std::ceil(length / (2 * lo))));
+}
+
+vec TemperatureLadder::respaced(unsigned int n) const {
+  const unsigned int m = temperature.size();
+  if(n < 2 || m < 2){
+    throw std::runtime_error("a ladder needs at least two temperatures");
+  }
+  const double length = thermodynamicLength();
+  if(!(length > 0)){
+    return arma::exp(arma::linspace<vec>(log(temperature(0)), log(temperature(m-1)), n));
+  }
+  // cumulative length at the current temperatures, linear in inverse temperature in between
+  const vec & sd = arma::sqrt(energy.variance());
+  const vec & beta = 1.0 / temperature;
+  vec cumulative(m, arma::fill::zeros);
+  for(unsigned int i=1; i<m; i++){
+    cumulative(i) = cumulative(i-1) + 0.5 * (sd(i-1) + sd(i)) * (beta(i-1) - beta(i));
+  }
+  vec ret(n);
+  ret(0) = temperature(0);
+  ret(n-1) = temperature(m-1);
+  unsigned int i = 1;
+  for(unsigned int k=1; k+1<n; k++){
+    const double target = length * k / (n-1);
+    while(i < m-1 && cumulative(i) < target){
+      i++;
+    }
+    const double w = cumulative(i) > cumulative(i-1) ?
+                     (target - cumulative(i-1)) / (cumulative(i) - cumulative(i-1)) : 0;
+    ret(k) = 1.0 / (beta(i-1) + w * (beta(i) - beta(i-1)));
+  }
+  return ret;
+}
+
+void TemperatureLadder::save(CheckpointWriter & out) const {
+  out.put(temperature);
+  out.put(lag);
+  out.put(rounds);
+  out.put(acceptRate);
+  energy.save(out);
+}
+
+void TemperatureLadder::load(CheckpointReader & in){
+  in.get(temperature);
+  lag = in.get<double>();
+  rounds = in.get<unsigned int>();
+  in.get(acceptRate);
+  energy.load(in);
+}
+
+RoundTripCounter::RoundTripCounter(unsigned int n) : walker(n), lastEnd(n), roundTrips(0) {
+  for(unsigned int i=0; i<n; i++){
+    walker(i) = i;
+  }
+  lastEnd.fill(-1);
+}
+
+void RoundTripCounter::exchange(unsigned int i){
+  std::swap(walker(i), walker(i+1));
+}
+
+// a state back at the cold end after reaching the hot end from it completes a round trip
+void RoundTripCounter::endRound(){
+  const unsigned int n = walker.size();
+  if(n < 2){
+    return;
+  }
+  if(lastEnd(walker(0)) == 1){
+    roundTrips++;
+  }
+  lastEnd(walker(0)) = 0;
+  if(lastEnd(walker(n-1)) == 0){
+    lastEnd(walker(n-1)) = 1;
+  }
+}
+
+void RoundTripCounter::save(CheckpointWriter & out) const {
+  out.put(walker);
+  out.put(lastEnd);
+  out.put(roundTrips);
+}
+
+void RoundTripCounter::load(CheckpointReader & in){
+  in.get(walker);
+  in.get(lastEnd);
+  roundTrips = in.get<unsigned int>();
+}
+
+void swapNeighbours(const vec & temperature, vec & logDensity, int parity, RandomStream & rng,
+                    const std::function<void(unsigned int)> & exchange,
+                    arma::uvec & attempted, arma::uvec & accepted){
+  for(unsigned int i=parity; i+1<temperature.size(); i+=2){
+    attempted(i) += 1;
+    const double log_accp_prob = (1.0/temperature(i) - 1.0/temperature(i+1)) * (logDensity(i+1) - logDensity(i));
+    if(log(rng.uniform()) < log_accp_prob){
+      exchange(i);
+      std::swap(logDensity(i), logDensity(i+1));
+      accepted(i) += 1;
+    }
   }
 }
 
 cube parallel_termperingC(std::function<lp (arma::vec)> & lpr, 
-                          std::function<mcmcstate (function<lp(vec)>, mcmcstate)> & mcmc, 
+                          std::function<mcmcstate (function<lp(vec)>, mcmcstate, RandomStream &)> & mcmc, 
                           const arma::vec & temperature, 
                           const arma::vec & initial, 
-                          double alpha0, int niter, bool verbose){
-  std::default_random_engine randgen;
-  std::uniform_real_distribution<double> unifdistr(0.0,1.0);
+                          double alpha0, int niter, bool verbose, long long seed, int nadapt){
+  // stream 0 drives the swaps, replica i draws from stream i+1
+  const uint64_t streamSeed = resolveSeed(seed);
+  RandomStream swaprng(streamSeed, 0);
+  vector<RandomStream> replicarng;
+  for(unsigned int i=0; i<temperature.size(); i++){
+    replicarng.emplace_back(streamSeed, i+1);
+  }
   
-  vector<future<mcmcstate>> slave_mcmc(temperature.size());
-  vector<future<lp>> slave_eval(temperature.size());
+  // one pool for the whole run, replica i always runs on worker i % size
+  ThreadPool pool(std::min(static_cast<unsigned int>(temperature.size()),
+                           std::max(1u, std::thread::hardware_concurrency())));
+  vector<future<void>> slaves(temperature.size());
   vector<function<lp(vec)>> lprtempered(temperature.size());
   vector<mcmcstate> paralxs(temperature.size());
+  auto runReplicas = [&](const std::function<void(unsigned int)> & task) {
+    for(unsigned int i=0; i<temperature.size(); i++){
+      slaves[i] = pool.submitTo(i % pool.size(), std::bind(task, i));
+    }
+    for(unsigned int i=0; i<temperature.size(); i++){
+      slaves[i].get();
+    }
+  };
 
   cube retstate(initial.size()+1, temperature.size(), niter);
-  arma::umat swapindicator(niter, 3, arma::fill::zeros);
+  arma::uvec swapattempt(temperature.size(), arma::fill::zeros);
+  arma::uvec swapaccept(temperature.size(), arma::fill::zeros);
   arma::umat mcmcindicator(temperature.size(), niter, arma::fill::zeros);
 
+  TemperatureLadder ladder(temperature);
+  RoundTripCounter roundtrips(temperature.size());
+
   // initial setup
   for(unsigned int i=0; i<temperature.size(); i++){
-    lprtempered[i] = [&lpr, &temperature, i](vec x) -> lp { 
+    lprtempered[i] = [&lpr, &ladder, i](vec x) -> lp { 
       lp ret = lpr(x);
-      ret.value = ret.value/temperature(i);
-      ret.gradient = ret.gradient/temperature(i);
+      ret.value = ret.value/ladder.temperature(i);
+      ret.gradient = ret.gradient/ladder.temperature(i);
       return ret; 
       };
     paralxs[i].state = initial;
     paralxs[i].acc = 1;
-    slave_eval[i] = async(lprtempered[i], paralxs[i].state);
   }
+  runReplicas([&](unsigned int i) {
+    paralxs[i].lpv = lprtempered[i](paralxs[i].state).value;
+  });
   
-  for(unsigned int i=0; i<temperature.size(); i++){
-    paralxs[i].lpv = slave_eval[i].get().value;
-  }
+  // the tempered log densities are kept, so swaps need no evaluation
+  vec logDensity(temperature.size());
+  auto exchange = [&](unsigned int i) {
+    std::swap(paralxs[i], paralxs[i+1]);
+    paralxs[i].lpv *= ladder.temperature(i+1) / ladder.temperature(i);
+    paralxs[i+1].lpv *= ladder.temperature(i) / ladder.temperature(i+1);
+    roundtrips.exchange(i);
+  };
   
-  int nmilestone = niter/10;
+  int nmilestone = std::max(niter/10, 1);
   for(int it=0; it<niter; it++){
     if(verbose && it % nmilestone == 0){
       std::cout << "\n === mile stone ===> processed " << it / nmilestone * 10
            << "% of MCMC iterations\n";
     }
     // MCMC update
-    
+    runReplicas([&](unsigned int i) {
+      paralxs[i] = mcmc(lprtempered[i], paralxs[i], replicarng[i]);
+    });
     for(unsigned int i=0; i<temperature.size(); i++){
-      // std::cout << paralxs[i].lpv << endl;
-      slave_mcmc[i] = async(mcmc, lprtempered[i], paralxs[i]);
+      logDensity(i) = paralxs[i].lpv * ladder.temperature(i);
     }
-    
-    for(unsigned int i=0; i<temperature.size(); i++){
-      paralxs[i] = slave_mcmc[i].get();
-    }
-    // swapping
-    if(unifdistr(randgen) < alpha0){
-      double moveinfo = unifdistr(randgen)*double(temperature.size());
-      int movefromid = floor(moveinfo);
-      int movetoid = movefromid;
-      if(movefromid == 0){
-        movetoid ++;
-      }else if(movetoid == (int)temperature.size()-1){
-        movetoid --;
-      }else{
-        if(moveinfo - movefromid > 0.5){
-          movetoid ++;
-        }else{
-          movetoid --;
+    // swapping, even and odd neighbour pairs in turn
+    if(swaprng.uniform() < alpha0){
+      const arma::uvec attemptedBefore = swapattempt;
+      const arma::uvec acceptedBefore = swapaccept;
+      swapNeighbours(ladder.temperature, logDensity, it % 2, swaprng, exchange, swapattempt, swapaccept);
+      if(it < nadapt){
+        ladder.adapt(swapattempt - attemptedBefore, swapaccept - acceptedBefore);
+        for(unsigned int i=0; i<temperature.size(); i++){
+          paralxs[i].lpv = logDensity(i) / ladder.temperature(i);
         }
       }
-      swapindicator(it, 0) = min(movefromid, movetoid)+1;
-      swapindicator(it, 1) = max(movefromid, movetoid)+1;
-      
-      slave_eval[0] = async(lprtempered[movefromid], paralxs[movetoid].state);
-      slave_eval[1] = async(lprtempered[movetoid], paralxs[movefromid].state);
-      double log_accp_prob = slave_eval[0].get().value + slave_eval[1].get().value - 
-        paralxs[movefromid].lpv - paralxs[movetoid].lpv;
-      if(log(unifdistr(randgen)) < log_accp_prob){
-        mcmcstate tmp = paralxs[movefromid];
-        paralxs[movefromid] = paralxs[movetoid];
-        paralxs[movetoid] = tmp;
-        swapindicator(it, 2) = 1;
-      }
     }
+    roundtrips.endRound();
     
     // store states
     for(unsigned int i=0; i < temperature.size(); i++){
@@ -119,25 +287,44 @@ cube parallel_termperingC(std::function<lp (arma::vec)> & lpr,
     }
   }
   if(verbose) {
-    print_info(swapindicator, mcmcindicator, temperature, niter); 
+    print_info(swapattempt, swapaccept, mcmcindicator, ladder.temperature, niter); 
+    std::cout << "temperatures = " << ladder.temperature.t()
+         << "round trips = " << roundtrips.roundTrips
+         << ", per iteration = " << roundtrips.roundTrips / double(niter) << endl;
   }
   return retstate;
 }
 
 
-mcmcstate metropolis (function<lp(vec)> lpv, mcmcstate current, double stepsize=1.0){
-  std::default_random_engine randgen;
-  std::uniform_real_distribution<double> unifdistr(0.0,1.0);
-  
+vec selectTemperatureLadder(std::function<lp (arma::vec)> & lpr,
+                            std::function<mcmcstate (function<lp(vec)>, mcmcstate, RandomStream &)> & mcmc,
+                            double maxTemperature, const vec & initial, int npilot,
+                            double targetAccept, long long seed){
+  if(!(maxTemperature > 1) || npilot < 4){
+    throw std::runtime_error("selectTemperatureLadder needs maxTemperature > 1 and npilot >= 4");
+  }
+  // pilot on a dense geometric ladder, the second half estimates the log density
+  // variance at each temperature
+  const vec pilot = arma::exp(arma::linspace<vec>(0, log(maxTemperature), 8));
+  const cube draws = parallel_termperingC(lpr, mcmc, pilot, initial, 1.0, npilot, false, seed);
+  TemperatureLadder ladder(pilot);
+  for(int it=npilot/2; it<npilot; it++){
+    ladder.energy.update(vec(draws.slice(it).row(0).t()) % pilot);
+  }
+  return ladder.respaced(ladder.recommendedSize(targetAccept));
+}
+
+
+mcmcstate metropolis (function<lp(vec)> lpv, mcmcstate current, double stepsize, RandomStream & rng){
   vec proposal = current.state;
-  proposal += arma::randn<vec>(current.state.size())*stepsize;
+  proposal += rng.normal(current.state.size())*stepsize;
   
   // std::cout << proposal << endl;
   
   double proplpv = lpv(proposal).value;
   mcmcstate ret = current;
   ret.acc = 0;
-  if(log(unifdistr(randgen)) < proplpv - current.lpv){
+  if(log(rng.uniform()) < proplpv - current.lpv){
     ret.state = proposal;
     ret.lpv = proplpv;
     ret.acc = 1;
@@ -145,3 +332,10 @@ mcmcstate metropolis (function<lp(vec)> lpv, mcmcstate current, double stepsize=
   return ret;
 }
 
+
+// HMC within a replica, e.g. std::bind(hmcmove, _1, _2, step, nsteps, lb, ub, _3)
+mcmcstate hmcmove (function<lp(vec)> lpv, mcmcstate current, const vec & step, int nsteps,
+                   const vec & lb, const vec & ub, RandomStream & rng){
+  hmcstate post = basic_hmcC(lpv, current.state, step, lb, ub, nsteps, false, rng);
+  return mcmcstate(post);
+}
@@ -1,15 +1,76 @@
+#ifndef PARALLELTEMPERING_H
+#define PARALLELTEMPERING_H
+
 #include <future>
 #include <chrono>
-#include <random>
 #include "classDefinition.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "adaptation.h"
 
 using namespace std;
 
-void print_info(const arma::umat &, const arma::umat &, const arma::vec &, const int &);
+// temperatures adapted towards equal swap acceptance of all neighbouring pairs by
+// moving the log gaps between them, see Vousden, Farr and Mandel 2016; the first and
+// last temperature stay fixed. The variance of the untempered log density at each
+// temperature gives the thermodynamic length, from which the number of temperatures
+// is chosen, see Kone and Kofke 2005.
+class TemperatureLadder {
+public:
+  arma::vec temperature;
+  double lag;             // rounds over which the adaptation gain halves
+  unsigned int rounds;
+  arma::vec acceptRate;   // smoothed swap acceptance per pair
+  WelfordEstimator energy;
+
+  explicit TemperatureLadder(const arma::vec & temperatureInput = arma::vec(), double lagInput = 1000);
+  void restart();
+  // one adaptation step from the swaps attempted and accepted per pair in a round
+  void adapt(const arma::uvec & attempted, const arma::uvec & accepted);
+  double thermodynamicLength() const;
+  // number of temperatures giving swap acceptance about targetAccept between neighbours
+  unsigned int recommendedSize(double targetAccept) const;
+  // n temperatures with the same end points, equally spaced in thermodynamic length
+  arma::vec respaced(unsigned int n) const;
+  void save(CheckpointWriter & out) const;
+  void load(CheckpointReader & in);
+};
+
+// round trips of the states of one set of replicas from the coldest to the hottest
+// temperature and back, the usual efficiency measure of a ladder
+class RoundTripCounter {
+  arma::uvec walker;   // label of the state at each temperature
+  arma::ivec lastEnd;  // per label: 0 last seen at the cold end, 1 at the hot end, -1 neither
+public:
+  unsigned int roundTrips;
+  explicit RoundTripCounter(unsigned int n = 0);
+  void exchange(unsigned int i);
+  void endRound();
+  void save(CheckpointWriter & out) const;
+  void load(CheckpointReader & in);
+};
+
+// one round of swaps between neighbouring temperatures: the pairs (i, i+1) with
+// i % 2 == parity are all proposed at once. logDensity holds the untempered log
+// densities of the replica states and follows accepted swaps; exchange(i) swaps
+// the states of replicas i and i+1. attempted and accepted count per pair.
+void swapNeighbours(const arma::vec & temperature, arma::vec & logDensity, int parity, RandomStream & rng,
+                    const std::function<void(unsigned int)> & exchange,
+                    arma::uvec & attempted, arma::uvec & accepted);
+void print_info(const arma::uvec &, const arma::uvec &, const arma::umat &, const arma::vec &, const int &);
+// nadapt > 0 adapts the ladder in the first nadapt iterations, temperature is then the start
 arma::cube parallel_termperingC(std::function<lp (arma::vec)> & , 
-                          std::function<mcmcstate (function<lp(arma::vec)>, mcmcstate)> &, 
+                          std::function<mcmcstate (function<lp(arma::vec)>, mcmcstate, RandomStream &)> &, 
                           const arma::vec &, 
                           const arma::vec &, 
-                          double, int, bool verbose=true);
-mcmcstate metropolis (function<lp(arma::vec)>, mcmcstate, double);
-  
\ No newline at end of file
+                          double, int, bool verbose=true, long long seed=-1, int nadapt=0);
+// ladder from 1 to maxTemperature chosen from a pilot run of npilot iterations
+arma::vec selectTemperatureLadder(std::function<lp (arma::vec)> &,
+                                  std::function<mcmcstate (function<lp(arma::vec)>, mcmcstate, RandomStream &)> &,
+                                  double maxTemperature, const arma::vec & initial, int npilot,
+                                  double targetAccept=0.23, long long seed=-1);
+mcmcstate metropolis (function<lp(arma::vec)>, mcmcstate, double, RandomStream &);
+mcmcstate hmcmove (function<lp(arma::vec)>, mcmcstate, const arma::vec &, int,
+                   const arma::vec &, const arma::vec &, RandomStream &);
+
+#endif //PARALLELTEMPERING_H
@@ -38,22 +38,7 @@ lp xthetaphi1sigmallik( const mat & xlatent,
       dotmuAllDimension.col(i) = CovAllDimensions[i].dotmu;
     }
     
-    OdeSystem fOdeModelShifted = fOdeModel;
-    
-    fOdeModelShifted.fOde = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> mat{
-      return fOdeModel.fOde(theta, x+muAllDimension, tvec) - dotmuAllDimension;
-    };
-    
-    fOdeModelShifted.fOdeDx = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> cube{
-      return fOdeModel.fOdeDx(theta, x+muAllDimension, tvec);
-    };
-    
-    fOdeModelShifted.fOdeDtheta = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> cube{
-      return fOdeModel.fOdeDtheta(theta, x+muAllDimension, tvec);
-    };
+    const OdeSystem & fOdeModelShifted = fOdeModel.shifted(muAllDimension, dotmuAllDimension);
     
     return xthetaphi1sigmallik(xlatentShifted, theta, phi1, sigmaInput, yobsShifted, CovAllDimensions, 
                                fOdeModelShifted, priorTemperatureInput, useBand, false); 
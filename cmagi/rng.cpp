@@ -0,0 +1,115 @@
+#include "rng.h"
+#include "checkpoint.h"
+
+static const uint32_t philoxM0 = 0xD2511F53;
+static const uint32_t philoxM1 = 0xCD9E8D57;
+static const uint32_t philoxW0 = 0x9E3779B9;
+static const uint32_t philoxW1 = 0xBB67AE85;
+
+RandomStream::RandomStream(const uint64_t seed, const uint64_t streamId) :
+        blockPos(4),
+        hasSpareNormal(false),
+        spareNormal(0) {
+    key[0] = static_cast<uint32_t>(seed);
+    key[1] = static_cast<uint32_t>(seed >> 32);
+    // the low half of the counter is the block index, the high half the stream
+    counter[0] = 0;
+    counter[1] = 0;
+    counter[2] = static_cast<uint32_t>(streamId);
+    counter[3] = static_cast<uint32_t>(streamId >> 32);
+}
+
+void RandomStream::refill() {
+    uint32_t x[4] = {counter[0], counter[1], counter[2], counter[3]};
+    uint32_t k[2] = {key[0], key[1]};
+    for (int round = 0; round < 10; round++) {
+        const uint64_t product0 = static_cast<uint64_t>(philoxM0) * x[0];
+        const uint64_t product1 = static_cast<uint64_t>(philoxM1) * x[2];
+        const uint32_t y0 = static_cast<uint32_t>(product1 >> 32) ^ x[1] ^ k[0];
+        const uint32_t y1 = static_cast<uint32_t>(product1);
+        const uint32_t y2 = static_cast<uint32_t>(product0 >> 32) ^ x[3] ^ k[1];
+        const uint32_t y3 = static_cast<uint32_t>(product0);
+        x[0] = y0;
+        x[1] = y1;
+        x[2] = y2;
+        x[3] = y3;
+        k[0] += philoxW0;
+        k[1] += philoxW1;
+    }
+    for (int i = 0; i < 4; i++) {
+        block[i] = x[i];
+    }
+    blockPos = 0;
+    if (++counter[0] == 0) {
+        ++counter[1];
+    }
+}
+
+uint32_t RandomStream::nextUInt32() {
+    if (blockPos == 4) {
+        refill();
+    }
+    return block[blockPos++];
+}
+
+double RandomStream::uniform() {
+    // 53 random bits, offset by half a unit so that 0 is never returned
+    const uint64_t high = nextUInt32() >> 5;
+    const uint64_t low = nextUInt32() >> 6;
+    return ((high << 26) + low + 0.5) / 9007199254740992.0;
+}
+
+// Box-Muller, the second variate of each pair is kept for the next call
+double RandomStream::normal() {
+    if (hasSpareNormal) {
+        hasSpareNormal = false;
+        return spareNormal;
+    }
+    const double radius = std::sqrt(-2.0 * std::log(uniform()));
+    const double angle = 2.0 * arma::datum::pi * uniform();
+    spareNormal = radius * std::sin(angle);
+    hasSpareNormal = true;
+    return radius * std::cos(angle);
+}
+
+arma::vec RandomStream::uniform(const unsigned int n) {
+    arma::vec draws(n);
+    for (unsigned int i = 0; i < n; i++) {
+        draws(i) = uniform();
+    }
+    return draws;
+}
+
+arma::vec RandomStream::normal(const unsigned int n) {
+    arma::vec draws(n);
+    for (unsigned int i = 0; i < n; i++) {
+        draws(i) = normal();
+    }
+    return draws;
+}
+
+void RandomStream::save(CheckpointWriter & out) const {
+    out.write(key, sizeof(key));
+    out.write(counter, sizeof(counter));
+    out.write(block, sizeof(block));
+    out.put(blockPos);
+    out.put(hasSpareNormal);
+    out.put(spareNormal);
+}
+
+void RandomStream::load(CheckpointReader & in) {
+    in.read(key, sizeof(key));
+    in.read(counter, sizeof(counter));
+    in.read(block, sizeof(block));
+    blockPos = in.get<unsigned int>();
+    hasSpareNormal = in.get<bool>();
+    spareNormal = in.get<double>();
+}
+
+uint64_t resolveSeed(const long long seed) {
+    if (seed >= 0) {
+        return static_cast<uint64_t>(seed);
+    }
+    const arma::vec & u = arma::randu<arma::vec>(2);
+    return (static_cast<uint64_t>(u(0) * 4294967296.0) << 32) | static_cast<uint64_t>(u(1) * 4294967296.0);
+}
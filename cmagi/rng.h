@@ -0,0 +1,41 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+#include "classDefinition.h"
+
+class CheckpointWriter;
+class CheckpointReader;
+
+// Philox4x32-10 counter-based generator, see Salmon, Moraes, Dror and Shaw 2011.
+// A stream is keyed by the seed and numbered by streamId; different streamIds
+// give independent sequences, so each chain or replica owns one and the draws
+// do not depend on which thread runs it.
+class RandomStream {
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t block[4];
+    unsigned int blockPos;
+    bool hasSpareNormal;
+    double spareNormal;
+
+    void refill();
+public:
+    explicit RandomStream(uint64_t seed = 0, uint64_t streamId = 0);
+
+    uint32_t nextUInt32();
+    // uniform on the open interval (0, 1)
+    double uniform();
+    double normal();
+    arma::vec uniform(unsigned int n);
+    arma::vec normal(unsigned int n);
+
+    void save(CheckpointWriter & out) const;
+    void load(CheckpointReader & in);
+};
+
+// a negative seed is replaced by a draw from armadillo's global generator, so
+// callers that seed armadillo (e.g. set.seed in R) stay reproducible
+uint64_t resolveSeed(long long seed);
+
+#endif //RNG_H
@@ -0,0 +1,283 @@
+#include <algorithm>
+
+#include "samplesink.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+RecordLayout::RecordLayout(const unsigned int fullRowsInput, const bool singlePrecisionInput) :
+        fullRows(fullRowsInput),
+        recorded(fullRowsInput > 0 ? arma::regspace<arma::uvec>(0, fullRowsInput - 1) : arma::uvec()),
+        singlePrecision(singlePrecisionInput) {}
+
+RecordLayout::RecordLayout(const unsigned int fullRowsInput, const arma::uvec & recordedInput,
+                           const bool singlePrecisionInput) :
+        fullRows(fullRowsInput),
+        recorded(recordedInput),
+        singlePrecision(singlePrecisionInput) {
+    for (unsigned int i = 0; i < recorded.size(); i++) {
+        if (recorded(i) >= fullRows || (i > 0 && recorded(i) <= recorded(i - 1))) {
+            throw std::runtime_error("recorded rows must be increasing and within the draw");
+        }
+    }
+}
+
+unsigned int RecordLayout::rows() const {
+    return recorded.size();
+}
+
+size_t RecordLayout::elementBytes() const {
+    return singlePrecision ? sizeof(float) : sizeof(double);
+}
+
+bool RecordLayout::keeps(const unsigned int fullRow) const {
+    return std::binary_search(recorded.begin(), recorded.end(), fullRow);
+}
+
+unsigned int RecordLayout::position(const unsigned int fullRow) const {
+    const auto found = std::lower_bound(recorded.begin(), recorded.end(), fullRow);
+    if (found == recorded.end() || *found != fullRow) {
+        throw std::runtime_error("requested row is not recorded");
+    }
+    return found - recorded.begin();
+}
+
+unsigned int SampleSink::rows() const {
+    return layout().rows();
+}
+
+const double * SampleSink::data() const {
+    return layout().singlePrecision ? nullptr : static_cast<const double *>(rawData());
+}
+
+arma::mat SampleSink::samples() const {
+    return samples(layout().recorded);
+}
+
+arma::mat SampleSink::samples(const arma::uvec & fullRows) const {
+    const RecordLayout & kept = layout();
+    arma::uvec stored(fullRows.size());
+    for (unsigned int i = 0; i < fullRows.size(); i++) {
+        stored(i) = kept.position(fullRows(i));
+    }
+    const size_t nrows = kept.rows();
+    arma::mat ret(fullRows.size(), size());
+    if (kept.singlePrecision) {
+        const float * block = static_cast<const float *>(rawData());
+        for (unsigned int j = 0; j < ret.n_cols; j++) {
+            for (unsigned int i = 0; i < ret.n_rows; i++) {
+                ret(i, j) = block[j * nrows + stored(i)];
+            }
+        }
+    } else {
+        const double * block = static_cast<const double *>(rawData());
+        for (unsigned int j = 0; j < ret.n_cols; j++) {
+            for (unsigned int i = 0; i < ret.n_rows; i++) {
+                ret(i, j) = block[j * nrows + stored(i)];
+            }
+        }
+    }
+    return ret;
+}
+
+BlockSink::BlockSink() : memory(nullptr), capacity(0), count(0) {}
+
+void BlockSink::attach(void * memoryInput, const RecordLayout & layoutInput, const unsigned int capacityInput) {
+    memory = memoryInput;
+    recordLayout = layoutInput;
+    capacity = capacityInput;
+    count = 0;
+}
+
+template <typename eT>
+static void writeColumn(eT * column, const arma::uvec & recorded, const double llik, const arma::vec & xthetasigma) {
+    const double * x = xthetasigma.memptr();
+    for (unsigned int i = 0; i < recorded.size(); i++) {
+        const arma::uword r = recorded(i);
+        column[i] = static_cast<eT>(r == 0 ? llik : x[r - 1]);
+    }
+}
+
+void BlockSink::push(const unsigned int /* iter */, const double llik, const arma::vec & xthetasigma) {
+    if (count == capacity) {
+        throw std::runtime_error("sample sink is full");
+    }
+    if (xthetasigma.size() + 1 != recordLayout.fullRows) {
+        throw std::runtime_error("sample sink and draw dimension not matched");
+    }
+    const size_t offset = static_cast<size_t>(count) * recordLayout.rows();
+    if (recordLayout.singlePrecision) {
+        writeColumn(static_cast<float *>(memory) + offset, recordLayout.recorded, llik, xthetasigma);
+    } else if (recordLayout.rows() == recordLayout.fullRows) {
+        double * column = static_cast<double *>(memory) + offset;
+        column[0] = llik;
+        std::copy(xthetasigma.begin(), xthetasigma.end(), column + 1);
+    } else {
+        writeColumn(static_cast<double *>(memory) + offset, recordLayout.recorded, llik, xthetasigma);
+    }
+    count++;
+}
+
+const RecordLayout & BlockSink::layout() const {
+    return recordLayout;
+}
+
+unsigned int BlockSink::size() const {
+    return count;
+}
+
+unsigned int BlockSink::columnsBefore(const unsigned int iter) const {
+    return iter;
+}
+
+const void * BlockSink::rawData() const {
+    return memory;
+}
+
+void BlockSink::resume(const unsigned int kept) {
+    if (kept > capacity) {
+        throw std::runtime_error("sample sink cannot resume beyond its capacity");
+    }
+    count = kept;
+}
+
+InMemorySink::InMemorySink(const unsigned int rows, const unsigned int capacity) :
+        InMemorySink(RecordLayout(rows), capacity) {}
+
+InMemorySink::InMemorySink(const RecordLayout & layout, const unsigned int capacity) {
+    if (layout.singlePrecision) {
+        storeFloat.set_size(layout.rows(), capacity);
+        storeFloat.fill(arma::datum::nan);
+        attach(storeFloat.memptr(), layout, capacity);
+    } else {
+        store.set_size(layout.rows(), capacity);
+        store.fill(arma::datum::nan);
+        attach(store.memptr(), layout, capacity);
+    }
+}
+
+InMemorySink::InMemorySink(void * external, const RecordLayout & layout, const unsigned int capacity) {
+    attach(external, layout, capacity);
+}
+
+#ifndef _WIN32
+MappedFile::MappedFile(const std::string & path, const size_t bytesInput, const bool keepContents) :
+        address(nullptr), bytes(bytesInput) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | (keepContents ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open sample file " + path);
+    }
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        throw std::runtime_error("cannot resize sample file " + path);
+    }
+    address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        address = nullptr;
+        throw std::runtime_error("cannot map sample file " + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (address != nullptr) {
+        munmap(address, bytes);
+    }
+}
+
+void MappedFile::flush() const {
+    if (address != nullptr && msync(address, bytes, MS_SYNC) != 0) {
+        throw std::runtime_error("cannot flush sample file");
+    }
+}
+#else
+MappedFile::MappedFile(const std::string & path, const size_t bytesInput, const bool keepContents) :
+        address(nullptr), bytes(bytesInput) {
+    throw std::runtime_error("memory mapped sample files are not supported on this platform");
+}
+
+MappedFile::~MappedFile() {}
+
+void MappedFile::flush() const {}
+#endif
+
+char * MappedFile::data() const {
+    return static_cast<char *>(address);
+}
+
+size_t MappedFile::size() const {
+    return bytes;
+}
+
+MappedFileSink::MappedFileSink(const std::string & path, const RecordLayout & layout, const unsigned int capacity) :
+        file(std::make_shared<MappedFile>(path, layout.elementBytes() * layout.rows() * static_cast<size_t>(capacity))) {
+    attach(file->data(), layout, capacity);
+}
+
+MappedFileSink::MappedFileSink(std::shared_ptr<MappedFile> fileInput, const size_t offset,
+                               const RecordLayout & layout, const unsigned int capacity) :
+        file(std::move(fileInput)) {
+    if (offset + layout.elementBytes() * layout.rows() * static_cast<size_t>(capacity) > file->size()) {
+        throw std::runtime_error("sample file too small for the sink");
+    }
+    attach(file->data() + offset, layout, capacity);
+}
+
+ThinnedSink::ThinnedSink(std::shared_ptr<SampleSink> innerInput, const unsigned int thinInput) :
+        inner(std::move(innerInput)),
+        thin(thinInput) {
+    if (thin == 0) {
+        throw std::runtime_error("thin must be positive");
+    }
+}
+
+void ThinnedSink::push(const unsigned int iter, const double llik, const arma::vec & xthetasigma) {
+    if (iter % thin == 0) {
+        inner->push(iter / thin, llik, xthetasigma);
+    }
+}
+
+const RecordLayout & ThinnedSink::layout() const {
+    return inner->layout();
+}
+
+unsigned int ThinnedSink::size() const {
+    return inner->size();
+}
+
+unsigned int ThinnedSink::columnsBefore(const unsigned int iter) const {
+    return inner->columnsBefore(thinnedLength(iter, thin));
+}
+
+const void * ThinnedSink::rawData() const {
+    return inner->rawData();
+}
+
+void ThinnedSink::resume(const unsigned int kept) {
+    inner->resume(kept);
+}
+
+NullSink::NullSink(const unsigned int fullRows) : recordLayout(fullRows, arma::uvec()) {}
+
+const RecordLayout & NullSink::layout() const {
+    return recordLayout;
+}
+
+unsigned int NullSink::size() const {
+    return 0;
+}
+
+unsigned int NullSink::columnsBefore(const unsigned int /* iter */) const {
+    return 0;
+}
+
+const void * NullSink::rawData() const {
+    return nullptr;
+}
+
+unsigned int thinnedLength(const unsigned int niter, const unsigned int thin) {
+    return (niter + thin - 1) / thin;
+}
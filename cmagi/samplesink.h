@@ -0,0 +1,136 @@
+#ifndef SAMPLESINK_H
+#define SAMPLESINK_H
+
+#include <memory>
+#include "classDefinition.h"
+
+// which rows of the full column [llik, xthetasigma] of a draw are kept, and
+// whether they are stored as float instead of double
+class RecordLayout {
+public:
+    unsigned int fullRows;
+    arma::uvec recorded;  // increasing indices into the full column
+    bool singlePrecision;
+
+    explicit RecordLayout(unsigned int fullRows = 0, bool singlePrecision = false);
+    RecordLayout(unsigned int fullRows, const arma::uvec & recorded, bool singlePrecision = false);
+    unsigned int rows() const;
+    size_t elementBytes() const;
+    bool keeps(unsigned int fullRow) const;
+    // stored row of a full column row, throws if it is not kept
+    unsigned int position(unsigned int fullRow) const;
+};
+
+// destination of the draws of one chain, fed one iteration at a time. Each kept
+// draw is a column of the rows selected by layout(), log posterior first when
+// kept, stored contiguously in column major order.
+class SampleSink {
+public:
+    virtual ~SampleSink() {}
+    // offer the draw of iteration iter, the sink decides whether to keep it
+    virtual void push(unsigned int iter, double llik, const arma::vec & xthetasigma) = 0;
+    virtual const RecordLayout & layout() const = 0;
+    // number of draws kept so far
+    virtual unsigned int size() const = 0;
+    // number of kept draws that come from iterations before iter
+    virtual unsigned int columnsBefore(unsigned int iter) const = 0;
+    // double or float storage depending on layout().singlePrecision
+    virtual const void * rawData() const = 0;
+    // continue after the first kept draws already in the storage, when resuming a run
+    virtual void resume(unsigned int kept) = 0;
+
+    unsigned int rows() const;
+    // the stored block, null when it is kept in single precision
+    const double * data() const;
+    // copy of the kept draws in double, rows() x size()
+    arma::mat samples() const;
+    // copy of the given rows of the full column, which must all be kept
+    arma::mat samples(const arma::uvec & fullRows) const;
+};
+
+// writes into a fixed rows x capacity block of memory
+class BlockSink : public SampleSink {
+protected:
+    void * memory;
+    RecordLayout recordLayout;
+    unsigned int capacity;
+    unsigned int count;
+
+    BlockSink();
+    void attach(void * memoryInput, const RecordLayout & layoutInput, unsigned int capacityInput);
+public:
+    void push(unsigned int iter, double llik, const arma::vec & xthetasigma) override;
+    const RecordLayout & layout() const override;
+    unsigned int size() const override;
+    unsigned int columnsBefore(unsigned int iter) const override;
+    const void * rawData() const override;
+    void resume(unsigned int kept) override;
+};
+
+// keeps the draws in memory, either its own or a block owned by the caller,
+// e.g. the columns of an output cube
+class InMemorySink : public BlockSink {
+    arma::mat store;
+    arma::fmat storeFloat;
+public:
+    InMemorySink(unsigned int rows, unsigned int capacity);
+    InMemorySink(const RecordLayout & layout, unsigned int capacity);
+    InMemorySink(void * external, const RecordLayout & layout, unsigned int capacity);
+};
+
+// a binary file mapped into memory, shared by the sinks writing to it;
+// keepContents reopens an existing file instead of truncating it
+class MappedFile {
+    void * address;
+    size_t bytes;
+public:
+    MappedFile(const std::string & path, size_t bytes, bool keepContents = false);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    char * data() const;
+    size_t size() const;
+    // write dirty pages back to the file
+    void flush() const;
+};
+
+// writes the draws to a memory mapped file, so the operating system can page
+// them out; offset is in bytes from the start of the file
+class MappedFileSink : public BlockSink {
+    std::shared_ptr<MappedFile> file;
+public:
+    MappedFileSink(const std::string & path, const RecordLayout & layout, unsigned int capacity);
+    MappedFileSink(std::shared_ptr<MappedFile> file, size_t offset, const RecordLayout & layout, unsigned int capacity);
+};
+
+// keeps every thin-th iteration, starting from iteration 0
+class ThinnedSink : public SampleSink {
+    std::shared_ptr<SampleSink> inner;
+    unsigned int thin;
+public:
+    ThinnedSink(std::shared_ptr<SampleSink> inner, unsigned int thin);
+    void push(unsigned int iter, double llik, const arma::vec & xthetasigma) override;
+    const RecordLayout & layout() const override;
+    unsigned int size() const override;
+    unsigned int columnsBefore(unsigned int iter) const override;
+    const void * rawData() const override;
+    void resume(unsigned int kept) override;
+};
+
+// keeps nothing, for chains only run for their effect on others, e.g. hot tempering replicas
+class NullSink : public SampleSink {
+    RecordLayout recordLayout;
+public:
+    explicit NullSink(unsigned int fullRows);
+    void push(unsigned int /* iter */, double /* llik */, const arma::vec & /* xthetasigma */) override {}
+    const RecordLayout & layout() const override;
+    unsigned int size() const override;
+    unsigned int columnsBefore(unsigned int iter) const override;
+    const void * rawData() const override;
+    void resume(unsigned int /* kept */) override {}
+};
+
+// number of draws a thinned chain of niter iterations keeps
+unsigned int thinnedLength(unsigned int niter, unsigned int thin);
+
+#endif //SAMPLESINK_H
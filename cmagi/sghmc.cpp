@@ -0,0 +1,175 @@
+#include "sghmc.h"
+#include "band.h"
+
+WindowedGradient::WindowedGradient(const arma::mat & yobsInput,
+                                   const std::vector<gpcov> & covAllDimensionsInput,
+                                   const OdeSystem & modelInput,
+                                   const arma::vec & priorTemperatureInput,
+                                   const unsigned int sigmaSizeInput,
+                                   const bool useMean,
+                                   const unsigned int windowInput) :
+        yobs(yobsInput),
+        covAllDimensions(covAllDimensionsInput),
+        model(modelInput),
+        sigmaSize(sigmaSizeInput),
+        priorTemperature(3),
+        mu(yobsInput.n_rows, yobsInput.n_cols, arma::fill::zeros),
+        dotmu(yobsInput.n_rows, yobsInput.n_cols, arma::fill::zeros),
+        bandwidth(0),
+        window(std::max(1u, std::min(windowInput, static_cast<unsigned int>(yobsInput.n_rows)))) {
+    if (priorTemperatureInput.n_elem == 1) {
+        priorTemperature.fill(priorTemperatureInput(0));
+    } else if (priorTemperatureInput.n_elem == 2) {
+        priorTemperature = {priorTemperatureInput(0), priorTemperatureInput(1), 1.0};
+    } else if (priorTemperatureInput.n_elem == 3) {
+        priorTemperature = priorTemperatureInput;
+    } else {
+        throw std::invalid_argument("priorTemperatureInput must be scaler, 2-vector or 3-vector");
+    }
+    for (unsigned int d = 0; d < yobs.n_cols; d++) {
+        if (useMean) {
+            mu.col(d) = covAllDimensions[d].mu;
+            dotmu.col(d) = covAllDimensions[d].dotmu;
+        }
+        bandwidth = std::max(bandwidth, covAllDimensions[d].bandsize);
+    }
+    observed = arma::zeros(yobs.n_rows, yobs.n_cols);
+    observed.elem(arma::find_finite(yobs)).fill(1);
+    yShifted = yobs - mu;
+    yShifted.elem(arma::find_nonfinite(yShifted)).fill(0);
+}
+
+arma::vec WindowedGradient::estimate(const arma::vec & xthetasigma, RandomStream & rng, double & share) const {
+    const int n = yobs.n_rows;
+    const unsigned int p = yobs.n_cols;
+    const int w = window;
+    const arma::mat & x = arma::reshape(xthetasigma.head(n * p), n, p);
+    const arma::vec & theta = xthetasigma.subvec(n * p, n * p + model.thetaSize - 1);
+    const arma::vec & sigma = xthetasigma.tail(sigmaSize);
+
+    const int start = std::min(static_cast<int>(rng.uniform() * (n + w - 1)), n + w - 2) - (w - 1);
+    const int first = std::max(0, start);
+    const int last = std::min(n - 1, start + w - 1);
+    const int lo = std::max(0, first - 2 * bandwidth);
+    const int hi = std::min(n - 1, last + 2 * bandwidth);
+    const int m = hi - lo + 1;
+    const double scale = static_cast<double>(n + w - 1) / w;
+    share = static_cast<double>(m) / n;
+
+    arma::vec mask(m, arma::fill::zeros);
+    mask.subvec(first - lo, last - lo).fill(1);
+    const arma::mat & xLocal = x.rows(lo, hi);
+    const arma::vec & tLocal = covAllDimensions[0].tvecCovInput.subvec(lo, hi);
+
+    const arma::mat & xs = xLocal - mu.rows(lo, hi);
+    const arma::mat & f = model.fOde(theta, xLocal, tLocal) - dotmu.rows(lo, hi);
+    const arma::cube & fDx = model.fOdeDx(theta, xLocal, tLocal);
+    const arma::cube & fDtheta = model.fOdeDtheta(theta, xLocal, tLocal);
+
+    // the bands of the local rows, columns lo to hi of the band storage; entries reaching
+    // outside them only feed rows whose terms are not needed
+    auto localProduct = [&](const arma::mat & band, const int bandsize, const arma::vec & v, const bool transposed) {
+        arma::vec out(m);
+        const double * a = band.colptr(lo);
+        if (transposed) {
+            bmatvecmultT(a, v.memptr(), &bandsize, &m, out.memptr());
+        } else {
+            bmatvecmult(a, v.memptr(), &bandsize, &m, out.memptr());
+        }
+        return out;
+    };
+
+    // u = derivative of the window terms of -0.5 r' Kinv r in r, for the chain rule through fOde
+    arma::mat gradientX(m, p);
+    arma::mat u(m, p);
+    arma::vec gradientSigma(p);
+    for (unsigned int d = 0; d < p; d++) {
+        const gpcov & cov = covAllDimensions[d];
+        const arma::vec & xd = xs.col(d);
+        const arma::vec & cinvX = localProduct(cov.CinvBand, cov.bandsize, xd, false);
+        gradientX.col(d) = -0.5 * (localProduct(cov.CinvBand, cov.bandsize, xd % mask, false) + mask % cinvX) /
+                           priorTemperature(1);
+
+        const arma::vec & r = f.col(d) - localProduct(cov.mphiBand, cov.bandsize, xd, false);
+        const arma::vec & kinvR = localProduct(cov.KinvBand, cov.bandsize, r, false);
+        u.col(d) = 0.5 * (localProduct(cov.KinvBand, cov.bandsize, r % mask, false) + mask % kinvR);
+
+        const double sigmaD = sigmaSize == 1 ? sigma(0) : sigma(d);
+        const arma::vec & error = (xd - yShifted.col(d).rows(lo, hi)) % observed.col(d).rows(lo, hi) % mask;
+        gradientX.col(d) -= error / (sigmaD * sigmaD * priorTemperature(2));
+        const double nobs = arma::dot(observed.col(d).rows(lo, hi), mask);
+        gradientSigma(d) = (arma::dot(error, error) / (sigmaD * sigmaD * sigmaD) - nobs / sigmaD) / priorTemperature(2);
+    }
+    arma::vec gradientTheta(model.thetaSize, arma::fill::zeros);
+    for (unsigned int d = 0; d < p; d++) {
+        const gpcov & cov = covAllDimensions[d];
+        arma::vec derivGradient = localProduct(cov.mphiBand, cov.bandsize, u.col(d), true);
+        for (unsigned int k = 0; k < p; k++) {
+            derivGradient -= fDx.slice(k).col(d) % u.col(k);
+        }
+        gradientX.col(d) += derivGradient / priorTemperature(0);
+        gradientTheta -= fDtheta.slice(d).t() * u.col(d) / priorTemperature(0);
+    }
+
+    arma::vec ret(xthetasigma.size(), arma::fill::zeros);
+    for (unsigned int d = 0; d < p; d++) {
+        ret.subvec(d * n + lo, d * n + hi) = gradientX.col(d);
+    }
+    ret.subvec(n * p, n * p + model.thetaSize - 1) = gradientTheta;
+    if (sigmaSize == 1) {
+        ret(n * p + model.thetaSize) = arma::accu(gradientSigma);
+    } else {
+        ret.tail(sigmaSize) = gradientSigma;
+    }
+    return ret * (scale / temperature);
+}
+
+hmcstate sghmcC(const std::function<arma::vec (const arma::vec &)> & gradientEstimate,
+                const arma::vec & initial,
+                const arma::vec & step,
+                const arma::vec & lb,
+                const arma::vec & ub,
+                const int nsteps,
+                const double friction,
+                RandomStream & rng) {
+    if (friction <= 0 || friction > 1) {
+        throw std::runtime_error("sghmcC: friction must be in (0, 1]");
+    }
+    const unsigned int size = initial.size();
+    const arma::vec & eta = arma::square(step);
+    arma::vec q = initial;
+    arma::vec v = step % rng.normal(size);
+    arma::vec gradientMean(size, arma::fill::zeros);
+    arma::vec gradientSquare(size, arma::fill::zeros);
+    for (int i = 0; i < nsteps; i++) {
+        q += v;
+        for (unsigned int j = 0; j < size; j++) {
+            if (q(j) < lb(j)) {
+                q(j) = std::min(2 * lb(j) - q(j), ub(j));
+                v(j) = -v(j);
+            } else if (q(j) > ub(j)) {
+                q(j) = std::max(2 * ub(j) - q(j), lb(j));
+                v(j) = -v(j);
+            }
+        }
+        const arma::vec & g = gradientEstimate(q);
+        const double decay = i == 0 ? 0 : 0.9;
+        gradientMean = decay * gradientMean + (1 - decay) * g;
+        gradientSquare = decay * gradientSquare + (1 - decay) * arma::square(g);
+        const arma::vec & noise = arma::clamp(gradientSquare - arma::square(gradientMean), 0, arma::datum::inf);
+        const arma::vec & beta = arma::clamp(0.5 * eta % noise, 0, friction);
+        v = (1 - friction) * v + eta % g + arma::sqrt(2 * (friction - beta) % eta) % rng.normal(size);
+    }
+
+    hmcstate ret;
+    ret.final = q;
+    ret.finalp = v / step;
+    ret.finalp.elem(arma::find_nonfinite(ret.finalp)).zeros();
+    ret.step = step;
+    ret.gradient = arma::vec(size).fill(arma::datum::nan);
+    ret.lprvalue = arma::datum::nan;
+    ret.acc = 1;
+    ret.apr = 1;
+    ret.ngrad = nsteps;
+    return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef SGHMC_H
+#define SGHMC_H
+
+#include "classDefinition.h"
+#include "rng.h"
+
+// Unbiased estimate of the gradient of xthetasigmallik with the band likelihood from one random
+// window of consecutive time points. The log posterior is a sum of one term per time point, and
+// with Cinv, mphi and Kinv banded the gradient of the terms of a window only involves the points
+// within twice the band of it, so only those are evaluated, fOde included. The window start is
+// uniform on [1 - window, n - 1] and the window is cut to the series, which includes every time
+// point with the same probability window / (n + window - 1); the terms are scaled by its inverse.
+// fOde must act on each time point separately, as it does for every model here. The bounds of
+// the model are not checked, the sampler keeps theta within them.
+class WindowedGradient {
+    const arma::mat & yobs;
+    const std::vector<gpcov> & covAllDimensions;
+    const OdeSystem & model;
+    const unsigned int sigmaSize;
+    arma::vec priorTemperature;  // derivative, level and observation temperatures
+    arma::mat mu, dotmu;         // zero unless useMean
+    arma::mat yShifted;          // yobs - mu, unobserved entries zero
+    arma::mat observed;          // 1 where yobs is finite
+    int bandwidth;               // widest band over the components
+public:
+    const unsigned int window;
+    double temperature = 1;
+
+    WindowedGradient(const arma::mat & yobsInput,
+                     const std::vector<gpcov> & covAllDimensionsInput,
+                     const OdeSystem & modelInput,
+                     const arma::vec & priorTemperatureInput,
+                     unsigned int sigmaSizeInput,
+                     bool useMean,
+                     unsigned int windowInput);
+
+    // the estimate at xthetasigma; share is the fraction of the time points it evaluated
+    arma::vec estimate(const arma::vec & xthetasigma, RandomStream & rng, double & share) const;
+};
+
+// Stochastic gradient HMC (Chen, Fox and Guestrin 2014) in its momentum form with learning rate
+// step^2: v <- (1 - friction) v + step^2 g + N(0, 2 (friction - beta) step^2), q <- q + v.
+// beta = step^2 V / 2 corrects for the gradient noise, with V its variance estimated from the
+// running moments of the gradients along the trajectory, capped at friction. There is no
+// accept / reject, so the draws are approximate; coordinates reflect at the bounds.
+hmcstate sghmcC(const std::function<arma::vec (const arma::vec &)> & gradientEstimate,
+                const arma::vec & initial,
+                const arma::vec & step,
+                const arma::vec & lb,
+                const arma::vec & ub,
+                int nsteps,
+                double friction,
+                RandomStream & rng);
+
+#endif //SGHMC_H
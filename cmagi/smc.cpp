@@ -0,0 +1,178 @@
+#include <iostream>
+
+#include "smc.h"
+#include "hmc.h"
+
+double logSumExp(const arma::vec & x) {
+    const double top = x.max();
+    if (!std::isfinite(top)) {
+        return top;
+    }
+    return top + std::log(arma::accu(arma::exp(x - top)));
+}
+
+// particles are split into one contiguous chunk per worker
+void TemperedSmc::forEachParticle(ThreadPool * pool, const std::function<void(unsigned int)> & task) {
+    const unsigned int n = particles.n_cols;
+    if (!pool || pool->size() <= 1 || n <= 1) {
+        for (unsigned int i = 0; i < n; i++) {
+            task(i);
+        }
+        return;
+    }
+    const unsigned int nchunks = std::min(pool->size(), n);
+    std::vector<std::future<void>> pending;
+    for (unsigned int k = 0; k < nchunks; k++) {
+        const unsigned int first = n * k / nchunks;
+        const unsigned int last = n * (k + 1) / nchunks;
+        pending.push_back(pool->submit([first, last, &task]() {
+            for (unsigned int i = first; i < last; i++) {
+                task(i);
+            }
+        }));
+    }
+    // wait for every chunk before rethrowing, the tasks refer to locals of the caller
+    std::exception_ptr failure;
+    for (auto & chunk : pending) {
+        try {
+            chunk.get();
+        } catch (...) {
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// systematic resampling, one uniform for all particles, see Kitagawa 1996
+void TemperedSmc::resample() {
+    const unsigned int n = particles.n_cols;
+    const arma::vec & cumulative = arma::cumsum(arma::exp(logWeights - logSumExp(logWeights)));
+    arma::uvec ancestor(n);
+    const double offset = resampleRng.uniform();
+    unsigned int j = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        const double u = (i + offset) / n * cumulative(n - 1);
+        while (j < n - 1 && cumulative(j) < u) {
+            j++;
+        }
+        ancestor(i) = j;
+    }
+    particles = arma::mat(particles.cols(ancestor));
+    logDensity = arma::vec(logDensity.elem(ancestor));
+    logWeights.fill(-std::log(static_cast<double>(n)));
+}
+
+void TemperedSmc::run(const arma::mat & initialParticles, const arma::vec & initialLogWeights,
+                      const uint64_t seed, ThreadPool * pool, const bool verbose) {
+    const unsigned int n = initialParticles.n_cols;
+    if (n == 0 || initialLogWeights.size() != n) {
+        throw std::runtime_error("TemperedSmc needs one initial log weight per particle");
+    }
+    if (nMoves == 0) {
+        throw std::runtime_error("TemperedSmc needs at least one move per stage");
+    }
+    particles = initialParticles;
+    logWeights = initialLogWeights;
+    logWeights.elem(arma::find_nonfinite(logWeights)).fill(-arma::datum::inf);
+    logEvidence = logSumExp(logWeights) - std::log(static_cast<double>(n));
+    if (!std::isfinite(logEvidence)) {
+        throw std::runtime_error("TemperedSmc: every initial particle has zero weight");
+    }
+    logWeights -= logSumExp(logWeights);
+    logDensity.set_size(n);
+    logDensity.fill(arma::datum::nan);
+    ngrad.zeros(n);
+    particleRng.clear();
+    for (unsigned int i = 0; i < n; i++) {
+        particleRng.emplace_back(seed, i);
+    }
+    resampleRng = RandomStream(seed, n);
+
+    arma::vec slopes(n);
+    auto updateSlopes = [&]() {
+        forEachParticle(pool, [&](const unsigned int i) {
+            slopes(i) = slope(particles.col(i));
+            if (!std::isfinite(slopes(i))) {
+                slopes(i) = -arma::datum::inf;
+            }
+        });
+    };
+    updateSlopes();
+
+    std::vector<double> lambdaPath;
+    double lambda = 0;
+    while (lambda < 1) {
+        // conditional ESS of reweighting by exp(delta * slope), relative to n
+        auto conditionalEss = [&](const double delta) {
+            const arma::vec & increment = delta * slopes;
+            return std::exp(2 * logSumExp(logWeights + increment) - logSumExp(logWeights + 2 * increment));
+        };
+        double delta = 1 - lambda;
+        if (conditionalEss(delta) < essRatio) {
+            double lo = 0;
+            double hi = delta;
+            for (int k = 0; k < 50; k++) {
+                const double mid = 0.5 * (lo + hi);
+                if (conditionalEss(mid) < essRatio) {
+                    hi = mid;
+                } else {
+                    lo = mid;
+                }
+            }
+            // at least a small step, so a particle of much larger slope cannot stall the path
+            delta = std::max(lo, 1e-8);
+        }
+        lambda = 1 - lambda - delta < 1e-10 ? 1 : lambda + delta;
+
+        const arma::vec & increment = delta * slopes;
+        logEvidence += logSumExp(logWeights + increment);
+        logWeights += increment;
+        logWeights.elem(arma::find_nonfinite(logWeights)).fill(-arma::datum::inf);
+        logWeights -= logSumExp(logWeights);
+
+        const double ess = 1 / arma::accu(arma::exp(2 * logWeights));
+        if (ess < resampleRatio * n) {
+            resample();
+        }
+
+        // leapfrog steps from the weighted spread of the particles
+        const arma::vec & weights = arma::exp(logWeights);
+        const arma::vec & mean = particles * weights;
+        const arma::vec & variance = arma::square(particles) * weights - arma::square(mean);
+        const arma::vec & step = stepScale * arma::sqrt(arma::clamp(variance, 0, arma::datum::inf));
+
+        arma::vec accepted(n, arma::fill::zeros);
+        const std::function<lp(arma::vec)> & stageTarget = [&](const arma::vec & z) { return target(z, lambda); };
+        forEachParticle(pool, [&](const unsigned int i) {
+            arma::vec state = particles.col(i);
+            for (unsigned int m = 0; m < nMoves; m++) {
+                const hmcstate & post = basic_hmcC(stageTarget, state, step, lb, ub, nsteps, false, particleRng[i]);
+                state = post.final;
+                logDensity(i) = post.lprvalue;
+                accepted(i) += post.acc;
+                ngrad(i) += post.ngrad;
+            }
+            particles.col(i) = state;
+        });
+        updateSlopes();
+
+        const double acceptRate = arma::mean(accepted) / nMoves;
+        if (acceptRate > 0.9) {
+            stepScale *= 1.2;
+        } else if (acceptRate < 0.6) {
+            stepScale *= 0.8;
+        }
+        lambdaPath.push_back(lambda);
+        if (verbose) {
+            std::cout << "TemperedSmc stage " << lambdaPath.size() << ": lambda = " << lambda
+                      << ", ess = " << ess << ", acceptance = " << acceptRate << "\n";
+        }
+    }
+    lambdas = arma::vec(lambdaPath);
+    finalEss = 1 / arma::accu(arma::exp(2 * logWeights));
+    resample();
+}
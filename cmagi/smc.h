@@ -0,0 +1,53 @@
+#ifndef SMC_H
+#define SMC_H
+
+#include "classDefinition.h"
+#include "rng.h"
+#include "threadpool.h"
+
+// Tempered sequential Monte Carlo along the linear path
+// log pi_lambda(z) = log pi_0(z) + lambda * slope(z), lambda from 0 to 1,
+// see Del Moral, Doucet and Jasra 2006. Each stage takes the largest lambda step
+// that keeps the conditional effective sample size of the reweighted particles at
+// essRatio (Zhou, Johansen and Aston 2016), resamples systematically when the
+// effective sample size drops below resampleRatio, then moves every particle by
+// HMC at the new lambda. Particle i always draws from stream i, so the result does
+// not depend on how many threads move the particles.
+class TemperedSmc {
+public:
+    // log pi_lambda with its gradient, for lambda in (0, 1]
+    std::function<lp(const arma::vec &, double)> target;
+    std::function<double(const arma::vec &)> slope;
+    arma::vec lb, ub;
+    int nsteps = 10;
+    unsigned int nMoves = 5;
+    double essRatio = 0.5;
+    double resampleRatio = 0.5;
+    // leapfrog step as a fraction of the particle sd, adapted towards acceptance in [0.6, 0.9]
+    double stepScale = 0.1;
+
+    // one column per particle, equally weighted after run
+    arma::mat particles;
+    arma::vec logWeights;
+    arma::vec logDensity;    // log pi_lambda of each particle at the last lambda
+    arma::vec lambdas;      // lambda after each stage
+    double logEvidence = 0;  // log of the normalising constant of pi_1 relative to pi_0
+    double finalEss = 0;     // effective sample size before the final resampling
+    arma::vec ngrad;         // gradient evaluations per particle
+
+    // initialLogWeights are log pi_0 - log of the density the initial particles were drawn from
+    void run(const arma::mat & initialParticles, const arma::vec & initialLogWeights,
+             uint64_t seed, ThreadPool * pool, bool verbose);
+
+private:
+    std::vector<RandomStream> particleRng;
+    RandomStream resampleRng;
+
+    void forEachParticle(ThreadPool * pool, const std::function<void(unsigned int)> & task);
+    void resample();
+};
+
+// log sum exp(x), stable for large x
+double logSumExp(const arma::vec & x);
+
+#endif //SMC_H
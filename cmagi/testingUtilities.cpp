@@ -3,6 +3,11 @@
 #include "paralleltempering.h"
 #include "tgtdistr.h"
 #include "dynamicalSystemModels.h"
+#include "MagiSolver.h"
+#include "laplace.h"
+#include "xthetasigma.h"
+#include "sghmc.h"
+#include "testingUtilities.h"
 
 using namespace arma;
 
@@ -84,6 +89,145 @@ double bandTest(std::string filename="data_band.txt"){
 
 
 
+// the builtin "FN" or "Hes1" model with data simulated by RK4 at its usual parameters,
+// with noise of 0.1 sd of each component
+struct SimulatedProblem {
+    OdeSystem model;
+    vec tvec;
+    mat yobs;
+    bool positiveSystem = false;
+};
+
+static SimulatedProblem simulatedProblem(const std::string & modelName, const int seed) {
+    SimulatedProblem problem;
+    vec theta, x0;
+    double tEnd;
+    unsigned int nobs;
+    if (modelName == "FN") {
+        problem.model = OdeSystem(fnmodelODE, fnmodelDx, fnmodelDtheta, zeros(3), ones(3) * datum::inf);
+        theta = {0.2, 0.2, 3};
+        x0 = {-1, 1};
+        tEnd = 20;
+        nobs = 41;
+    } else if (modelName == "Hes1") {
+        problem.model = OdeSystem(hes1modelODE, hes1modelDx, hes1modelDtheta, zeros(7), ones(7) * datum::inf);
+        theta = {0.022, 0.3, 0.031, 0.028, 0.5, 20, 0.3};
+        x0 = {1.438575, 2.037488, 17.90385};
+        tEnd = 240;
+        nobs = 33;
+        problem.positiveSystem = true;
+    } else {
+        throw std::runtime_error("modelName must be FN or Hes1");
+    }
+
+    problem.tvec = linspace<vec>(0, tEnd, nobs);
+    const unsigned int substeps = 100;
+    const double h = tEnd / (nobs - 1) / substeps;
+    const OdeSystem & model = problem.model;
+    auto derivative = [&](const mat & x) -> mat { return model.fOde(theta, x, zeros(1)); };
+    mat xtrue(nobs, x0.size());
+    mat state = x0.t();
+    for (unsigned int i = 0; i < nobs; i++) {
+        xtrue.row(i) = state;
+        for (unsigned int k = 0; k < substeps && i + 1 < nobs; k++) {
+            const mat & k1 = derivative(state);
+            const mat & k2 = derivative(state + 0.5 * h * k1);
+            const mat & k3 = derivative(state + 0.5 * h * k2);
+            const mat & k4 = derivative(state + h * k3);
+            state += h / 6.0 * (k1 + 2 * k2 + 2 * k3 + k4);
+        }
+    }
+    RandomStream rng(seed, 0);
+    problem.yobs = xtrue;
+    for (unsigned int d = 0; d < problem.yobs.n_cols; d++) {
+        problem.yobs.col(d) += 0.1 * stddev(xtrue.col(d)) * rng.normal(nobs);
+    }
+    return problem;
+}
+
+// a solver of the problem with banded likelihood and mean, initialised up to sampling
+static std::shared_ptr<MagiSolver> initialisedSolver(const SimulatedProblem & problem, const unsigned int niterHmc,
+                                                     const int nstepsHmc, const int seed) {
+    static const vec noVec;
+    static const mat noMat;
+    auto solver = std::make_shared<MagiSolver>(
+            problem.yobs, problem.model, problem.tvec, noVec, noMat, noMat, noVec, noMat, noMat,
+            1, 1, 1, "generalMatern", nstepsHmc, 0.5, niterHmc, vec(), 1, 20,
+            false, true, true, false, false, false, problem.positiveSystem, false,
+            "hmc", 10, "legacy", "diag", 0.8, 1, seed);
+    solver->setupPhiSigma();
+    solver->initXmudotmu();
+    solver->initTheta();
+    solver->initMissingComponent();
+    return solver;
+}
+
+// gradient evaluations per bulk ESS of theta for each integrator of basic_hmcC, one row each for
+// leapfrog, twostage and threestage, on the MAGI posterior of a simulatedProblem
+// [[Rcpp::export]]
+arma::mat integratorBenchmark(const std::string modelName = "FN",
+                              const unsigned int niterHmc = 2000,
+                              const int nstepsHmc = 20,
+                              const int seed = 2024) {
+    const SimulatedProblem & problem = simulatedProblem(modelName, seed);
+    const std::vector<std::string> integrators = {"leapfrog", "twostage", "threestage"};
+    mat ret(integrators.size(), problem.model.thetaSize);
+    for (unsigned int k = 0; k < integrators.size(); k++) {
+        const std::shared_ptr<MagiSolver> & solver = initialisedSolver(problem, niterHmc, nstepsHmc, seed);
+        solver->integrator = integrators[k];
+        solver->sampleInEpochs();
+        ret.row(k) = solver->gradientsPerEss.col(0).t();
+    }
+    return ret;
+}
+
+// the Hessian-vector product of xthetasigmallik in a random direction at the start of sampling
+// of a simulatedProblem, and the central difference of its gradient, as two columns
+// [[Rcpp::export]]
+arma::mat hessianVectorCheck(const std::string modelName = "FN", const int seed = 2024) {
+    const SimulatedProblem & problem = simulatedProblem(modelName, seed);
+    const std::shared_ptr<MagiSolver> & solver = initialisedSolver(problem, 1, 1, seed);
+    const vec & at = join_vert(join_vert(vectorise(solver->xInit), vec(solver->thetaInit)), solver->sigmaInit);
+    RandomStream rng(seed, 1);
+    const vec & direction = rng.normal(at.size()) % (abs(at) + 1);
+    const vec & hvp = xthetasigmallikHessianVector(solver->xInit, vec(solver->thetaInit), solver->sigmaInit, problem.yobs,
+                                                   solver->covAllDimensions, problem.model, direction,
+                                                   solver->priorTemperature, solver->useBand, solver->useMean);
+    const double h = 1e-5;
+    const vec & difference = (solver->xthetasigmaLlik(at + h * direction, solver->priorTemperature).gradient -
+                              solver->xthetasigmaLlik(at - h * direction, solver->priorTemperature).gradient) / (2 * h);
+    return join_horiz(hvp, difference);
+}
+
+// Laplace approximation of log int exp(-(z - m)' P (z - m) / 2) dz, as drawLaplace takes it from a
+// finite difference Hessian with a banded leading block, and its exact value, for a random positive
+// definite P of nb banded and nd dense coordinates
+// [[Rcpp::export]]
+arma::vec laplaceGaussianEvidence(const unsigned int nb = 30,
+                                  const unsigned int nd = 3,
+                                  const unsigned int bandwidth = 2,
+                                  const int seed = 2024) {
+    RandomStream rng(seed, 0);
+    const unsigned int d = nb + nd;
+    mat precision(d, d, fill::zeros);
+    for (unsigned int j = 0; j < d; j++) {
+        for (unsigned int i = j + 1; i < d; i++) {
+            if (i - j <= bandwidth || i >= nb) {
+                precision(i, j) = precision(j, i) = 0.3 * rng.normal();
+            }
+        }
+    }
+    // diagonally dominant, so positive definite
+    precision.diag() = sum(abs(precision), 1) + 1 + rng.uniform(d);
+    const vec & centre = rng.normal(d);
+    auto gradient = [&](const vec & z) -> vec { return precision * (z - centre); };
+
+    const ArrowheadCholesky factor(finiteDifferenceHessian(gradient, centre, ones(d), nb, bandwidth));
+    const double laplace = 0.5 * d * std::log(2 * datum::pi) - 0.5 * factor.logDeterminant();
+    const double exact = 0.5 * d * std::log(2 * datum::pi) - accu(log(chol(precision).diag()));
+    return {laplace, exact};
+}
+
 // [[Rcpp::export]]
 arma::cube paralleltemperingTest1() {
     std::ofstream out("testout.txt");
@@ -92,8 +236,8 @@ arma::cube paralleltemperingTest1() {
 
     function<lp(vec)> lpnormal = [](vec x) {return lp(-arma::sum(arma::square(x))/2.0);};
     vec temperature = arma::linspace<vec>(8, 1, 8);
-    std::function<mcmcstate(function<lp(vec)>, mcmcstate)> metropolis_tuned =
-            std::bind(metropolis, std::placeholders::_1, std::placeholders::_2, 1.0);
+    std::function<mcmcstate(function<lp(vec)>, mcmcstate, RandomStream &)> metropolis_tuned =
+            std::bind(metropolis, std::placeholders::_1, std::placeholders::_2, 1.0, std::placeholders::_3);
 
     cube samples = parallel_termperingC(lpnormal,
                                         metropolis_tuned,
@@ -112,8 +256,8 @@ arma::cube paralleltemperingTest2() {
         return lp(log(exp(-arma::sum(arma::square(x+4))/2.0) + exp(-arma::sum(arma::square(x-4))/2.0)));
     };
     vec temperature = {1, 1.3, 1.8, 2.5, 3.8, 5.7, 8};
-    function<mcmcstate(function<lp(vec)>, mcmcstate)> metropolis_tuned =
-            std::bind(metropolis, std::placeholders::_1, std::placeholders::_2, 1.0);
+    function<mcmcstate(function<lp(vec)>, mcmcstate, RandomStream &)> metropolis_tuned =
+            std::bind(metropolis, std::placeholders::_1, std::placeholders::_2, 1.0, std::placeholders::_3);
 
     cube samples = parallel_termperingC(lpnormalvalue,
                                         metropolis_tuned,
@@ -713,3 +857,24 @@ lp phisigllikHard2D( const vec & phisig,
 
     return ret;
 }
+
+// the mean of nDraws windowed gradient estimates of xthetasigmallik with the band likelihood at the
+// start of sampling of a simulatedProblem, the exact gradient and the standard error of the mean,
+// as three columns
+// [[Rcpp::export]]
+arma::mat windowedGradientCheck(const std::string modelName = "FN", const unsigned int window = 10,
+                                const unsigned int nDraws = 2000, const int seed = 2024) {
+    const SimulatedProblem & problem = simulatedProblem(modelName, seed);
+    const std::shared_ptr<MagiSolver> & solver = initialisedSolver(problem, 1, 1, seed);
+    const vec & at = join_vert(join_vert(vectorise(solver->xInit), vec(solver->thetaInit)), solver->sigmaInit);
+    const WindowedGradient windowed(problem.yobs, solver->covAllDimensions, problem.model, solver->priorTemperature,
+                                    solver->sigmaSize, solver->useMean, window);
+    RandomStream rng(seed, 1);
+    mat draws(at.size(), nDraws);
+    double share;
+    for (unsigned int i = 0; i < nDraws; i++) {
+        draws.col(i) = windowed.estimate(at, rng, share);
+    }
+    const vec & exact = solver->xthetasigmaLlik(at, solver->priorTemperature).gradient;
+    return join_horiz(join_horiz(mean(draws, 1), exact), stddev(draws, 0, 1) / std::sqrt(nDraws));
+}
@@ -0,0 +1,24 @@
+#ifndef TESTINGUTILITIES_H
+#define TESTINGUTILITIES_H
+
+#include <string>
+#include "classDefinition.h"
+
+// gradient evaluations per bulk ESS of theta for each integrator of basic_hmcC, one row each for
+// leapfrog, twostage and threestage, on data simulated from the builtin "FN" or "Hes1" model
+arma::mat integratorBenchmark(const std::string modelName, const unsigned int niterHmc,
+                              const int nstepsHmc, const int seed);
+
+// Laplace and exact log normalising constant of a random Gaussian with a banded precision block
+arma::vec laplaceGaussianEvidence(const unsigned int nb, const unsigned int nd,
+                                  const unsigned int bandwidth, const int seed);
+
+// Hessian-vector product of the MAGI log posterior and the central difference of its gradient
+arma::mat hessianVectorCheck(const std::string modelName, const int seed);
+
+// mean of windowed gradient estimates of the MAGI log posterior, its exact gradient and the
+// standard error of the mean
+arma::mat windowedGradientCheck(const std::string modelName, const unsigned int window,
+                                const unsigned int nDraws, const int seed);
+
+#endif //TESTINGUTILITIES_H
@@ -2,6 +2,7 @@
 // Created by Shihao Yang on 5/30/19.
 //
 #include "../hmc.h"
+#include "../nuts.h"
 #include "../band.h"
 #include "../paralleltempering.h"
 #include "../tgtdistr.h"
@@ -19,6 +20,11 @@ int main(){
                                {-arma::datum::inf},
                                {arma::datum::inf},
                                nsteps, traj);
+    RandomStream rng(2019, 0);
+    hmcstate postNuts = nuts_hmcC(lpnormal, initial, step,
+                                  {-arma::datum::inf},
+                                  {arma::datum::inf},
+                                  rng, 5);
     // for(int i; i < post.final.size(); i++)`
     //   std::cout << post.final(i) << endl;
     // std::cout << post.final << endl;
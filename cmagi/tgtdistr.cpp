@@ -632,22 +632,7 @@ lp xthetallikWithmuBand( const vec & xtheta,
     dotmuAllDimension.col(i) = CovAllDimensions[i].dotmu;
   }
 
-  OdeSystem fOdeModelShifted = fOdeModel;
-  
-  fOdeModelShifted.fOde = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-  (const vec & theta, const mat & x, const vec & tvec) -> mat{
-    return fOdeModel.fOde(theta, x+muAllDimension, tvec) - dotmuAllDimension;
-  };
-  
-  fOdeModelShifted.fOdeDx = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-  (const vec & theta, const mat & x, const vec & tvec) -> cube{
-    return fOdeModel.fOdeDx(theta, x+muAllDimension, tvec);
-  };
-  
-  fOdeModelShifted.fOdeDtheta = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-  (const vec & theta, const mat & x, const vec & tvec) -> cube{
-    return fOdeModel.fOdeDtheta(theta, x+muAllDimension, tvec);
-  };
+  const OdeSystem & fOdeModelShifted = fOdeModel.shifted(muAllDimension, dotmuAllDimension);
   
   lp ret = xthetallik(xthetaShifted, CovAllDimensions, sigma, yobsShifted, 
                       fOdeModelShifted, useBand, priorTemperature); 
@@ -0,0 +1,83 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned int nthreads) : stopping(false) {
+    if (nthreads == 0) {
+        nthreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    pinnedQueues.resize(nthreads);
+    for (unsigned int i = 0; i < nthreads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::workerLoop(const unsigned int workerId) {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this, workerId] {
+                return stopping || !pinnedQueues[workerId].empty() || !sharedQueue.empty();
+            });
+            // pinned work first, so a pinned task never waits behind shared ones
+            if (!pinnedQueues[workerId].empty()) {
+                task = std::move(pinnedQueues[workerId].front());
+                pinnedQueues[workerId].pop_front();
+            } else if (!sharedQueue.empty()) {
+                task = std::move(sharedQueue.front());
+                sharedQueue.pop_front();
+            } else {
+                return;
+            }
+        }
+        task();
+    }
+}
+
+std::future<void> ThreadPool::enqueue(std::function<void()> task, const int workerId) {
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> result = packaged->get_future();
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (stopping) {
+            throw std::runtime_error("submit on a stopped ThreadPool");
+        }
+        if (workerId < 0) {
+            sharedQueue.emplace_back([packaged] { (*packaged)(); });
+        } else {
+            pinnedQueues[workerId].emplace_back([packaged] { (*packaged)(); });
+        }
+    }
+    if (workerId < 0) {
+        queueCondition.notify_one();
+    } else {
+        // the condition is shared, wake everyone so the pinned worker sees its task
+        queueCondition.notify_all();
+    }
+    return result;
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    return enqueue(std::move(task), -1);
+}
+
+std::future<void> ThreadPool::submitTo(const unsigned int workerId, std::function<void()> task) {
+    if (workerId >= workers.size()) {
+        throw std::runtime_error("submitTo workerId out of range");
+    }
+    return enqueue(std::move(task), workerId);
+}
@@ -0,0 +1,35 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed size pool of worker threads that live as long as the pool.
+// Tasks go to a shared queue, or to one worker's own queue when pinned.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> sharedQueue;
+    std::vector<std::deque<std::function<void()>>> pinnedQueues;
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    bool stopping;
+
+    void workerLoop(unsigned int workerId);
+    std::future<void> enqueue(std::function<void()> task, int workerId);
+public:
+    explicit ThreadPool(unsigned int nthreads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    unsigned int size() const;
+    std::future<void> submit(std::function<void()> task);
+    std::future<void> submitTo(unsigned int workerId, std::function<void()> task);
+};
+
+#endif //THREADPOOL_H
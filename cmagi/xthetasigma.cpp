@@ -36,22 +36,7 @@ lp xthetasigmallik( const mat & xlatent,
       dotmuAllDimension.col(i) = CovAllDimensions[i].dotmu;
     }
     
-    OdeSystem fOdeModelShifted = fOdeModel;
-
-    fOdeModelShifted.fOde = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> mat{
-      return fOdeModel.fOde(theta, x+muAllDimension, tvec) - dotmuAllDimension;
-    };
-    
-    fOdeModelShifted.fOdeDx = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> cube{
-      return fOdeModel.fOdeDx(theta, x+muAllDimension, tvec);
-    };
-    
-    fOdeModelShifted.fOdeDtheta = [&muAllDimension, &dotmuAllDimension, &fOdeModel]
-    (const vec & theta, const mat & x, const vec & tvec) -> cube{
-      return fOdeModel.fOdeDtheta(theta, x+muAllDimension, tvec);
-    };
+    const OdeSystem & fOdeModelShifted = fOdeModel.shifted(muAllDimension, dotmuAllDimension);
 
     return xthetasigmallik(xlatentShifted, theta, sigmaInput, yobsShifted, CovAllDimensions, 
                            fOdeModelShifted, priorTemperatureInput, useBand, false); 
@@ -193,3 +178,192 @@ lp xthetasigmallik( const mat & xlatent,
   
   return ret;
 }
+
+//' Hessian of xthetasigmallik times direction, both in the layout of its gradient [x, theta, sigma].
+//' Exact through the GP operators and the first derivatives of fOde; the second derivatives of
+//' fOde, which OdeSystem does not provide, are a central difference of fOdeDx and fOdeDtheta
+//' along the direction.
+vec xthetasigmallikHessianVector( const mat & xlatent,
+                                  const vec & theta,
+                                  const vec & sigmaInput,
+                                  const mat & yobs,
+                                  const std::vector<gpcov> & CovAllDimensions,
+                                  const OdeSystem & fOdeModel,
+                                  const vec & direction,
+                                  const arma::vec & priorTemperatureInput,
+                                  const bool useBand,
+                                  const bool useMean) {
+
+  const arma::vec & tvecFull = CovAllDimensions[0].tvecCovInput;
+  if(useMean){
+    mat xlatentShifted = xlatent;
+    mat yobsShifted = yobs;
+    mat muAllDimension(yobs.n_rows, yobs.n_cols);
+    mat dotmuAllDimension(yobs.n_rows, yobs.n_cols);
+
+    for(unsigned int i = 0; i < yobs.n_cols; i++){
+      xlatentShifted.col(i) -= CovAllDimensions[i].mu;
+      yobsShifted.col(i) -= CovAllDimensions[i].mu;
+      muAllDimension.col(i) = CovAllDimensions[i].mu;
+      dotmuAllDimension.col(i) = CovAllDimensions[i].dotmu;
+    }
+
+    const OdeSystem & fOdeModelShifted = fOdeModel.shifted(muAllDimension, dotmuAllDimension);
+
+    return xthetasigmallikHessianVector(xlatentShifted, theta, sigmaInput, yobsShifted, CovAllDimensions,
+                                        fOdeModelShifted, direction, priorTemperatureInput, useBand, false);
+  }
+
+  int n = yobs.n_rows;
+  int pdimension = yobs.n_cols;
+
+  lp bound;
+  if (fOdeModel.checkBound(xlatent, theta, &bound)) {
+    return zeros(direction.size());
+  }
+
+  arma::vec priorTemperature(3);
+  if(priorTemperatureInput.n_rows == 1){
+    priorTemperature.fill(as_scalar(priorTemperatureInput));
+  }else if(priorTemperatureInput.n_rows == 2){
+    priorTemperature.subvec(0, 1) = priorTemperatureInput;
+    priorTemperature(2) = 1.0;
+  }else if(priorTemperatureInput.n_rows == 3){
+    priorTemperature = priorTemperatureInput;
+  }else{
+    throw std::invalid_argument("priorTemperatureInput must be scaler, 2-vector or 3-vector");
+  }
+
+  vec sigma(yobs.n_cols);
+  bool sigmaIsScaler = (sigmaInput.size() == 1);
+  if (sigmaIsScaler){
+    sigma.fill(as_scalar(sigmaInput));
+  }else if(sigmaInput.size() == yobs.n_cols){
+    sigma = sigmaInput;
+  }else{
+    throw std::runtime_error("sigmaInput dimension not right");
+  }
+  vec sigmaSq = square(sigma);
+  if(direction.size() != yobs.size() + theta.size() + sigmaInput.size()){
+    throw std::runtime_error("direction dimension not right");
+  }
+
+  const mat & vx = reshape(direction.subvec(0, n*pdimension-1), n, pdimension);
+  const vec & vtheta = direction.subvec(n*pdimension, n*pdimension+theta.size()-1);
+  const vec & vsigma = direction.subvec(n*pdimension+theta.size(), direction.size()-1);
+
+  const mat & fderiv = fOdeModel.fOde(theta, xlatent, tvecFull);
+  const cube & fderivDx = fOdeModel.fOdeDx(theta, xlatent, tvecFull);
+  const cube & fderivDtheta = fOdeModel.fOdeDtheta(theta, xlatent, tvecFull);
+
+  // derivatives of the Jacobians along the direction
+  cube fderivDxDot(size(fderivDx), fill::zeros);
+  cube fderivDthetaDot(size(fderivDtheta), fill::zeros);
+  const double directionSize = std::max(abs(vx).max(), theta.empty() ? 0.0 : abs(vtheta).max());
+  if(directionSize > 0){
+    const double scale = std::max(1.0, std::max(abs(xlatent).max(), theta.empty() ? 0.0 : abs(theta).max()));
+    const double h = std::cbrt(datum::eps) * scale / directionSize;
+    fderivDxDot = (fOdeModel.fOdeDx(theta + h*vtheta, xlatent + h*vx, tvecFull) -
+                   fOdeModel.fOdeDx(theta - h*vtheta, xlatent - h*vx, tvecFull)) / (2*h);
+    fderivDthetaDot = (fOdeModel.fOdeDtheta(theta + h*vtheta, xlatent + h*vx, tvecFull) -
+                       fOdeModel.fOdeDtheta(theta - h*vtheta, xlatent - h*vx, tvecFull)) / (2*h);
+  }
+
+  // derivative residual, its change along the direction, and both through Kinv
+  mat fitDerivError(n, pdimension);
+  mat fitDerivErrorDot(n, pdimension);
+  mat KinvfitDerivError(n, pdimension);
+  mat KinvfitDerivErrorDot(n, pdimension);
+  for( int vEachDim = 0; vEachDim < pdimension; vEachDim++){
+    vec mphiX(n), mphiV(n);
+    if(useBand){
+      bmatvecmult(CovAllDimensions[vEachDim].mphiBand.memptr(), xlatent.colptr(vEachDim),
+                  &(CovAllDimensions[vEachDim].bandsize), &n, mphiX.memptr());
+      bmatvecmult(CovAllDimensions[vEachDim].mphiBand.memptr(), vx.colptr(vEachDim),
+                  &(CovAllDimensions[vEachDim].bandsize), &n, mphiV.memptr());
+    }else{
+      mphiX = CovAllDimensions[vEachDim].mphi * xlatent.col(vEachDim);
+      mphiV = CovAllDimensions[vEachDim].mphi * vx.col(vEachDim);
+    }
+    fitDerivError.col(vEachDim) = fderiv.col(vEachDim) - mphiX;
+    fitDerivErrorDot.col(vEachDim) = sum(fderivDx.slice(vEachDim) % vx, 1) - mphiV;
+    if(theta.size() > 0){
+      fitDerivErrorDot.col(vEachDim) += fderivDtheta.slice(vEachDim) * vtheta;
+    }
+    if(useBand){
+      bmatvecmult(CovAllDimensions[vEachDim].KinvBand.memptr(), fitDerivError.colptr(vEachDim),
+                  &(CovAllDimensions[vEachDim].bandsize), &n, KinvfitDerivError.colptr(vEachDim));
+      bmatvecmult(CovAllDimensions[vEachDim].KinvBand.memptr(), fitDerivErrorDot.colptr(vEachDim),
+                  &(CovAllDimensions[vEachDim].bandsize), &n, KinvfitDerivErrorDot.colptr(vEachDim));
+    }else{
+      KinvfitDerivError.col(vEachDim) = CovAllDimensions[vEachDim].Kinv * fitDerivError.col(vEachDim);
+      KinvfitDerivErrorDot.col(vEachDim) = CovAllDimensions[vEachDim].Kinv * fitDerivErrorDot.col(vEachDim);
+    }
+  }
+
+  // derivative term: -(J' Kinv J v + Jdot' Kinv r) / priorTemperature(0)
+  mat hvx(n, pdimension, fill::zeros);
+  vec hvtheta(theta.size(), fill::zeros);
+  for( int vEachDim = 0; vEachDim < pdimension; vEachDim++){
+    vec mphiTu(n);
+    if(useBand){
+      bmatvecmultT(CovAllDimensions[vEachDim].mphiBand.memptr(), KinvfitDerivErrorDot.colptr(vEachDim),
+                   &(CovAllDimensions[vEachDim].bandsize), &n, mphiTu.memptr());
+    }else{
+      mphiTu = CovAllDimensions[vEachDim].mphi.t() * KinvfitDerivErrorDot.col(vEachDim);
+    }
+    hvx.col(vEachDim) += mphiTu;
+    hvx -= fderivDx.slice(vEachDim).each_col() % KinvfitDerivErrorDot.col(vEachDim);
+    hvx -= fderivDxDot.slice(vEachDim).each_col() % KinvfitDerivError.col(vEachDim);
+    if(theta.size() > 0){
+      hvtheta -= fderivDtheta.slice(vEachDim).t() * KinvfitDerivErrorDot.col(vEachDim);
+      hvtheta -= fderivDthetaDot.slice(vEachDim).t() * KinvfitDerivError.col(vEachDim);
+    }
+  }
+  hvx /= priorTemperature(0);
+  hvtheta /= priorTemperature(0);
+
+  // GP level term
+  for( int vEachDim = 0; vEachDim < pdimension; vEachDim++){
+    vec CinvV(n);
+    if(useBand){
+      bmatvecmult(CovAllDimensions[vEachDim].CinvBand.memptr(), vx.colptr(vEachDim),
+                  &(CovAllDimensions[vEachDim].bandsize), &n, CinvV.memptr());
+    }else{
+      CinvV = CovAllDimensions[vEachDim].Cinv * vx.col(vEachDim);
+    }
+    hvx.col(vEachDim) -= CinvV / priorTemperature(1);
+  }
+
+  // observation term
+  mat fitLevelError = xlatent - yobs;
+  mat observed(n, pdimension, fill::ones);
+  observed(find_nonfinite(fitLevelError)).fill(0.0);
+  fitLevelError(find_nonfinite(fitLevelError)).fill(0.0);
+  const vec & nobs = sum(observed).t();
+  const vec & sumSqError = sum(square(fitLevelError)).t();
+  vec vsigmaAll(pdimension);
+  if(sigmaIsScaler){
+    vsigmaAll.fill(as_scalar(vsigma));
+  }else{
+    vsigmaAll = vsigma;
+  }
+  for( int vEachDim = 0; vEachDim < pdimension; vEachDim++){
+    hvx.col(vEachDim) += (2 * fitLevelError.col(vEachDim) / (sigmaSq(vEachDim) * sigma(vEachDim)) * vsigmaAll(vEachDim)
+                          - observed.col(vEachDim) % vx.col(vEachDim) / sigmaSq(vEachDim)) / priorTemperature(2);
+  }
+  const vec & hvsigmaAll = (2 * sum(fitLevelError % vx).t() / (sigmaSq % sigma)
+                            + (nobs / sigmaSq - 3 * sumSqError / square(sigmaSq)) % vsigmaAll) / priorTemperature(2);
+
+  vec ret(direction.size());
+  ret.subvec(0, n*pdimension-1) = vectorise(hvx);
+  if(theta.size() > 0){
+    ret.subvec(n*pdimension, n*pdimension+theta.size()-1) = hvtheta;
+  }
+  if(sigmaIsScaler){
+    ret(ret.size() - 1) = sum(hvsigmaAll);
+  }else{
+    ret.subvec(ret.size() - sigma.size(), ret.size() - 1) = hvsigmaAll;
+  }
+  return ret;
+}
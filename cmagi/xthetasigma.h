@@ -20,6 +20,18 @@ lp xthetasigmallik( const arma::mat & xlatent,
                     const bool useBand = false,
                     const bool useMean = false);
 
+//' Hessian of xthetasigmallik times direction, in the layout of its gradient [x, theta, sigma]
+arma::vec xthetasigmallikHessianVector( const arma::mat & xlatent,
+                                        const arma::vec & theta,
+                                        const arma::vec & sigmaInput,
+                                        const arma::mat & yobs,
+                                        const std::vector<gpcov> & CovAllDimensions,
+                                        const OdeSystem & fOdeModel,
+                                        const arma::vec & direction,
+                                        const arma::vec & priorTemperatureInput = arma::ones(1),
+                                        const bool useBand = false,
+                                        const bool useMean = false);
+
 #define DYNAMIC_SYSTEMS_XTHETASIGMA_H
 
 #endif //DYNAMIC_SYSTEMS_XTHETASIGMA_H
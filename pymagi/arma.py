@@ -158,7 +158,41 @@ def solve_magi(
         useFixedSigma = False,
         skipMissingComponentOptimization = False,
         positiveSystem = False,
-        verbose = True):
+        verbose = True,
+        samplerMethod = "hmc",
+        maxTreeDepth = 10,
+        adaptMethod = "legacy",
+        metric = "diag",
+        targetAcceptRate = 0.8,
+        nChains = 1,
+        seed = -1,
+        thin = 1,
+        sampleFile = "",
+        recordLlik = True,
+        recordX = True,
+        recordXComponents = np.array([]),
+        recordXTimes = np.array([]),
+        recordTheta = True,
+        recordSigma = True,
+        singlePrecision = False,
+        continueEpochs = False,
+        epochBurninRatio = 0.1,
+        checkpointFile = "",
+        checkpointEvery = 0,
+        temperatures = np.array([]),
+        adaptTemperatures = False,
+        optimizerMethod = "lbfgsb",
+        transformBounds = False,
+        integrator = "leapfrog",
+        lengthAdaptation = "fixed",
+        blocking = "joint",
+        sgWindow = 100,
+        sgFriction = 0.1,
+        maxSeconds = 0,
+        targetEss = 0,
+        targetRhat = 0,
+        stopCheckEvery = 100,
+        smcMoves = 5):
 
     sigmaExogenous = ArmaVector(np.ndarray(0)) if sigmaExogenous.size == 0 else ArmaVector(sigmaExogenous)
     phiExogenous = ArmaMatrix(np.ndarray([0, 0])) if phiExogenous.size == 0 else ArmaMatrix(phiExogenous).t()
@@ -167,6 +201,9 @@ def solve_magi(
     muExogenous = ArmaMatrix(np.ndarray([0, 0])) if muExogenous.size == 0 else ArmaMatrix(muExogenous).t()
     dotmuExogenous=ArmaMatrix(np.ndarray([0, 0])) if dotmuExogenous.size == 0 else ArmaMatrix(dotmuExogenous).t()
     stepSizeFactorHmc = ArmaVector(np.ndarray(0)) if isinstance(stepSizeFactorHmc, float) or stepSizeFactorHmc.size == 0 else ArmaVector(stepSizeFactorHmc)
+    recordXComponents = ArmaVector(np.asarray(recordXComponents, dtype=float).reshape([-1]))
+    recordXTimes = ArmaVector(np.asarray(recordXTimes, dtype=float).reshape([-1]))
+    temperatures = ArmaVector(np.asarray(temperatures, dtype=float).reshape([-1]))
     result_solved = solveMagiPy(
         yFull=ArmaMatrix(yFull).t(),
         odeModel=odeModel,
@@ -194,12 +231,70 @@ def solve_magi(
         useFixedSigma=useFixedSigma,
         skipMissingComponentOptimization=skipMissingComponentOptimization,
         positiveSystem=positiveSystem,
-        verbose=verbose)
+        verbose=verbose,
+        samplerMethod=samplerMethod,
+        maxTreeDepth=maxTreeDepth,
+        adaptMethod=adaptMethod,
+        metric=metric,
+        targetAcceptRate=targetAcceptRate,
+        nChains=nChains,
+        seed=seed,
+        thin=thin,
+        sampleFile=sampleFile,
+        recordLlik=recordLlik,
+        recordX=recordX,
+        recordXComponents=recordXComponents,
+        recordXTimes=recordXTimes,
+        recordTheta=recordTheta,
+        recordSigma=recordSigma,
+        singlePrecision=singlePrecision,
+        continueEpochs=continueEpochs,
+        epochBurninRatio=epochBurninRatio,
+        checkpointFile=checkpointFile,
+        checkpointEvery=checkpointEvery,
+        temperatures=temperatures,
+        adaptTemperatures=adaptTemperatures,
+        optimizerMethod=optimizerMethod,
+        transformBounds=transformBounds,
+        integrator=integrator,
+        lengthAdaptation=lengthAdaptation,
+        blocking=blocking,
+        sgWindow=sgWindow,
+        sgFriction=sgFriction,
+        maxSeconds=maxSeconds,
+        targetEss=targetEss,
+        targetRhat=targetRhat,
+        stopCheckEvery=stopCheckEvery,
+        smcMoves=smcMoves)
 
     phiUsed = matrix(result_solved.phiAllDimensions)
     phiUsed = np.copy(phiUsed.reshape([-1])).reshape([2, -1])
-    samplesCpp = matrix(result_solved.llikxthetasigmaSamples.slice(0))
-    return dict(phiUsed=phiUsed, samplesCpp=samplesCpp)
+    recordedRows = np.array(result_solved.recordedRows, dtype=int)
+    if sampleFile == "":
+        if singlePrecision:
+            samplesCpp = result_solved.llikxthetasigmaSamplesFloat[:, :, 0]
+        else:
+            samplesCpp = matrix(result_solved.llikxthetasigmaSamples.slice(0))
+    else:
+        # draws were streamed to the file, laid out like llikxthetasigmaSamples
+        ncol = (1 if samplerMethod == "map" else (niterHmc + thin - 1) // thin) * nChains
+        samplesCpp = np.memmap(sampleFile, dtype=np.float32 if singlePrecision else np.float64, mode='r',
+                               shape=(recordedRows.size, ncol, nEpoch), order='F')[:, :, 0]
+    return dict(phiUsed=phiUsed, samplesCpp=samplesCpp, recordedRows=recordedRows,
+                thetaRhat=matrix(result_solved.thetaRhat),
+                thetaBulkEss=matrix(result_solved.thetaBulkEss),
+                thetaTailEss=matrix(result_solved.thetaTailEss),
+                xthetasigmaMean=vector(result_solved.xthetasigmaMean),
+                xthetasigmaSd=vector(result_solved.xthetasigmaSd),
+                xthetasigmaQuantiles=matrix(result_solved.xthetasigmaQuantiles),
+                thetaOnlineEss=vector(result_solved.thetaOnlineEss),
+                swapAcceptRate=matrix(result_solved.swapAcceptRate) if result_solved.swapAcceptRate.n_rows > 0
+                else np.zeros([0, nEpoch]),
+                roundTripRate=vector(result_solved.roundTripRate),
+                logEvidence=vector(result_solved.logEvidence),
+                epochIterations=np.array(result_solved.epochIterations, dtype=int),
+                stopReason=result_solved.stopReason,
+                temperatureLadder=np.array(result_solved.temperatureLadder))
 
 def summaryMagiOutput(x, par_names, est = 'mean', sigma = False, lower = 0.025, upper = 0.975):
     
@@ -95,6 +95,176 @@ def MagiSolver(y, odeModel, tvec=None, control=dict()):
     else:
         verbose = False
 
+    if 'samplerMethod' in control.keys():
+        samplerMethod = control['samplerMethod']
+    else:
+        samplerMethod = 'hmc'
+
+    if 'maxTreeDepth' in control.keys():
+        maxTreeDepth = control['maxTreeDepth']
+    else:
+        maxTreeDepth = 10
+
+    if 'adaptMethod' in control.keys():
+        adaptMethod = control['adaptMethod']
+    else:
+        adaptMethod = 'legacy'
+
+    if 'metric' in control.keys():
+        metric = control['metric']
+    else:
+        metric = 'diag'
+
+    if 'targetAcceptRate' in control.keys():
+        targetAcceptRate = control['targetAcceptRate']
+    else:
+        targetAcceptRate = 0.8
+
+    if 'nChains' in control.keys():
+        nChains = control['nChains']
+    else:
+        nChains = 1
+
+    if 'seed' in control.keys():
+        seed = control['seed']
+    else:
+        seed = -1
+
+    if 'thin' in control.keys():
+        thin = control['thin']
+    else:
+        thin = 1
+
+    if 'sampleFile' in control.keys():
+        sampleFile = control['sampleFile']
+    else:
+        sampleFile = ''
+
+    if 'recordLlik' in control.keys():
+        recordLlik = control['recordLlik']
+    else:
+        recordLlik = True
+
+    if 'recordX' in control.keys():
+        recordX = control['recordX']
+    else:
+        recordX = True
+
+    if 'recordXComponents' in control.keys():
+        recordXComponents = control['recordXComponents']
+    else:
+        recordXComponents = np.array([])
+
+    if 'recordXTimes' in control.keys():
+        recordXTimes = control['recordXTimes']
+    else:
+        recordXTimes = np.array([])
+
+    if 'recordTheta' in control.keys():
+        recordTheta = control['recordTheta']
+    else:
+        recordTheta = True
+
+    if 'recordSigma' in control.keys():
+        recordSigma = control['recordSigma']
+    else:
+        recordSigma = True
+
+    if 'singlePrecision' in control.keys():
+        singlePrecision = control['singlePrecision']
+    else:
+        singlePrecision = False
+
+    if 'continueEpochs' in control.keys():
+        continueEpochs = control['continueEpochs']
+    else:
+        continueEpochs = False
+
+    if 'epochBurninRatio' in control.keys():
+        epochBurninRatio = control['epochBurninRatio']
+    else:
+        epochBurninRatio = 0.1
+
+    if 'checkpointFile' in control.keys():
+        checkpointFile = control['checkpointFile']
+    else:
+        checkpointFile = ''
+
+    if 'checkpointEvery' in control.keys():
+        checkpointEvery = control['checkpointEvery']
+    else:
+        checkpointEvery = 0
+
+    if 'temperatures' in control.keys():
+        temperatures = control['temperatures']
+    else:
+        temperatures = np.array([])
+
+    if 'adaptTemperatures' in control.keys():
+        adaptTemperatures = control['adaptTemperatures']
+    else:
+        adaptTemperatures = False
+
+    if 'optimizerMethod' in control.keys():
+        optimizerMethod = control['optimizerMethod']
+    else:
+        optimizerMethod = 'lbfgsb'
+
+    if 'transformBounds' in control.keys():
+        transformBounds = control['transformBounds']
+    else:
+        transformBounds = False
+
+    if 'integrator' in control.keys():
+        integrator = control['integrator']
+    else:
+        integrator = 'leapfrog'
+
+    if 'lengthAdaptation' in control.keys():
+        lengthAdaptation = control['lengthAdaptation']
+    else:
+        lengthAdaptation = 'fixed'
+
+    if 'blocking' in control.keys():
+        blocking = control['blocking']
+    else:
+        blocking = 'joint'
+
+    if 'sgWindow' in control.keys():
+        sgWindow = control['sgWindow']
+    else:
+        sgWindow = 100
+
+    if 'sgFriction' in control.keys():
+        sgFriction = control['sgFriction']
+    else:
+        sgFriction = 0.1
+
+    if 'maxSeconds' in control.keys():
+        maxSeconds = control['maxSeconds']
+    else:
+        maxSeconds = 0
+
+    if 'targetEss' in control.keys():
+        targetEss = control['targetEss']
+    else:
+        targetEss = 0
+
+    if 'targetRhat' in control.keys():
+        targetRhat = control['targetRhat']
+    else:
+        targetRhat = 0
+
+    if 'stopCheckEvery' in control.keys():
+        stopCheckEvery = control['stopCheckEvery']
+    else:
+        stopCheckEvery = 100
+
+    if 'smcMoves' in control.keys():
+        smcMoves = control['smcMoves']
+    else:
+        smcMoves = 5
+
 
     result = solve_magi(
         y,
@@ -123,7 +293,41 @@ def MagiSolver(y, odeModel, tvec=None, control=dict()):
         useFixedSigma = useFixedSigma,
         skipMissingComponentOptimization = skipMissingComponentOptimization,
         positiveSystem = positiveSystem,
-        verbose = verbose)
+        verbose = verbose,
+        samplerMethod = samplerMethod,
+        maxTreeDepth = maxTreeDepth,
+        adaptMethod = adaptMethod,
+        metric = metric,
+        targetAcceptRate = targetAcceptRate,
+        nChains = nChains,
+        seed = seed,
+        thin = thin,
+        sampleFile = sampleFile,
+        recordLlik = recordLlik,
+        recordX = recordX,
+        recordXComponents = recordXComponents,
+        recordXTimes = recordXTimes,
+        recordTheta = recordTheta,
+        recordSigma = recordSigma,
+        singlePrecision = singlePrecision,
+        continueEpochs = continueEpochs,
+        epochBurninRatio = epochBurninRatio,
+        checkpointFile = checkpointFile,
+        checkpointEvery = checkpointEvery,
+        temperatures = temperatures,
+        adaptTemperatures = adaptTemperatures,
+        optimizerMethod = optimizerMethod,
+        transformBounds = transformBounds,
+        integrator = integrator,
+        lengthAdaptation = lengthAdaptation,
+        blocking = blocking,
+        sgWindow = sgWindow,
+        sgFriction = sgFriction,
+        maxSeconds = maxSeconds,
+        targetEss = targetEss,
+        targetRhat = targetRhat,
+        stopCheckEvery = stopCheckEvery,
+        smcMoves = smcMoves)
 
     phiUsed = result['phiUsed']
     samplesCpp = result['samplesCpp']
@@ -133,17 +337,50 @@ def MagiSolver(y, odeModel, tvec=None, control=dict()):
     thetaId = range(np.max(xId) + 1, np.max(xId) + odeModel.thetaSize + 1)
     sigmaId = range(np.max(thetaId) + 1, np.max(thetaId) + y.shape[1] + 1)
 
-    burnin = int(niterHmc*burninRatio)
-    xsampled = samplesCpp[xId, burnin:]
-    xsampled = xsampled.reshape([y.shape[1], y.shape[0], -1])
+    # chains are stored one after another, each thinned, drop the burn-in of each;
+    # smc fills the block with equally weighted particles, laplace with independent draws
+    # and map with one optimum per chain
+    niterStored = 1 if samplerMethod == 'map' else (niterHmc + thin - 1) // thin
+    burnin = 0 if samplerMethod in ('smc', 'laplace', 'map') else (int(niterHmc*burninRatio) + thin - 1) // thin
+    keptId = np.concatenate([np.arange(c*niterStored + burnin, (c+1)*niterStored) for c in range(nChains)])
+    samplesCpp = samplesCpp[:, keptId]
+    # a stopping rule leaves the draws it did not take as nan
+    samplesCpp = samplesCpp[:, ~np.all(np.isnan(samplesCpp), axis=0)]
+
+    # only the recorded rows of [lp, x, theta, sigma] are stored, blocks left out are None
+    rowOf = {r: i for i, r in enumerate(result['recordedRows'])}
+    def recordedRows(ids):
+        kept = [rowOf[i] for i in ids if i in rowOf]
+        return samplesCpp[kept, :] if len(kept) > 0 else None
 
-    thetaSampled = samplesCpp[thetaId, burnin:]
+    xsampled = recordedRows(xId)
+    if xsampled is not None and xsampled.shape[0] == y.size:
+        xsampled = xsampled.reshape([y.shape[1], y.shape[0], -1])
+    lp = recordedRows([llikId])
 
     return dict(
-        theta=thetaSampled,
+        theta=recordedRows(thetaId),
         xsampled=xsampled,
-        lp=samplesCpp[llikId, burnin:],
-        sigma=samplesCpp[sigmaId, burnin:],
+        lp=lp[0, :] if lp is not None else None,
+        sigma=recordedRows(sigmaId),
+        rhat=result['thetaRhat'][:, -1],
+        bulkEss=result['thetaBulkEss'][:, -1],
+        tailEss=result['thetaTailEss'][:, -1],
+        # iterations each epoch ran and the stopping rule that ended the last one, if any
+        epochIterations=result['epochIterations'],
+        stopReason=result['stopReason'],
+        # summaries of the last epoch accumulated while sampling, rows follow [x, theta, sigma]
+        postMean=result['xthetasigmaMean'],
+        postSd=result['xthetasigmaSd'],
+        postQuantiles=result['xthetasigmaQuantiles'],
+        onlineEss=result['thetaOnlineEss'],
+        # swap acceptance between neighbouring temperatures per epoch, empty without tempering
+        swapAcceptRate=result['swapAcceptRate'],
+        # final, possibly adapted, temperatures and round trips per iteration of each epoch
+        temperatureLadder=result['temperatureLadder'],
+        roundTripRate=result['roundTripRate'],
+        # log normalising constant of the posterior per epoch, nan unless samplerMethod is 'smc' or 'laplace'
+        logEvidence=result['logEvidence'],
         phi=phiUsed,
         y = y,
         tvec = tvec,
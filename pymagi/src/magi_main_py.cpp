@@ -30,7 +30,41 @@ MagiSolver solveMagiPy(const arma::mat & yFull,
                       bool useFixedSigma ,
                       bool skipMissingComponentOptimization ,
                       bool positiveSystem ,
-                      bool verbose) {
+                      bool verbose ,
+                      std::string samplerMethod ,
+                      const int maxTreeDepth ,
+                      std::string adaptMethod ,
+                      std::string metric ,
+                      const double targetAcceptRate ,
+                      const int nChains ,
+                      const int seed ,
+                      const int thin ,
+                      std::string sampleFile ,
+                      bool recordLlik ,
+                      bool recordX ,
+                      const arma::vec recordXComponents ,
+                      const arma::vec recordXTimes ,
+                      bool recordTheta ,
+                      bool recordSigma ,
+                      bool singlePrecision ,
+                      bool continueEpochs ,
+                      const double epochBurninRatio ,
+                      std::string checkpointFile ,
+                      const unsigned int checkpointEvery ,
+                      const arma::vec temperatures ,
+                      bool adaptTemperatures ,
+                      std::string optimizerMethod ,
+                      bool transformBounds ,
+                      std::string integrator ,
+                      std::string lengthAdaptation ,
+                      std::string blocking ,
+                      const unsigned int sgWindow ,
+                      const double sgFriction ,
+                      const double maxSeconds ,
+                      const double targetEss ,
+                      const double targetRhat ,
+                      const unsigned int stopCheckEvery ,
+                      const unsigned int smcMoves) {
 
     MagiSolver solver(yFull,
                       odeModel,
@@ -58,7 +92,41 @@ MagiSolver solveMagiPy(const arma::mat & yFull,
                       useFixedSigma,
                       skipMissingComponentOptimization,
                       positiveSystem,
-                      verbose);
+                      verbose,
+                      std::move(samplerMethod),
+                      maxTreeDepth,
+                      std::move(adaptMethod),
+                      std::move(metric),
+                      targetAcceptRate,
+                      nChains,
+                      seed,
+                      thin,
+                      std::move(sampleFile),
+                      recordLlik,
+                      recordX,
+                      recordXComponents,
+                      recordXTimes,
+                      recordTheta,
+                      recordSigma,
+                      singlePrecision,
+                      continueEpochs,
+                      epochBurninRatio,
+                      std::move(checkpointFile),
+                      checkpointEvery,
+                      temperatures,
+                      adaptTemperatures,
+                      std::move(optimizerMethod),
+                      transformBounds,
+                      std::move(integrator),
+                      std::move(lengthAdaptation),
+                      std::move(blocking),
+                      sgWindow,
+                      sgFriction,
+                      maxSeconds,
+                      targetEss,
+                      targetRhat,
+                      stopCheckEvery,
+                      smcMoves);
     solver.setupPhiSigma();
     if(verbose){
         std::cout << "phi = \n" << solver.phiAllDimensions << "\n";
@@ -66,7 +134,11 @@ MagiSolver solveMagiPy(const arma::mat & yFull,
     solver.initXmudotmu();
     solver.initTheta();
     solver.initMissingComponent();
-    solver.sampleInEpochs();
+    if(solver.samplerMethod == "map" || solver.samplerMethod == "laplace"){
+        solver.optimizeInEpochs();
+    }else{
+        solver.sampleInEpochs();
+    }
 //    return solver.llikxthetasigmaSamples;
     return solver;
 }
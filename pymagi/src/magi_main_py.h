@@ -33,6 +33,40 @@ MagiSolver solveMagiPy(const arma::mat & yFull,
                        bool useFixedSigma = false,
                        bool skipMissingComponentOptimization = false,
                        bool positiveSystem = false,
-                       bool verbose = false);
+                       bool verbose = false,
+                       std::string samplerMethod = "hmc",
+                       const int maxTreeDepth = 10,
+                       std::string adaptMethod = "legacy",
+                       std::string metric = "diag",
+                       const double targetAcceptRate = 0.8,
+                       const int nChains = 1,
+                       const int seed = -1,
+                       const int thin = 1,
+                       std::string sampleFile = "",
+                       bool recordLlik = true,
+                       bool recordX = true,
+                       const arma::vec recordXComponents = arma::vec(),
+                       const arma::vec recordXTimes = arma::vec(),
+                       bool recordTheta = true,
+                       bool recordSigma = true,
+                       bool singlePrecision = false,
+                       bool continueEpochs = false,
+                       const double epochBurninRatio = 0.1,
+                       std::string checkpointFile = "",
+                       const unsigned int checkpointEvery = 0,
+                       const arma::vec temperatures = arma::vec(),
+                       bool adaptTemperatures = false,
+                       std::string optimizerMethod = "lbfgsb",
+                       bool transformBounds = false,
+                       std::string integrator = "leapfrog",
+                       std::string lengthAdaptation = "fixed",
+                       std::string blocking = "joint",
+                       const unsigned int sgWindow = 100,
+                       const double sgFriction = 0.1,
+                       const double maxSeconds = 0,
+                       const double targetEss = 0,
+                       const double targetRhat = 0,
+                       const unsigned int stopCheckEvery = 100,
+                       const unsigned int smcMoves = 5);
 
 #endif //MAGI_MULTI_LANG_MAGI_MAIN_PY_H
@@ -10,8 +10,14 @@
 
 #include <tgtdistr.h>
 #include <hmc.h>
+#include <nuts.h>
+#include <rng.h>
+#include <diagnostics.h>
+#include <smc.h>
+#include <boundtransform.h>
 #include <gpsmoothing.h>
 #include <classDefinition.h>
+#include <testingUtilities.h>
 #include "magi_main_py.h"
 
 
@@ -250,6 +256,19 @@ PYBIND11_MODULE(pymagi, macro)
         .def_readwrite("trajq", &hmcstate::trajq)
         .def_readwrite("trajp", &hmcstate::trajp);
 
+    py::class_< BoundTransform >(macro, "BoundTransform")
+        .def(py::init< const arma::vec &, const arma::vec & >(), py::arg("lb"), py::arg("ub"))
+        .def("toUnconstrained",
+             static_cast<arma::vec (BoundTransform::*)(const arma::vec &) const>(&BoundTransform::toUnconstrained),
+             py::arg("q"))
+        .def("toUnconstrained",
+             static_cast<lp (BoundTransform::*)(const arma::vec &, const lp &) const>(&BoundTransform::toUnconstrained),
+             py::arg("u"),
+             py::arg("lpq"))
+        .def("toConstrained",
+             static_cast<arma::vec (BoundTransform::*)(const arma::vec &) const>(&BoundTransform::toConstrained),
+             py::arg("u"));
+
     /*
      * cpp functions
      */
@@ -262,9 +281,47 @@ PYBIND11_MODULE(pymagi, macro)
         py::arg("dist"),
         py::arg("kernel"));
 
+    macro.def(
+        "effectiveSampleSize",
+        &effectiveSampleSize,
+        "",
+        py::arg("draws"));
+
+    macro.def(
+        "splitRhat",
+        &splitRhat,
+        "",
+        py::arg("draws"));
+
+    macro.def(
+        "bulkEffectiveSampleSize",
+        &bulkEffectiveSampleSize,
+        "",
+        py::arg("draws"));
+
     /*
      * cpp class with functionals
      */
+    py::class_< TemperedSmc >(macro, "TemperedSmc")
+        .def(py::init<>())
+        .def_readwrite("target", &TemperedSmc::target)
+        .def_readwrite("slope", &TemperedSmc::slope)
+        .def_readwrite("lb", &TemperedSmc::lb)
+        .def_readwrite("ub", &TemperedSmc::ub)
+        .def_readwrite("nsteps", &TemperedSmc::nsteps)
+        .def_readwrite("nMoves", &TemperedSmc::nMoves)
+        .def_readonly("particles", &TemperedSmc::particles)
+        .def_readonly("lambdas", &TemperedSmc::lambdas)
+        .def_readonly("logEvidence", &TemperedSmc::logEvidence)
+        .def("run",
+             [](TemperedSmc & smc, const arma::mat & initialParticles, const arma::vec & initialLogWeights,
+                uint64_t seed) {
+                 smc.run(initialParticles, initialLogWeights, seed, nullptr, false);
+             },
+             py::arg("initialParticles"),
+             py::arg("initialLogWeights"),
+             py::arg("seed"));
+
     py::class_< OdeSystem >(macro, "OdeSystem")
         .def(py::init<>())
         .def_readwrite("fOde", &OdeSystem::fOde)
@@ -283,7 +340,8 @@ PYBIND11_MODULE(pymagi, macro)
      */
     macro.def(
         "basic_hmcC",
-        &basic_hmcC,
+        static_cast<hmcstate (*)(const std::function<lp (arma::vec)> &, const arma::vec &, const arma::vec &,
+                                 arma::vec, arma::vec, int, bool)>(&basic_hmcC),
         "",
         py::arg("lpr"),
         py::arg("initial"),
@@ -293,17 +351,115 @@ PYBIND11_MODULE(pymagi, macro)
         py::arg("nsteps"),
         py::arg("traj"));
 
+    macro.def(
+        "lpnormal",
+        &lpnormal,
+        "",
+        py::arg("x"));
+
+    py::class_< RandomStream >(macro, "RandomStream")
+        .def(py::init< uint64_t, uint64_t >(), py::arg("seed") = 0, py::arg("streamId") = 0)
+        .def("uniform", static_cast<arma::vec (RandomStream::*)(unsigned int)>(&RandomStream::uniform), py::arg("n"))
+        .def("normal", static_cast<arma::vec (RandomStream::*)(unsigned int)>(&RandomStream::normal), py::arg("n"));
+
+    // basic_hmcC drawing its momentum from rng, with a choice of integrator
+    macro.def(
+        "basic_hmcC",
+        [](const std::function<lp (arma::vec)> & lpr, const arma::vec & initial, const arma::vec & step,
+           const arma::vec & lb, const arma::vec & ub, const int nsteps, RandomStream & rng,
+           const std::string & integrator) {
+            return basic_hmcC(lpr, initial, step, lb, ub, nsteps, false, rng, 0, integrator);
+        },
+        "",
+        py::arg("lpr"),
+        py::arg("initial"),
+        py::arg("step"),
+        py::arg("lb"),
+        py::arg("ub"),
+        py::arg("nsteps"),
+        py::arg("rng"),
+        py::arg("integrator") = "leapfrog");
+
+    // split_hmcC with a single Gaussian block over every coordinate
+    macro.def(
+        "split_hmcC",
+        [](const std::function<lp (arma::vec)> & lpr, const arma::mat & precision, const arma::vec & center,
+           const arma::vec & initial, const arma::vec & step, const arma::vec & lb, const arma::vec & ub,
+           const int nsteps, RandomStream & rng) {
+            GaussianSplit split;
+            split.blocks = {arma::regspace<arma::uvec>(0, initial.size() - 1)};
+            split.centers = {center};
+            split.precisions = {precision};
+            return split_hmcC(lpr, split, initial, step, lb, ub, nsteps, false, rng);
+        },
+        "",
+        py::arg("lpr"),
+        py::arg("precision"),
+        py::arg("center"),
+        py::arg("initial"),
+        py::arg("step"),
+        py::arg("lb"),
+        py::arg("ub"),
+        py::arg("nsteps"),
+        py::arg("rng"));
+
+    macro.def(
+        "nuts_hmcC",
+        [](const std::function<lp (arma::vec)> & lpr, const arma::vec & initial, const arma::vec & step,
+           const arma::vec & lb, const arma::vec & ub, RandomStream & rng, const int maxTreeDepth) {
+            return nuts_hmcC(lpr, initial, step, lb, ub, rng, maxTreeDepth);
+        },
+        "",
+        py::arg("lpr"),
+        py::arg("initial"),
+        py::arg("step"),
+        py::arg("lb"),
+        py::arg("ub"),
+        py::arg("rng"),
+        py::arg("maxTreeDepth") = 10);
+
     py::class_< MagiSolver >(macro, "MagiSolver")
         .def_readwrite("phiAllDimensions", &MagiSolver::phiAllDimensions)
         .def_readwrite("sigmaInit", &MagiSolver::sigmaInit)
         .def_readwrite("xInit", &MagiSolver::xInit)
         .def_readwrite("thetaInit", &MagiSolver::thetaInit)
-        .def_readwrite("llikxthetasigmaSamples", &MagiSolver::llikxthetasigmaSamples);
+        .def_readwrite("llikxthetasigmaSamples", &MagiSolver::llikxthetasigmaSamples)
+        .def_readwrite("gradientsPerEss", &MagiSolver::gradientsPerEss)
+        .def_readwrite("thetaRhat", &MagiSolver::thetaRhat)
+        .def_readwrite("thetaBulkEss", &MagiSolver::thetaBulkEss)
+        .def_readwrite("thetaTailEss", &MagiSolver::thetaTailEss)
+        .def_readwrite("xthetasigmaMean", &MagiSolver::xthetasigmaMean)
+        .def_readwrite("xthetasigmaSd", &MagiSolver::xthetasigmaSd)
+        .def_readwrite("xthetasigmaQuantiles", &MagiSolver::xthetasigmaQuantiles)
+        .def_readwrite("thetaOnlineEss", &MagiSolver::thetaOnlineEss)
+        .def_readwrite("swapAcceptRate", &MagiSolver::swapAcceptRate)
+        .def_readwrite("roundTripRate", &MagiSolver::roundTripRate)
+        .def_readwrite("logEvidence", &MagiSolver::logEvidence)
+        .def_readwrite("stopReason", &MagiSolver::stopReason)
+        .def_property_readonly("temperatureLadder", [](const MagiSolver & solver) {
+            return arma::conv_to< std::vector< double > >::from(solver.ladder.temperature);
+        })
+        .def_property_readonly("recordedRows", [](const MagiSolver & solver) {
+            return arma::conv_to< std::vector< arma::uword > >::from(solver.recordLayout.recorded);
+        })
+        .def_property_readonly("epochIterations", [](const MagiSolver & solver) {
+            return arma::conv_to< std::vector< arma::uword > >::from(solver.epochIterations);
+        })
+        .def_property_readonly("llikxthetasigmaSamplesFloat", [](const MagiSolver & solver) {
+            const arma::fcube & samples = solver.llikxthetasigmaSamplesFloat;
+            return py::array_t< float >(
+                {samples.n_rows, samples.n_cols, samples.n_slices},
+                {sizeof(float), sizeof(float) * samples.n_rows, sizeof(float) * samples.n_rows * samples.n_cols},
+                samples.memptr());
+        });
 
+    // chains run on worker threads that call back into python for the ode,
+    // so the GIL must not be held while sampling
     macro.def(
         "solveMagiPy",
         &solveMagiPy,
         "",
+        py::call_guard<py::gil_scoped_release>(),
         py::arg("yFull"),
         py::arg("odeModel"),
         py::arg("tvecFull"),
@@ -330,7 +486,41 @@ PYBIND11_MODULE(pymagi, macro)
         py::arg("useFixedSigma"),
         py::arg("skipMissingComponentOptimization"),
         py::arg("positiveSystem"),
-        py::arg("verbose"));
+        py::arg("verbose"),
+        py::arg("samplerMethod") = "hmc",
+        py::arg("maxTreeDepth") = 10,
+        py::arg("adaptMethod") = "legacy",
+        py::arg("metric") = "diag",
+        py::arg("targetAcceptRate") = 0.8,
+        py::arg("nChains") = 1,
+        py::arg("seed") = -1,
+        py::arg("thin") = 1,
+        py::arg("sampleFile") = "",
+        py::arg("recordLlik") = true,
+        py::arg("recordX") = true,
+        py::arg("recordXComponents") = arma::vec(),
+        py::arg("recordXTimes") = arma::vec(),
+        py::arg("recordTheta") = true,
+        py::arg("recordSigma") = true,
+        py::arg("singlePrecision") = false,
+        py::arg("continueEpochs") = false,
+        py::arg("epochBurninRatio") = 0.1,
+        py::arg("checkpointFile") = "",
+        py::arg("checkpointEvery") = 0,
+        py::arg("temperatures") = arma::vec(),
+        py::arg("adaptTemperatures") = false,
+        py::arg("optimizerMethod") = "lbfgsb",
+        py::arg("transformBounds") = false,
+        py::arg("integrator") = "leapfrog",
+        py::arg("lengthAdaptation") = "fixed",
+        py::arg("blocking") = "joint",
+        py::arg("sgWindow") = 100,
+        py::arg("sgFriction") = 0.1,
+        py::arg("maxSeconds") = 0.0,
+        py::arg("targetEss") = 0.0,
+        py::arg("targetRhat") = 0.0,
+        py::arg("stopCheckEvery") = 100,
+        py::arg("smcMoves") = 5);
 
     macro.def(
         "gpsmooth",
@@ -363,6 +553,40 @@ PYBIND11_MODULE(pymagi, macro)
         py::arg("xOutput"),
         py::arg("phiCandidates"),
         py::arg("sigmaCandidates"),
-        py::arg("kerneltype"));          
+        py::arg("kerneltype"));
+
+    macro.def(
+        "integratorBenchmark",
+        &integratorBenchmark,
+        "",
+        py::arg("modelName") = "FN",
+        py::arg("niterHmc") = 2000,
+        py::arg("nstepsHmc") = 20,
+        py::arg("seed") = 2024);
+
+    macro.def(
+        "laplaceGaussianEvidence",
+        &laplaceGaussianEvidence,
+        "",
+        py::arg("nb") = 30,
+        py::arg("nd") = 3,
+        py::arg("bandwidth") = 2,
+        py::arg("seed") = 2024);
+
+    macro.def(
+        "hessianVectorCheck",
+        &hessianVectorCheck,
+        "",
+        py::arg("modelName") = "FN",
+        py::arg("seed") = 2024);
+
+    macro.def(
+        "windowedGradientCheck",
+        &windowedGradientCheck,
+        "",
+        py::arg("modelName") = "FN",
+        py::arg("window") = 10,
+        py::arg("nDraws") = 2000,
+        py::arg("seed") = 2024);
 }
 
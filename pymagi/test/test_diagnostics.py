@@ -0,0 +1,32 @@
+import numpy as np
+from pymagi import ArmaVector, ArmaMatrix, effectiveSampleSize, splitRhat, bulkEffectiveSampleSize
+import unittest
+
+
+class DiagnosticsTest(unittest.TestCase):
+    def test_independent_chains(self):
+        np.random.seed(2024)
+        draws = np.random.normal(size=[1000, 4])
+        self.assertLess(splitRhat(ArmaMatrix(draws).t()), 1.01)
+        ess = bulkEffectiveSampleSize(ArmaMatrix(draws).t())
+        self.assertGreater(ess, 0.75 * draws.size)
+        self.assertLess(ess, 1.25 * draws.size)
+
+    def test_separated_chains(self):
+        np.random.seed(2024)
+        draws = np.random.normal(size=[1000, 4])
+        draws[:, 3] += 2
+        self.assertGreater(splitRhat(ArmaMatrix(draws).t()), 1.1)
+
+    def test_autoregressive_ess(self):
+        # an AR(1) chain with coefficient phi has ESS n (1 - phi) / (1 + phi)
+        np.random.seed(2024)
+        phi = 0.9
+        n = 20000
+        draws = np.zeros(n)
+        for i in range(1, n):
+            draws[i] = phi * draws[i - 1] + np.random.normal()
+        expected = n * (1 - phi) / (1 + phi)
+        ess = effectiveSampleSize(ArmaVector(draws))
+        self.assertGreater(ess, 0.7 * expected)
+        self.assertLess(ess, 1.3 * expected)
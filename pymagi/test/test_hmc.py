@@ -24,3 +24,26 @@ class HmcTest(unittest.TestCase):
                          traj=False)
         self.assertEqual(out.final.size(), 2)
         self.assertEqual(llk(out.final).value, out.lprvalue)
+
+    def test_hmc_reflects_at_bounds(self):
+        # a standard normal truncated to the positive quadrant, reached by reflecting at lb
+        def llk(x):
+            x = vector(x)
+            llik = lp()
+            llik.value = -0.5 * np.sum(np.square(x))
+            llik.gradient = ArmaVector(-x)
+            return llik
+        x = ArmaVector([0.05, 0.05])
+        draws = np.zeros([2000, 2])
+        for i in range(draws.shape[0]):
+            out = basic_hmcC(lpr=llk,
+                             initial=x,
+                             step=ArmaVector([0.3, 0.3]),
+                             lb=ArmaVector([0, 0]),
+                             ub=ArmaVector([np.Inf, np.Inf]),
+                             nsteps=20,
+                             traj=False)
+            x = out.final
+            draws[i, :] = vector(x)
+        self.assertTrue(np.all(draws >= 0))
+        self.assertLess(np.max(np.abs(draws.mean(axis=0) - np.sqrt(2 / np.pi))), 0.1)
@@ -0,0 +1,24 @@
+import numpy as np
+from pymagi import laplaceGaussianEvidence, hessianVectorCheck, windowedGradientCheck
+import unittest
+from arma import vector, matrix
+
+
+class PosteriorTest(unittest.TestCase):
+    def test_laplace_evidence_of_gaussian(self):
+        # exact for a Gaussian, with the Hessian from finite differences on the banded layout
+        for bandwidth in [1, 3]:
+            laplace, exact = vector(laplaceGaussianEvidence(nb=30, nd=3, bandwidth=bandwidth, seed=7))
+            self.assertAlmostEqual(laplace, exact, delta=1e-5 * abs(exact) + 1e-6)
+
+    def test_hessian_vector_product(self):
+        for modelName in ["FN", "Hes1"]:
+            check = matrix(hessianVectorCheck(modelName=modelName, seed=11))
+            hvp = check[:, 0]
+            difference = check[:, 1]
+            np.testing.assert_allclose(hvp, difference, rtol=1e-4, atol=1e-4 * np.max(np.abs(difference)))
+
+    def test_windowed_gradient_is_unbiased(self):
+        check = matrix(windowedGradientCheck(modelName="FN", window=10, nDraws=2000, seed=13)).copy()
+        estimate, exact, se = check[:, 0], check[:, 1], check[:, 2]
+        self.assertTrue(np.all(np.abs(estimate - exact) < 5 * se + 1e-8 * (np.abs(exact) + 1)))
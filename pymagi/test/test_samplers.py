@@ -0,0 +1,213 @@
+import numpy as np
+from pymagi import ArmaVector, ArmaMatrix, BoundTransform, RandomStream, TemperedSmc, lp, lpnormal, basic_hmcC, \
+    integratorBenchmark, nuts_hmcC, split_hmcC
+import unittest
+from arma import vector, matrix
+
+
+class NutsTest(unittest.TestCase):
+    def test_nuts_normal_moments(self):
+        dim = 4
+        rng = RandomStream(2019, 0)
+        x = ArmaVector(np.zeros(dim))
+        draws = np.zeros([2000, dim])
+        for i in range(draws.shape[0]):
+            out = nuts_hmcC(lpr=lpnormal,
+                            initial=x,
+                            step=ArmaVector(np.repeat(0.5, dim)),
+                            lb=ArmaVector(np.repeat(-np.inf, dim)),
+                            ub=ArmaVector(np.repeat(np.inf, dim)),
+                            rng=rng)
+            x = out.final
+            draws[i, :] = vector(x)
+        self.assertLess(np.max(np.abs(draws.mean(axis=0))), 0.15)
+        self.assertLess(np.max(np.abs(draws.var(axis=0) - 1)), 0.2)
+
+    def test_nuts_scaled_normal_moments(self):
+        # a step far from the scale of either coordinate, so trajectories turn within a few steps
+        # on one and take many on the other, where merged subtrees are checked across
+        scale = np.array([0.3, 3.0])
+        def lpr(z):
+            z = vector(z) / scale
+            ret = lp()
+            ret.value = -0.5 * z.dot(z)
+            ret.gradient = ArmaVector(-z / scale)
+            return ret
+
+        rng = RandomStream(2020, 0)
+        x = ArmaVector(np.zeros(2))
+        draws = np.zeros([3000, 2])
+        for i in range(draws.shape[0]):
+            out = nuts_hmcC(lpr=lpr,
+                            initial=x,
+                            step=ArmaVector(np.repeat(0.2, 2)),
+                            lb=ArmaVector(np.repeat(-np.inf, 2)),
+                            ub=ArmaVector(np.repeat(np.inf, 2)),
+                            rng=rng)
+            x = out.final
+            draws[i, :] = vector(x)
+        np.testing.assert_allclose(draws.mean(axis=0) / scale, 0, atol=0.15)
+        np.testing.assert_allclose(draws.std(axis=0) / scale, 1, atol=0.1)
+
+
+class RandomStreamTest(unittest.TestCase):
+    def test_streams(self):
+        first = vector(RandomStream(7, 0).uniform(1000)).copy()
+        again = vector(RandomStream(7, 0).uniform(1000)).copy()
+        other = vector(RandomStream(7, 1).uniform(1000)).copy()
+        np.testing.assert_array_equal(first, again)
+        self.assertFalse(np.any(first == other))
+        self.assertTrue(np.all((first > 0) & (first < 1)))
+        self.assertLess(abs(np.corrcoef(first, other)[0, 1]), 0.1)
+
+    def test_moments(self):
+        uniform = vector(RandomStream(11, 3).uniform(100000)).copy()
+        normal = vector(RandomStream(11, 4).normal(100000)).copy()
+        self.assertLess(abs(uniform.mean() - 0.5), 0.005)
+        self.assertLess(abs(uniform.var() - 1 / 12.0), 0.002)
+        self.assertLess(abs(normal.mean()), 0.015)
+        self.assertLess(abs(normal.var() - 1), 0.02)
+
+
+class TemperedSmcTest(unittest.TestCase):
+    def test_gaussian_evidence(self):
+        # from N(0, I) to N(0, I / (1 + c)): the evidence is (1 + c)^(-dim / 2)
+        dim = 2
+        c = 3.0
+        def target(z, lam):
+            z = vector(z)
+            ret = lp()
+            ret.value = -0.5 * (1 + lam * c) * np.sum(np.square(z)) - 0.5 * dim * np.log(2 * np.pi)
+            ret.gradient = ArmaVector(-(1 + lam * c) * z)
+            return ret
+        def slope(z):
+            return -0.5 * c * np.sum(np.square(vector(z)))
+        smc = TemperedSmc()
+        smc.target = target
+        smc.slope = slope
+        smc.lb = ArmaVector(np.repeat(-np.inf, dim))
+        smc.ub = ArmaVector(np.repeat(np.inf, dim))
+        smc.nsteps = 5
+        smc.nMoves = 2
+        np.random.seed(2024)
+        # rows of the numpy array become the columns, one per particle
+        smc.run(initialParticles=ArmaMatrix(np.random.normal(size=[400, dim])),
+                initialLogWeights=ArmaVector(np.zeros(400)),
+                seed=1)
+        self.assertLess(abs(smc.logEvidence + 0.5 * dim * np.log(1 + c)), 0.15)
+        particles = matrix(smc.particles)
+        self.assertEqual(particles.shape, (dim, 400))
+        self.assertLess(np.max(np.abs(particles.var(axis=1) - 1 / (1 + c))), 0.06)
+
+
+class SplitHmcTest(unittest.TestCase):
+    precision = np.array([[2.0, 0.8], [0.8, 1.0]])
+    center = np.array([1.0, -1.0])
+
+    def lpr(self, z):
+        z = vector(z) - self.center
+        ret = lp()
+        ret.value = -0.5 * z.dot(self.precision).dot(z)
+        ret.gradient = ArmaVector(-self.precision.dot(z))
+        return ret
+
+    def run_chain(self, splitPrecision, niter):
+        rng = RandomStream(42, 0)
+        x = ArmaVector(self.center.copy())
+        draws = np.zeros([niter, 2])
+        accepts = np.zeros(niter)
+        for i in range(niter):
+            out = split_hmcC(lpr=self.lpr,
+                             precision=ArmaMatrix(splitPrecision),
+                             center=ArmaVector(self.center),
+                             initial=x,
+                             step=ArmaVector([0.4, 0.4]),
+                             lb=ArmaVector([-np.inf, -np.inf]),
+                             ub=ArmaVector([np.inf, np.inf]),
+                             nsteps=5,
+                             rng=rng)
+            x = out.final
+            draws[i, :] = vector(x)
+            accepts[i] = out.acc
+        return draws, accepts
+
+    def test_exact_gaussian_part(self):
+        # nothing is left outside the Gaussian part, so the flow is exact and every move accepted
+        draws, accepts = self.run_chain(self.precision, 200)
+        self.assertTrue(np.all(accepts == 1))
+
+    def test_invariance_with_remainder(self):
+        # a Gaussian part of the wrong scale leaves a quadratic remainder to the leapfrog
+        draws, accepts = self.run_chain(0.7 * self.precision, 3000)
+        np.testing.assert_allclose(draws.mean(axis=0), self.center, atol=0.1)
+        np.testing.assert_allclose(np.cov(draws.T), np.linalg.inv(self.precision), atol=0.1)
+
+
+class IntegratorTest(unittest.TestCase):
+    def run_chain(self, integrator, niter=2000, dim=4):
+        rng = RandomStream(2021, 0)
+        x = ArmaVector(np.zeros(dim))
+        draws = np.zeros([niter, dim])
+        for i in range(niter):
+            out = basic_hmcC(lpr=lpnormal,
+                             initial=x,
+                             step=ArmaVector(np.repeat(0.6, dim)),
+                             lb=ArmaVector(np.repeat(-np.inf, dim)),
+                             ub=ArmaVector(np.repeat(np.inf, dim)),
+                             nsteps=4,
+                             rng=rng,
+                             integrator=integrator)
+            x = out.final
+            draws[i, :] = vector(x)
+        return draws
+
+    def test_normal_moments(self):
+        for integrator in ["leapfrog", "twostage", "threestage"]:
+            draws = self.run_chain(integrator)
+            self.assertLess(np.max(np.abs(draws.mean(axis=0))), 0.15, integrator)
+            self.assertLess(np.max(np.abs(draws.var(axis=0) - 1)), 0.2, integrator)
+
+    def test_unknown_integrator(self):
+        with self.assertRaises(RuntimeError):
+            self.run_chain("euler", niter=1)
+
+    def test_benchmark(self):
+        benchmark = matrix(integratorBenchmark(niterHmc=300, nstepsHmc=10)).copy()
+        self.assertEqual(benchmark.shape, (3, 3))
+        self.assertTrue(np.all(np.isfinite(benchmark) & (benchmark > 0)))
+
+
+class BoundTransformTest(unittest.TestCase):
+    # an identity, a lower, an upper and an interval coordinate
+    lb = np.array([-np.inf, 0.5, -np.inf, -1.0])
+    ub = np.array([np.inf, np.inf, 2.0, 3.0])
+
+    def setUp(self):
+        self.transform = BoundTransform(ArmaVector(self.lb), ArmaVector(self.ub))
+
+    def constrained(self, u):
+        return vector(self.transform.toConstrained(ArmaVector(u))).copy()
+
+    def test_round_trip(self):
+        q = np.array([-1.3, 2.0, 1.5, 0.4])
+        u = vector(self.transform.toUnconstrained(ArmaVector(q))).copy()
+        self.assertEqual(u[0], q[0])
+        np.testing.assert_allclose(self.constrained(u), q, rtol=1e-10)
+        inside = self.constrained(np.array([-30.0, -30.0, 30.0, 30.0]))
+        self.assertTrue(np.all((inside >= self.lb) & (inside <= self.ub)))
+
+    def test_log_jacobian(self):
+        def logDensity(u):
+            lpq = lpnormal(ArmaVector(self.constrained(u)))
+            out = self.transform.toUnconstrained(ArmaVector(u), lpq)
+            return out.value, vector(out.gradient).copy()
+
+        u = np.array([0.3, -0.7, 0.2, 1.1])
+        h = 1e-6
+        dqdu = np.array([(self.constrained(u + h * e) - self.constrained(u - h * e))[i] / (2 * h)
+                         for i, e in enumerate(np.eye(4))])
+        value, gradient = logDensity(u)
+        q = self.constrained(u)
+        self.assertAlmostEqual(value, -np.sum(q ** 2) / 2 + np.sum(np.log(np.abs(dqdu))), places=6)
+        numeric = np.array([(logDensity(u + h * e)[0] - logDensity(u - h * e)[0]) / (2 * h) for e in np.eye(4)])
+        np.testing.assert_allclose(gradient, numeric, atol=1e-5)
@@ -0,0 +1,330 @@
+import os
+import tempfile
+import numpy as np
+from pymagi import ArmaVector, ArmaMatrix, ArmaCube, OdeSystem, solveMagiPy
+import unittest
+from arma import vector, matrix, cube
+
+
+# FitzHugh-Nagumo, with V moved up by vOffset when a positive component is needed
+def fn_system(vOffset=0.0):
+    system = OdeSystem()
+    def fOde(theta, x, tvec):
+        theta = vector(theta)
+        x = matrix(x)
+        V = x[:, 0] - vOffset
+        R = x[:, 1]
+        Vdt = theta[2] * (V - pow(V, 3) / 3.0 + R)
+        Rdt = -1.0 / theta[2] * (V - theta[0] + theta[1] * R)
+        return ArmaMatrix(np.stack([Vdt, Rdt], axis=1).T.copy())
+
+    def fOdeDx(theta, x, tvec):
+        theta = vector(theta)
+        x = matrix(x)
+        resultDx = np.zeros(shape=[np.shape(x)[0], np.shape(x)[1], np.shape(x)[1]])
+        V = x[:, 0] - vOffset
+        resultDx[:, 0, 0] = theta[2] * (1 - np.square(V))
+        resultDx[:, 1, 0] = theta[2]
+        resultDx[:, 0, 1] = -1.0 / theta[2]
+        resultDx[:, 1, 1] = -1.0 * theta[1] / theta[2]
+        return ArmaCube(resultDx.T.copy())
+
+    def fOdeDtheta(theta, x, tvec):
+        theta = vector(theta)
+        x = matrix(x)
+        resultDtheta = np.zeros(shape=[np.shape(x)[0], np.shape(theta)[0], np.shape(x)[1]])
+        V = x[:, 0] - vOffset
+        R = x[:, 1]
+        resultDtheta[:, 2, 0] = V - pow(V, 3) / 3.0 + R
+        resultDtheta[:, 0, 1] = 1.0 / theta[2]
+        resultDtheta[:, 1, 1] = -R / theta[2]
+        resultDtheta[:, 2, 1] = 1.0 / pow(theta[2], 2) * (V - theta[0] + theta[1] * R)
+        return ArmaCube(resultDtheta.T.copy())
+
+    system.fOde = fOde
+    system.fOdeDx = fOdeDx
+    system.fOdeDtheta = fOdeDtheta
+    system.thetaLowerBound = ArmaVector(np.array([0, 0, 0]))
+    system.thetaUpperBound = ArmaVector(np.array([np.inf, np.inf, np.inf]))
+    system.name = "FN"
+    system.thetaSize = 3
+    return system
+
+
+# FN data simulated at theta = (0.2, 0.2, 3) with noise sd 0.2, observed at every other time point
+FN_THETA = np.array([0.2, 0.2, 3])
+FN_V = [-0.86, -0.26, 2.14, 1.94, 1.63, 1.75, 1.92, 1.39, 1.29, 1.59, 0.63, 0.78, -1.59, -1.92,
+        -1.56, -1.58, -1.26, -1.34, -0.62, -0.39, 1.58, 2.29, 1.69, 1.61, 1.88, 1.57, 1.28, 1.09,
+        1.21, 0.1, -1.66, -2.05, -1.55, -1.81, -1.72, -0.98, -0.77, -0.09, 1.87, 2.18, 1.67]
+FN_R = [0.94, 0.87, 0.62, 0.44, 0.07, 0.02, -0.55, -0.09, -0.66, -0.73, -0.73, -0.63, -0.85,
+        -0.55, 0.01, 0.43, 0.4, 0.57, 0.64, 1.26, 1.09, 0.46, 0.13, 0.14, -0.3, -0.53, -0.5,
+        -0.35, -1.03, -1.02, -0.6, -0.61, -0.05, 0.31, 0.82, 0.85, 0.64, 1.31, 0.78, 0.47, 0.35]
+FN_TIMES = 81
+# theta within [x, theta, sigma], one row further down in the draws after the log posterior
+THETA = slice(2 * FN_TIMES, 2 * FN_TIMES + 3)
+
+
+def solve_fn(system=None, vOffset=0.0, **options):
+    yFull = np.ndarray([FN_TIMES, 2])
+    yFull.fill(np.nan)
+    yFull[np.linspace(0, FN_TIMES - 1, num=41).astype(int), :] = np.stack([np.add(FN_V, vOffset), FN_R], axis=1)
+    arguments = dict(
+        yFull=ArmaMatrix(yFull).t(),
+        odeModel=fn_system(vOffset) if system is None else system,
+        tvecFull=ArmaVector(np.linspace(0, 20, num=FN_TIMES)),
+        sigmaExogenous=ArmaVector(np.ndarray(0)),
+        phiExogenous=ArmaMatrix(np.ndarray([0, 0])),
+        xInitExogenous=ArmaMatrix(np.ndarray([0, 0])),
+        thetaInitExogenous=ArmaVector(np.ndarray(0)),
+        muExogenous=ArmaMatrix(np.ndarray([0, 0])),
+        dotmuExogenous=ArmaMatrix(np.ndarray([0, 0])),
+        priorTemperatureLevel=1.0,
+        priorTemperatureDeriv=1.0,
+        priorTemperatureObs=1.0,
+        kernel="generalMatern",
+        nstepsHmc=20,
+        burninRatioHmc=0.5,
+        niterHmc=400,
+        stepSizeFactorHmc=ArmaVector(np.ndarray(0)),
+        nEpoch=1,
+        bandSize=20,
+        useFrequencyBasedPrior=True,
+        useBand=True,
+        useMean=False,
+        useScalerSigma=False,
+        useFixedSigma=False,
+        skipMissingComponentOptimization=False,
+        positiveSystem=False,
+        verbose=False,
+        seed=1)
+    arguments.update(options)
+    return solveMagiPy(**arguments)
+
+
+class SolveOptionsTest(unittest.TestCase):
+    def assertThetaNearTruth(self, result):
+        thetaMean = vector(result.xthetasigmaMean)[THETA]
+        self.assertTrue(np.all(np.abs(thetaMean - FN_THETA) < np.array([0.15, 0.3, 0.5])), thetaMean)
+
+    def test_windowed_adaptation(self):
+        for metric in ["diag", "dense"]:
+            self.assertThetaNearTruth(solve_fn(adaptMethod="windowed", metric=metric))
+
+    def test_x_bounds_of_the_model(self):
+        system = fn_system()
+        system.xUpperBound = ArmaVector(np.array([2.3, np.inf]))
+        result = solve_fn(system=system, transformBounds=True)
+        samples = cube(result.llikxthetasigmaSamples).copy()
+        self.assertTrue(np.all(samples[1:FN_TIMES + 1, :, :] <= 2.3))
+        self.assertThetaNearTruth(result)
+
+    def test_x_bounds_with_the_mean(self):
+        # V moved up to [1, 5] and bounded below by 0, with the GP mean mu in the likelihood; about
+        # half of the states have x < mu and stay valid, as the bound is on x and not on x - mu
+        system = fn_system(vOffset=3.0)
+        system.xLowerBound = ArmaVector(np.array([0, -np.inf]))
+        for transformBounds in [False, True]:
+            result = solve_fn(system=system, vOffset=3.0, useMean=True, transformBounds=transformBounds)
+            samples = cube(result.llikxthetasigmaSamples).copy()
+            self.assertTrue(np.all(samples[1:FN_TIMES + 1, :, :] >= 0))
+            self.assertTrue(np.all(samples[0, 200:, :] > -1e8))
+            self.assertThetaNearTruth(result)
+
+    def test_parallel_chains(self):
+        result = solve_fn(nChains=2)
+        self.assertEqual(result.llikxthetasigmaSamples.n_cols, 2 * 400)
+        rhat = matrix(result.thetaRhat)[:, 0]
+        self.assertTrue(np.all(np.isfinite(rhat)))
+        self.assertTrue(np.all(rhat < 1.5), rhat)
+
+    def test_seed_reproduces_chains(self):
+        first = matrix(solve_fn(nChains=2, seed=5).llikxthetasigmaSamples.slice(0)).copy()
+        again = matrix(solve_fn(nChains=2, seed=5).llikxthetasigmaSamples.slice(0)).copy()
+        np.testing.assert_array_equal(first, again)
+
+    def test_thinned_sample_file(self):
+        samples = cube(solve_fn(thin=2).llikxthetasigmaSamples).copy()
+        self.assertEqual(samples.shape[1], 200)
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "draws.bin")
+            result = solve_fn(thin=2, sampleFile=path)
+            self.assertEqual(result.llikxthetasigmaSamples.n_cols, 0)
+            # column major rows x draws x epochs, as the cube
+            stored = np.fromfile(path).reshape([1, samples.shape[1], samples.shape[0]])
+            np.testing.assert_array_equal(stored[0].T, samples[:, :, 0])
+
+    def test_online_summaries(self):
+        result = solve_fn()
+        # the summaries cover the draws after the burn-in of 200 iterations
+        draws = matrix(result.llikxthetasigmaSamples.slice(0))[1:, 200:]
+        np.testing.assert_allclose(vector(result.xthetasigmaMean), draws.mean(axis=1), rtol=1e-8, atol=1e-10)
+        np.testing.assert_allclose(vector(result.xthetasigmaSd), draws.std(axis=1, ddof=1), rtol=1e-6, atol=1e-10)
+        median = matrix(result.xthetasigmaQuantiles)[:, 1]
+        self.assertTrue(np.all(median >= np.quantile(draws, 0.2, axis=1)))
+        self.assertTrue(np.all(median <= np.quantile(draws, 0.8, axis=1)))
+
+    def test_selective_recording(self):
+        full = matrix(solve_fn().llikxthetasigmaSamples.slice(0)).copy()
+        result = solve_fn(recordX=False)
+        rows = np.array(result.recordedRows)
+        np.testing.assert_array_equal(rows, np.r_[0, 1 + 2 * FN_TIMES:full.shape[0]])
+        np.testing.assert_array_equal(matrix(result.llikxthetasigmaSamples.slice(0)), full[rows, :])
+        single = solve_fn(recordX=False, singlePrecision=True).llikxthetasigmaSamplesFloat
+        self.assertEqual(single.dtype, np.float32)
+        np.testing.assert_array_equal(single[:, :, 0], full[rows, :].astype(np.float32))
+
+    def test_epochs_continue_chains(self):
+        samples = cube(solve_fn(nEpoch=2, continueEpochs=True).llikxthetasigmaSamples).copy()
+        # the second epoch starts from the last state of the first
+        np.testing.assert_array_equal(samples[1:, 0, 1], samples[1:, -1, 0])
+
+    def test_checkpoint_resume_is_bit_exact(self):
+        calls = [0]
+        def interrupted_system(limit):
+            system = fn_system()
+            fOde = system.fOde
+            def fOdeCounted(theta, x, tvec):
+                calls[0] += 1
+                if limit is not None and calls[0] > limit:
+                    raise RuntimeError("interrupted")
+                return fOde(theta, x, tvec)
+            system.fOde = fOdeCounted
+            return system
+
+        with tempfile.TemporaryDirectory() as directory:
+            def solve_checkpointed(name, system=None):
+                return solve_fn(system=system,
+                                sampleFile=os.path.join(directory, name + ".bin"),
+                                checkpointFile=os.path.join(directory, name + ".checkpoint"),
+                                checkpointEvery=50)
+            solve_checkpointed("reference", interrupted_system(None))
+            total = calls[0]
+            calls[0] = 0
+            with self.assertRaises(RuntimeError):
+                solve_checkpointed("resumed", interrupted_system(total * 3 // 4))
+            solve_checkpointed("resumed")
+            np.testing.assert_array_equal(np.fromfile(os.path.join(directory, "resumed.bin")),
+                                          np.fromfile(os.path.join(directory, "reference.bin")))
+            # a checkpoint of other data or another configuration is rejected, naming what differs
+            changes = [("integrator", dict(integrator="twostage")),
+                       ("lengthAdaptation", dict(lengthAdaptation="jitter")),
+                       ("nstepsHmc", dict(nstepsHmc=10)),
+                       ("priorTemperature", dict(priorTemperatureLevel=2.0)),
+                       ("continueEpochs", dict(continueEpochs=True)),
+                       ("yFull", dict(vOffset=0.5, system=fn_system()))]
+            for what, change in changes:
+                with self.assertRaisesRegex(RuntimeError, "does not match: " + what):
+                    solve_fn(sampleFile=os.path.join(directory, "resumed.bin"),
+                             checkpointFile=os.path.join(directory, "resumed.checkpoint"),
+                             checkpointEvery=50, **change)
+
+    def test_parallel_tempering(self):
+        options = dict(nChains=2, seed=9, temperatures=ArmaVector(np.array([1, 1.5, 2.25])))
+        result = solve_fn(**options)
+        swapRate = matrix(result.swapAcceptRate)[:, 0]
+        self.assertEqual(swapRate.size, 2)
+        self.assertTrue(np.all((swapRate > 0) & (swapRate <= 1)), swapRate)
+        self.assertThetaNearTruth(result)
+        # the replicas run on the pool, yet a seed fixes every draw
+        np.testing.assert_array_equal(matrix(solve_fn(**options).llikxthetasigmaSamples.slice(0)),
+                                      matrix(result.llikxthetasigmaSamples.slice(0)))
+
+    def test_adaptive_ladder(self):
+        initial = np.array([1, 2, 4, 8])
+        result = solve_fn(nEpoch=2, temperatures=ArmaVector(initial), adaptTemperatures=True)
+        ladder = np.array(result.temperatureLadder)
+        # the end points stay, the inner temperatures move and stay ordered
+        self.assertEqual(ladder[0], 1)
+        self.assertEqual(ladder[-1], 8)
+        self.assertTrue(np.all(np.diff(ladder) > 0), ladder)
+        self.assertFalse(ladder.size == initial.size and np.all(ladder == initial), ladder)
+        roundTrips = vector(result.roundTripRate)
+        self.assertTrue(np.all(np.isfinite(roundTrips) & (roundTrips >= 0)), roundTrips)
+
+    def test_map_mode(self):
+        result = solve_fn(samplerMethod="map", nChains=2)
+        optima = matrix(result.llikxthetasigmaSamples.slice(0))
+        self.assertEqual(optima.shape[1], 2)
+        np.testing.assert_array_equal(vector(result.xthetasigmaSd), 0)
+        self.assertThetaNearTruth(result)
+        # the optimum beats a typical posterior draw
+        hmcLlik = matrix(solve_fn().llikxthetasigmaSamples.slice(0))[0, 200:]
+        self.assertGreater(np.max(optima[0, :]), np.median(hmcLlik))
+
+    def test_laplace_mode(self):
+        result = solve_fn(samplerMethod="laplace")
+        self.assertTrue(np.isfinite(vector(result.logEvidence)[0]))
+        self.assertTrue(np.all(vector(result.xthetasigmaSd) > 0))
+        self.assertThetaNearTruth(result)
+
+    def test_laplace_draws_respect_x_bounds(self):
+        # V peaks near 2, so the bound truncates the approximation around the peaks
+        system = fn_system()
+        system.xUpperBound = ArmaVector(np.array([2.15, np.inf]))
+        result = solve_fn(system=system, samplerMethod="laplace")
+        samples = cube(result.llikxthetasigmaSamples).copy()
+        self.assertTrue(np.all(samples[1:FN_TIMES + 1, :, :] <= 2.15))
+        self.assertThetaNearTruth(result)
+
+    def test_trajectory_length_adaptation(self):
+        for lengthAdaptation in ["jitter", "chees"]:
+            self.assertThetaNearTruth(solve_fn(lengthAdaptation=lengthAdaptation))
+        with self.assertRaises(RuntimeError):
+            solve_fn(lengthAdaptation="nuts")
+
+    def test_band_metric(self):
+        self.assertThetaNearTruth(solve_fn(adaptMethod="windowed", metric="band"))
+        with self.assertRaises(RuntimeError):
+            solve_fn(metric="band")
+
+    def test_component_blocking(self):
+        for samplerMethod in ["hmc", "nuts"]:
+            self.assertThetaNearTruth(solve_fn(blocking="components", samplerMethod=samplerMethod))
+        with self.assertRaises(RuntimeError):
+            solve_fn(blocking="components", lengthAdaptation="chees")
+
+    def test_elliptical_slice(self):
+        self.assertThetaNearTruth(solve_fn(samplerMethod="ellipticalslice"))
+        with self.assertRaises(RuntimeError):
+            solve_fn(samplerMethod="ellipticalslice", transformBounds=True)
+
+    def test_stochastic_gradient_hmc(self):
+        result = solve_fn(samplerMethod="sghmc", sgWindow=20)
+        self.assertTrue(np.all(np.isfinite(cube(result.llikxthetasigmaSamples))))
+        # the draws are approximate, so theta is held to wider bounds than the exact samplers
+        thetaMean = vector(result.xthetasigmaMean)[THETA]
+        self.assertTrue(np.all(np.abs(thetaMean - FN_THETA) < np.array([0.3, 0.6, 1.0])), thetaMean)
+        with self.assertRaises(RuntimeError):
+            solve_fn(samplerMethod="sghmc", useBand=False)
+
+    def assertStoppedAt(self, result, reason):
+        iterations = result.epochIterations[0]
+        self.assertEqual(result.stopReason, reason)
+        self.assertTrue(0 < iterations < 400, iterations)
+        samples = cube(result.llikxthetasigmaSamples)
+        # the draws kept are finite, past the log posterior of the start, and those the stopping
+        # rule left out NaN
+        self.assertTrue(np.all(np.isfinite(samples[1:, :iterations, 0])))
+        self.assertTrue(np.all(np.isfinite(samples[0, 1:iterations, 0])))
+        self.assertTrue(np.all(np.isnan(samples[:, iterations:, 0])))
+
+    def test_ess_stopping_rule(self):
+        result = solve_fn(targetEss=5, stopCheckEvery=20)
+        self.assertStoppedAt(result, "ess")
+        # the rule is only checked after the burn-in of 200 iterations
+        self.assertGreater(result.epochIterations[0], 200)
+        self.assertTrue(np.all(np.isfinite(vector(result.xthetasigmaMean))))
+        self.assertEqual(solve_fn(targetEss=1e6, stopCheckEvery=20).stopReason, "")
+
+    def test_deadline_in_burn_in(self):
+        result = solve_fn(maxSeconds=1e-6, stopCheckEvery=20, nEpoch=2)
+        self.assertStoppedAt(result, "deadline in burn-in")
+        self.assertLessEqual(result.epochIterations[0], 200)
+        self.assertEqual(result.epochIterations[1], 0)
+        # warmup draws are not posterior draws, so nothing is summarised or diagnosed
+        self.assertTrue(np.all(np.isnan(vector(result.xthetasigmaMean))))
+        self.assertTrue(np.all(np.isnan(vector(result.xthetasigmaSd))))
+        self.assertTrue(np.all(np.isnan(matrix(result.thetaBulkEss))))
+        self.assertTrue(np.all(np.isnan(matrix(result.thetaRhat))))
+        with self.assertRaises(RuntimeError):
+            solve_fn(maxSeconds=1, samplerMethod="map")